@@ -28,16 +28,20 @@ typedef size_t z_size_t;
 
 #include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #if !defined(_WIN32)
 #include <sys/mman.h>
@@ -52,6 +56,7 @@ typedef size_t z_size_t;
 #include "absl/debugging/internal/demangle.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/substitute.h"
@@ -60,6 +65,9 @@ typedef size_t z_size_t;
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "google/protobuf/text_format.h"
 #include "re.h"
+#include "reference_graph.h"
+#include "symbol_order.h"
+#include "template_family.h"
 #include "util.h"
 
 using absl::string_view;
@@ -82,10 +90,18 @@ constexpr DataSourceDefinition data_sources[] = {
     {DataSource::kArchiveMembers, "armembers", "the .o files in a .a file"},
     {DataSource::kCompileUnits, "compileunits",
      "source file for the .o file (translation unit). requires debug info."},
+    {DataSource::kDominators, "dominators",
+     "symbols with the size of everything only they refer to (retained "
+     "size)"},
+    {DataSource::kIdenticalCode, "icf",
+     "functions grouped with identical copies, with the bytes that identical "
+     "code folding would save"},
     {DataSource::kInputFiles, "inputfiles",
      "the filename specified on the Bloaty command-line"},
     {DataSource::kInlines, "inlines",
      "source line/file where inlined code came from.  requires debug info."},
+    {DataSource::kPages, "pages",
+     "VM pages of the loaded segments (size set with --page-size)"},
     {DataSource::kSections, "sections", "object file section"},
     {DataSource::kSegments, "segments", "load commands in the binary"},
     // We require that all symbols sources are >= kSymbols.
@@ -94,6 +110,8 @@ constexpr DataSourceDefinition data_sources[] = {
     {DataSource::kRawSymbols, "rawsymbols", "unmangled symbols"},
     {DataSource::kFullSymbols, "fullsymbols", "full demangled symbols"},
     {DataSource::kShortSymbols, "shortsymbols", "short demangled symbols"},
+    {DataSource::kTemplates, "templates",
+     "symbols grouped by template, with template arguments erased"},
 };
 
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
@@ -165,6 +183,15 @@ extern "C" char* __cxa_demangle(const char* mangled_name, char* buf, size_t* n,
                                 int* status);
 
 std::string ItaniumDemangle(string_view symbol, DataSource source) {
+  if (source == DataSource::kTemplates) {
+    std::string family;
+    if (TemplateFamily(symbol, &family)) {
+      return family;
+    }
+    // Names we can't parse are shown the way shortsymbols would show them.
+    source = DataSource::kShortSymbols;
+  }
+
   if (source != DataSource::kShortSymbols &&
       source != DataSource::kFullSymbols) {
     // No demangling.
@@ -248,23 +275,37 @@ std::string others_label = "[Other]";
 
 class Rollup {
  public:
+  // A rollup without a label pool can't have children.
   Rollup() {}
+
+  // Children are keyed by their id in |labels|, which must outlive the rollup.
+  // Rollups that are added together or compared must use the same pool.
+  explicit Rollup(LabelPool* labels) : labels_(labels) {}
+
   Rollup(const Rollup&) = delete;
   Rollup& operator=(const Rollup&) = delete;
 
   Rollup(Rollup&& other) = default;
   Rollup& operator=(Rollup&& other) = default;
 
-  void AddSizes(const std::vector<std::string>& names, uint64_t size,
-                bool is_vmsize) {
+  // |samples| and |relocs| are the number of profile samples and dynamic
+  // relocations that fall in this range, and are only counted for VM ranges.
+  // |compressed| is the range's share of the compressed file, and is only
+  // counted for file ranges.  |names| are ids in this rollup's label pool.
+  void AddSizes(const std::vector<uint32_t>& names, uint64_t size,
+                bool is_vmsize, uint64_t samples = 0, uint64_t relocs = 0,
+                uint64_t compressed = 0) {
     // We start at 1 to exclude the base map (see base_map_).
-    AddInternal(names, 1, size, is_vmsize);
+    AddInternal(names, 1, size, is_vmsize, samples, relocs, compressed);
   }
 
   // Prints a graphical representation of the rollup.
   void CreateRollupOutput(const Options& options, RollupOutput* output) const {
     CreateDiffModeRollupOutput(nullptr, options, output);
     output->diff_mode_ = false;
+    output->show_samples_ = options.has_profile_filename();
+    output->show_relocs_ = options.count_relocs();
+    output->show_compressed_ = options.compressed_size();
   }
 
   void CreateDiffModeRollupOutput(Rollup* base, const Options& options,
@@ -274,8 +315,12 @@ class Rollup {
     row->size.file = file_total_;
     row->filtered_size.vm = filtered_vm_total_;
     row->filtered_size.file = filtered_file_total_;
+    row->samples = samples_;
+    row->relocs = relocs_;
+    row->compressed = compressed_;
     row->vmpercent = 100;
     row->filepercent = 100;
+    row->compressedpercent = 100;
     if (base) {
       row->size.vm -= base->vm_total_;
       row->size.file -= base->file_total_;
@@ -286,29 +331,134 @@ class Rollup {
 
   void SetFilterRegex(const ReImpl* regex) { filter_regex_ = regex; }
 
-  // Add the values in "other" from this.
-  void Add(const Rollup& other) {
+  // Add the values in "other" to this, consuming "other" in the process.
+  // Subtrees that only exist in "other" are moved over wholesale (including
+  // their hash nodes), so we only recurse where both trees have the label.
+  // Since both use the same label pool, this only compares ids.
+  void Add(Rollup&& other) {
+    assert(other.children_.empty() || labels_ == other.labels_);
     vm_total_ += other.vm_total_;
     file_total_ += other.file_total_;
+    filtered_vm_total_ += other.filtered_vm_total_;
+    filtered_file_total_ += other.filtered_file_total_;
+    samples_ += other.samples_;
+    relocs_ += other.relocs_;
+    compressed_ += other.compressed_;
+
+    if (children_.empty()) {
+      children_ = std::move(other.children_);
+      return;
+    }
+
+    for (auto it = other.children_.begin(); it != other.children_.end();) {
+      auto other_child = it++;
+      auto child = children_.find(other_child->first);
+      if (child == children_.end()) {
+        children_.insert(other.children_.extract(other_child));
+      } else {
+        child->second->Add(std::move(*other_child->second));
+      }
+    }
+  }
+
+  // Stores this rollup in |node|.  Children are written in name order, so the
+  // output doesn't depend on hash order.
+  void ToPartialNode(PartialRollup::Node* node) const {
+    node->set_vm_size(vm_total_);
+    node->set_file_size(file_total_);
+    // These are usually zero, so leave them out to keep partials small.
+    if (filtered_vm_total_) node->set_filtered_vm_size(filtered_vm_total_);
+    if (filtered_file_total_) {
+      node->set_filtered_file_size(filtered_file_total_);
+    }
+    if (samples_) node->set_samples(samples_);
+    if (relocs_) node->set_relocs(relocs_);
+    if (compressed_) node->set_compressed_size(compressed_);
+
+    std::vector<const ChildMap::value_type*> children;
+    children.reserve(children_.size());
+    for (const auto& child : children_) {
+      children.push_back(&child);
+    }
+    std::sort(children.begin(), children.end(),
+              [this](const ChildMap::value_type* a,
+                     const ChildMap::value_type* b) {
+                return labels_->Get(a->first) < labels_->Get(b->first);
+              });
+    for (const auto* child : children) {
+      PartialRollup::Node* child_node = node->add_child();
+      child_node->set_name(labels_->Get(child->first));
+      child->second->ToPartialNode(child_node);
+    }
+  }
+
+  // Adds the values in |node| to this, like Add() does for a Rollup.
+  void AddPartialNode(const PartialRollup::Node& node) {
+    CheckedAdd(&vm_total_, node.vm_size());
+    CheckedAdd(&file_total_, node.file_size());
+    CheckedAdd(&filtered_vm_total_, node.filtered_vm_size());
+    CheckedAdd(&filtered_file_total_, node.filtered_file_size());
+    CheckedAdd(&samples_, node.samples());
+    CheckedAdd(&relocs_, node.relocs());
+    CheckedAdd(&compressed_, node.compressed_size());
+
+    for (const auto& child_node : node.child()) {
+      auto& child = children_[labels_->Intern(child_node.name())];
+      if (child.get() == nullptr) {
+        child.reset(new Rollup(labels_));
+      }
+      child->AddPartialNode(child_node);
+    }
+  }
 
-    for (const auto& other_child : other.children_) {
-      auto& child = children_[other_child.first];
-      if (child.get() == NULL) {
-        child.reset(new Rollup());
+  // Calls |func| with the label and rollup of every row |depth| levels below
+  // this one.
+  void ForEachAtDepth(
+      int depth,
+      const std::function<void(const std::string&, const Rollup&)>& func)
+      const {
+    for (const auto& child : children_) {
+      if (depth == 0) {
+        func(labels_->Get(child.first), *child.second);
+      } else {
+        child.second->ForEachAtDepth(depth - 1, func);
       }
-      child->Add(*other_child.second);
     }
   }
 
-  // Create entries for all children which exist in "other" but not in this.
-  void AddEntriesFrom(const Rollup& other) {
-    for (const auto& other_child : other.children_) {
-      auto& child = children_[other_child.first];
-      if (child.get() == NULL) {
-        child.reset(new Rollup());
+  // Relabels every row |depth| levels below this one with |relabel|, adding
+  // together rows that end up with the same label.
+  void RelabelAtDepth(
+      int depth, const std::function<std::string(const std::string&)>& relabel) {
+    if (depth > 0) {
+      for (auto& child : children_) {
+        child.second->RelabelAtDepth(depth - 1, relabel);
+      }
+      return;
+    }
+
+    ChildMap relabeled;
+    for (auto& child : children_) {
+      auto& dest =
+          relabeled[labels_->Intern(relabel(labels_->Get(child.first)))];
+      if (dest.get() == nullptr) {
+        dest = std::move(child.second);
+      } else {
+        dest->Add(std::move(*child.second));
       }
-      child->AddEntriesFrom(*other_child.second);
     }
+    children_ = std::move(relabeled);
+  }
+
+  // Filters a complete rollup like SetFilterRegex() does while ranges are
+  // added: keeps only the rows that have a label matching |regex| in their
+  // path from the root, and counts the rest as filtered out.  For labels that
+  // are only known once every range is in, like those of the "icf" source.
+  void FilterRows(const ReImpl& regex) {
+    Rollup removed;
+    RemoveUnmatchedRows(regex, &removed);
+    CheckedAdd(&filtered_vm_total_, removed.vm_total_);
+    CheckedAdd(&filtered_file_total_, removed.file_total_);
   }
 
   int64_t file_total() const { return file_total_; }
@@ -319,34 +469,31 @@ class Rollup {
   int64_t file_total_ = 0;
   int64_t filtered_vm_total_ = 0;
   int64_t filtered_file_total_ = 0;
+  int64_t samples_ = 0;
+  int64_t relocs_ = 0;
+  int64_t compressed_ = 0;
 
   const ReImpl* filter_regex_ = nullptr;
+  LabelPool* labels_ = nullptr;
 
   // Putting Rollup by value seems to work on some compilers/libs but not
   // others.
-  typedef std::unordered_map<std::string, std::unique_ptr<Rollup>> ChildMap;
+  typedef std::unordered_map<uint32_t, std::unique_ptr<Rollup>> ChildMap;
   ChildMap children_;
-  static Rollup* empty_;
-
-  static Rollup* GetEmpty() {
-    if (!empty_) {
-      empty_ = new Rollup();
-    }
-    return empty_;
-  }
 
   // Adds "size" bytes to the rollup under the label names[i].
   // If there are more entries names[i+1, i+2, etc] add them to sub-rollups.
-  void AddInternal(const std::vector<std::string>& names, size_t i,
-                   uint64_t size, bool is_vmsize) {
+  void AddInternal(const std::vector<uint32_t>& names, size_t i,
+                   uint64_t size, bool is_vmsize, uint64_t samples,
+                   uint64_t relocs, uint64_t compressed) {
     if (filter_regex_ != nullptr) {
       // filter_regex_ is only set in the root rollup, which checks the full
       // label hierarchy for a match to determine whether a region should be
       // considered.
       bool any_matched = false;
 
-      for (const auto& name : names) {
-        if (ReImpl::PartialMatch(name, *filter_regex_)) {
+      for (uint32_t name : names) {
+        if (ReImpl::PartialMatch(labels_->Get(name), *filter_regex_)) {
           any_matched = true;
           break;
         }
@@ -365,17 +512,58 @@ class Rollup {
 
     if (is_vmsize) {
       CheckedAdd(&vm_total_, size);
+      CheckedAdd(&samples_, samples);
+      CheckedAdd(&relocs_, relocs);
     } else {
       CheckedAdd(&file_total_, size);
+      CheckedAdd(&compressed_, compressed);
     }
 
     if (i < names.size()) {
       auto& child = children_[names[i]];
       if (child.get() == nullptr) {
-        child.reset(new Rollup());
+        child.reset(new Rollup(labels_));
+      }
+      child->AddInternal(names, i + 1, size, is_vmsize, samples, relocs,
+                         compressed);
+    }
+  }
+
+  // Removes the ranges of FilterRows() below this row, and adds their sizes to
+  // |removed|.  Every range has a label at every depth, so the ranges of a
+  // row are exactly those of its children.
+  void RemoveUnmatchedRows(const ReImpl& regex, Rollup* removed) {
+    Rollup removed_here;
+    for (auto it = children_.begin(); it != children_.end();) {
+      Rollup& child = *it->second;
+      if (ReImpl::PartialMatch(labels_->Get(it->first), regex)) {
+        ++it;
+        continue;
+      }
+      if (child.children_.empty()) {
+        removed_here.AddTotals(child, 1);
+        it = children_.erase(it);
+        continue;
+      }
+      child.RemoveUnmatchedRows(regex, &removed_here);
+      if (child.children_.empty()) {
+        it = children_.erase(it);
+      } else {
+        ++it;
       }
-      child->AddInternal(names, i + 1, size, is_vmsize);
     }
+    AddTotals(removed_here, -1);
+    removed->AddTotals(removed_here, 1);
+  }
+
+  // Adds the sizes of |other|, times |sign|, to this row (but not its
+  // children).
+  void AddTotals(const Rollup& other, int sign) {
+    vm_total_ += sign * other.vm_total_;
+    file_total_ += sign * other.file_total_;
+    samples_ += sign * other.samples_;
+    relocs_ += sign * other.relocs_;
+    compressed_ += sign * other.compressed_;
   }
 
   static double Percent(int64_t part, int64_t whole) {
@@ -392,12 +580,110 @@ class Rollup {
     }
   }
 
+  // Returns the key that rows are sorted by, for the --sort domain.  Its
+  // magnitude decides which rows are kept; its sign only orders them.
+  static int64_t SortKey(const Options& options, int64_t vm, int64_t file,
+                         int64_t samples, int64_t relocs, int64_t compressed) {
+    switch (options.sort_by()) {
+      case Options::SORTBY_VMSIZE:
+        return vm;
+      case Options::SORTBY_FILESIZE:
+        return file;
+      case Options::SORTBY_BOTH:
+        return std::abs(vm) > std::abs(file) ? vm : file;
+      case Options::SORTBY_SAMPLES:
+        return samples;
+      case Options::SORTBY_RELOCS:
+        return relocs;
+      case Options::SORTBY_COMPRESSED:
+        return compressed;
+      default:
+        BLOATY_UNREACHABLE();
+    }
+  }
+
+  // A label one level below the row being built, with its rollup on each
+  // side of a diff.  In a diff either side may be missing; otherwise |base|
+  // is always null.
+  struct ChildRollups {
+    uint32_t label;
+    const Rollup* target;
+    const Rollup* base;
+    int64_t vm;  // The target's size minus the base's.
+    int64_t file;
+    int64_t sortkey;
+  };
+
+  void CollectChildren(const Rollup* base,
+                       std::vector<ChildRollups>* children) const;
   void CreateRows(RollupRow* row, const Rollup* base, const Options& options,
                   bool is_toplevel) const;
   void SortAndAggregateRows(RollupRow* row, const Rollup* base,
+                            std::vector<ChildRollups>* children,
                             const Options& options, bool is_toplevel) const;
 };
 
+void Rollup::CollectChildren(const Rollup* base,
+                             std::vector<ChildRollups>* children) const {
+  auto add = [children](uint32_t label, const Rollup* target,
+                        const Rollup* base) {
+    int64_t vm = 0;
+    int64_t file = 0;
+    if (target) {
+      vm = target->vm_total_;
+      file = target->file_total_;
+    }
+    if (base) {
+      vm -= base->vm_total_;
+      file -= base->file_total_;
+    }
+    if (vm != 0 || file != 0) {
+      children->push_back({label, target, base, vm, file, 0});
+    }
+  };
+
+  if (!base) {
+    children->reserve(children_.size());
+    for (const auto& child : children_) {
+      add(child.first, child.second.get(), nullptr);
+    }
+    return;
+  }
+
+  // For a diff, both sides' children are sorted by label id and merged, so
+  // that labels only the base has get rows too, without copying them into
+  // this tree or looking each label up in the other side's hash map.
+  auto sorted = [](const ChildMap& map) {
+    std::vector<std::pair<uint32_t, const Rollup*>> ret;
+    ret.reserve(map.size());
+    for (const auto& child : map) {
+      ret.emplace_back(child.first, child.second.get());
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+  };
+  auto target_children = sorted(children_);
+  auto base_children = sorted(base->children_);
+  children->reserve(std::max(target_children.size(), base_children.size()));
+
+  auto t = target_children.begin();
+  auto b = base_children.begin();
+  while (t != target_children.end() || b != base_children.end()) {
+    if (b == base_children.end() ||
+        (t != target_children.end() && t->first < b->first)) {
+      add(t->first, t->second, nullptr);
+      ++t;
+    } else if (t == target_children.end() || b->first < t->first) {
+      add(b->first, nullptr, b->second);
+      ++b;
+    } else {
+      add(t->first, t->second, b->second);
+      ++t;
+      ++b;
+    }
+  }
+}
+
 void Rollup::CreateRows(RollupRow* row, const Rollup* base,
                         const Options& options, bool is_toplevel) const {
   if (base) {
@@ -407,174 +693,157 @@ void Rollup::CreateRows(RollupRow* row, const Rollup* base,
     row->filepercent = Percent(file_total_ - base->file_total_, base->file_total_);
   }
 
-  for (const auto& value : children_) {
-    int64_t vm_total = value.second->vm_total_;
-    int64_t file_total = value.second->file_total_;
-    Rollup* base_child = nullptr;
-
-    if (base) {
-      // Reassign sizes to base during a diff to compare to target sizes.
-      auto it = base->children_.find(value.first);
-      if (it != base->children_.end()) {
-        base_child = it->second.get();
-        vm_total -= base_child->vm_total_;
-        file_total -= base_child->file_total_;
-      }
-    }
-
-    if (vm_total != 0 || file_total != 0) {
-      row->sorted_children.emplace_back(value.first);
-      RollupRow& child_row = row->sorted_children.back();
-      child_row.size.vm = vm_total;
-      child_row.size.file = file_total;
-
-      // Preserve the old size for this label in the RollupRow output.
-      // If there is a diff base, the old sizes come from the size of the label
-      // in that base.  Otherwise, the old size stays 0.
-      if (base_child) {
-        child_row.old_size.vm = base_child->vm_total_;
-        child_row.old_size.file = base_child->file_total_;
-      }
-    }
-  }
-
-  SortAndAggregateRows(row, base, options, is_toplevel);
+  std::vector<ChildRollups> children;
+  CollectChildren(base, &children);
+  SortAndAggregateRows(row, base, &children, options, is_toplevel);
 }
 
-Rollup* Rollup::empty_;
-
 void Rollup::SortAndAggregateRows(RollupRow* row, const Rollup* base,
+                                  std::vector<ChildRollups>* children,
                                   const Options& options,
                                   bool is_toplevel) const {
-  std::vector<RollupRow>& child_rows = row->sorted_children;
-
-  // We don't want to output a solitary "[None]" or "[Unmapped]" row except at
-  // the top level.
-  if (!is_toplevel && child_rows.size() == 1 &&
-      (child_rows[0].name == "[None]" || child_rows[0].name == "[Unmapped]")) {
-    child_rows.clear();
-  }
-
-  // We don't want to output a single row that has exactly the same size and
-  // label as the parent.
-  if (child_rows.size() == 1 && child_rows[0].name == row->name) {
-    child_rows.clear();
+  if (children->size() == 1) {
+    const std::string& name = labels_->Get((*children)[0].label);
+    // We don't want to output a solitary "[None]" or "[Unmapped]" row except
+    // at the top level, or a single row that has exactly the same size and
+    // label as the parent.
+    if ((!is_toplevel && (name == "[None]" || name == "[Unmapped]")) ||
+        name == row->name) {
+      children->clear();
+    }
   }
 
-  if (child_rows.empty()) {
+  if (children->empty()) {
     return;
   }
 
-  // First sort by magnitude.
-  for (auto& child : child_rows) {
-    switch (options.sort_by()) {
-      case Options::SORTBY_VMSIZE:
-        child.sortkey = std::abs(child.size.vm);
-        break;
-      case Options::SORTBY_FILESIZE:
-        child.sortkey = std::abs(child.size.file);
-        break;
-      case Options::SORTBY_BOTH:
-        child.sortkey =
-            std::max(std::abs(child.size.vm), std::abs(child.size.file));
-        break;
-      default:
-        BLOATY_UNREACHABLE();
+  // Pick the top 'row_limit' by magnitude.  Only these get rows; the rest are
+  // added to "others_row".
+  for (auto& child : *children) {
+    const Rollup* target = child.target;
+    child.sortkey = std::abs(
+        SortKey(options, child.vm, child.file, target ? target->samples_ : 0,
+                target ? target->relocs_ : 0,
+                target ? target->compressed_ : 0));
+  }
+  auto by_magnitude = [this](const ChildRollups& a, const ChildRollups& b) {
+    if (a.sortkey != b.sortkey) {
+      return a.sortkey > b.sortkey;
     }
+    return labels_->Get(a.label) < labels_->Get(b.label);
+  };
+  uint64_t row_limit = options.max_rows_per_level();
+  size_t kept = children->size();
+  if (kept > row_limit) {
+    kept = row_limit;
+    std::nth_element(children->begin(), children->begin() + kept,
+                     children->end(), by_magnitude);
   }
 
-  std::sort(child_rows.begin(), child_rows.end(), &RollupRow::Compare);
-
   RollupRow others_row(others_label);
-  others_row.other_count = child_rows.size() - options.max_rows_per_level();
+  others_row.other_count = children->size() - kept;
   others_row.name = absl::Substitute("[$0 Others]", others_row.other_count);
   Rollup others_rollup;
   Rollup others_base;
 
-  // Filter out everything but the top 'row_limit'.  Add rows that were filtered
-  // out to "others_row".
-  size_t i = child_rows.size() - 1;
-  while (i >= options.max_rows_per_level()) {
-    CheckedAdd(&others_row.size.vm, child_rows[i].size.vm);
-    CheckedAdd(&others_row.size.file, child_rows[i].size.file);
-    if (base) {
-      auto it = base->children_.find(child_rows[i].name);
-      if (it != base->children_.end()) {
-        CheckedAdd(&others_base.vm_total_, it->second->vm_total_);
-        CheckedAdd(&others_base.file_total_, it->second->file_total_);
-      }
+  for (size_t i = kept; i < children->size(); i++) {
+    const ChildRollups& child = (*children)[i];
+    CheckedAdd(&others_row.size.vm, child.vm);
+    CheckedAdd(&others_row.size.file, child.file);
+    if (child.target) {
+      CheckedAdd(&others_row.samples, child.target->samples_);
+      CheckedAdd(&others_row.relocs, child.target->relocs_);
+      CheckedAdd(&others_row.compressed, child.target->compressed_);
+    }
+    if (child.base) {
+      CheckedAdd(&others_base.vm_total_, child.base->vm_total_);
+      CheckedAdd(&others_base.file_total_, child.base->file_total_);
+    }
+  }
+  children->resize(kept);
+
+  std::vector<RollupRow> child_rows;
+  child_rows.reserve(kept + 1);
+  for (const auto& child : *children) {
+    child_rows.emplace_back(labels_->Get(child.label));
+    RollupRow& child_row = child_rows.back();
+    child_row.size.vm = child.vm;
+    child_row.size.file = child.file;
+    if (child.target) {
+      child_row.samples = child.target->samples_;
+      child_row.relocs = child.target->relocs_;
+      child_row.compressed = child.target->compressed_;
     }
 
-    child_rows.erase(child_rows.end() - 1);
-    i--;
+    // Preserve the old size for this label in the RollupRow output.
+    // If there is a diff base, the old sizes come from the size of the label
+    // in that base.  Otherwise, the old size stays 0.
+    if (child.base) {
+      child_row.old_size.vm = child.base->vm_total_;
+      child_row.old_size.file = child.base->file_total_;
+    }
   }
 
   if (std::abs(others_row.size.vm) > 0 || std::abs(others_row.size.file) > 0) {
     child_rows.push_back(others_row);
     CheckedAdd(&others_rollup.vm_total_, others_row.size.vm);
     CheckedAdd(&others_rollup.file_total_, others_row.size.file);
+    CheckedAdd(&others_rollup.samples_, others_row.samples);
+    CheckedAdd(&others_rollup.relocs_, others_row.relocs);
+    CheckedAdd(&others_rollup.compressed_, others_row.compressed);
   }
 
-  // Now sort by actual value (positive or negative).
-  for (auto& child : child_rows) {
-    switch (options.sort_by()) {
-      case Options::SORTBY_VMSIZE:
-        child.sortkey = child.size.vm;
-        break;
-      case Options::SORTBY_FILESIZE:
-        child.sortkey = child.size.file;
-        break;
-      case Options::SORTBY_BOTH:
-        if (std::abs(child.size.vm) > std::abs(child.size.file)) {
-          child.sortkey = child.size.vm;
-        } else {
-          child.sortkey = child.size.file;
-        }
-        break;
-      default:
-        BLOATY_UNREACHABLE();
-    }
+  // Now sort by actual value (positive or negative).  The rows are sorted
+  // through |order|, so that each keeps its place in |children|.
+  for (auto& child_row : child_rows) {
+    child_row.sortkey =
+        SortKey(options, child_row.size.vm, child_row.size.file,
+                child_row.samples, child_row.relocs, child_row.compressed);
+  }
+  std::vector<size_t> order(child_rows.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&child_rows](size_t a, size_t b) {
+    return RollupRow::Compare(child_rows[a], child_rows[b]);
+  });
+  row->sorted_children.reserve(child_rows.size());
+  for (size_t i : order) {
+    row->sorted_children.push_back(std::move(child_rows[i]));
   }
-
-  std::sort(child_rows.begin(), child_rows.end(), &RollupRow::Compare);
 
   // For a non-diff, the percentage is compared to the total size of the parent.
   if (!base) {
-    for (auto& child_row : child_rows) {
+    for (auto& child_row : row->sorted_children) {
       child_row.vmpercent = Percent(child_row.size.vm, row->size.vm);
       child_row.filepercent = Percent(child_row.size.file, row->size.file);
+      child_row.compressedpercent =
+          Percent(child_row.compressed, row->compressed);
     }
   }
 
-  // Recurse into sub-rows, (except "Other", which isn't a real row).
-  for (auto& child_row : child_rows) {
+  // Recurse into sub-rows, (except "Other", which isn't a real row).  A label
+  // that one side of a diff lacks is compared against an empty rollup.
+  Rollup empty(labels_);
+  for (size_t i = 0; i < order.size(); i++) {
+    RollupRow* child_row = &row->sorted_children[i];
     const Rollup* child_rollup;
     const Rollup* child_base = nullptr;
 
-    if (child_row.other_count > 0) {
+    if (order[i] == children->size()) {
       child_rollup = &others_rollup;
       if (base) {
         child_base = &others_base;
       }
     } else {
-      auto it = children_.find(child_row.name);
-      if (it == children_.end()) {
-        THROWF("internal error, couldn't find name $0", child_row.name);
-      }
-      child_rollup = it->second.get();
-      assert(child_rollup);
-
+      const ChildRollups& child = (*children)[order[i]];
+      child_rollup = child.target ? child.target : &empty;
       if (base) {
-        auto it = base->children_.find(child_row.name);
-        if (it == base->children_.end()) {
-          child_base = GetEmpty();
-        } else {
-          child_base = it->second.get();
-        }
+        child_base = child.base ? child.base : &empty;
       }
     }
 
-    child_rollup->CreateRows(&child_row, child_base, options, false);
+    child_rollup->CreateRows(child_row, child_base, options, false);
   }
 }
 
@@ -656,6 +925,15 @@ std::string SiPrint(int64_t size, bool force_sign) {
   return LeftPad(ret, 7);
 }
 
+// VM bytes per profile sample, the density of a row's samples: large values
+// point at cold code, small ones at hot code.
+std::string BytesPerSample(const RollupRow& row) {
+  if (row.samples == 0) {
+    return "-";
+  }
+  return SiPrint(row.size.vm / row.samples, /*force_sign=*/false);
+}
+
 std::string PercentString(double percent, bool diff_mode) {
   if (diff_mode) {
     if (percent == 0 || std::isnan(percent)) {
@@ -706,6 +984,10 @@ void RollupOutput::Print(const OutputOptions& options, std::ostream* out) {
   if (!disassembly_.empty()) {
     *out << disassembly_;
   }
+
+  if (!summary_.empty()) {
+    *out << summary_;
+  }
 }
 
 void RollupOutput::PrettyPrintRow(const RollupRow& row, size_t indent,
@@ -732,6 +1014,20 @@ void RollupOutput::PrettyPrintRow(const RollupRow& row, size_t indent,
          << SiPrint(row.size.vm, diff_mode_) << " ";
   }
 
+  if (show_compressed_) {
+    *out << PercentString(row.compressedpercent, diff_mode_) << " "
+         << SiPrint(row.compressed, diff_mode_) << " ";
+  }
+
+  if (show_samples_) {
+    *out << LeftPad(std::to_string(row.samples), 9) << " "
+         << LeftPad(BytesPerSample(row), 9) << " ";
+  }
+
+  if (show_relocs_) {
+    *out << LeftPad(std::to_string(row.relocs), 9) << " ";
+  }
+
   *out << "   " << row.name << "\n";
 }
 
@@ -778,6 +1074,18 @@ void RollupOutput::PrettyPrint(const OutputOptions& options,
     *out << "     VM SIZE    ";
   }
 
+  if (show_compressed_) {
+    *out << "   COMPRESSED   ";
+  }
+
+  if (show_samples_) {
+    *out << "  SAMPLES VM/SAMPLE ";
+  }
+
+  if (show_relocs_) {
+    *out << "   RELOCS ";
+  }
+
   *out << "\n";
 
   if (ShowFile(options)) {
@@ -788,6 +1096,18 @@ void RollupOutput::PrettyPrint(const OutputOptions& options,
     *out << " -------------- ";
   }
 
+  if (show_compressed_) {
+    *out << " -------------- ";
+  }
+
+  if (show_samples_) {
+    *out << " -------- --------- ";
+  }
+
+  if (show_relocs_) {
+    *out << " -------- ";
+  }
+
   *out << "\n";
 
   for (const auto& child : toplevel_row_.sorted_children) {
@@ -845,6 +1165,20 @@ void RollupOutput::PrintRowToCSV(const RollupRow& row,
     parent_labels.push_back(
         std::to_string(row.old_size.file + (row.size.file)));}
 
+  if (show_compressed_) {
+    parent_labels.push_back(std::to_string(row.compressed));
+  }
+
+  if (show_samples_) {
+    parent_labels.push_back(std::to_string(row.samples));
+    parent_labels.push_back(
+        row.samples > 0 ? std::to_string(row.size.vm / row.samples) : "");
+  }
+
+  if (show_relocs_) {
+    parent_labels.push_back(std::to_string(row.relocs));
+  }
+
   std::string sep = tabs ? "\t" : ",";
   *out << absl::StrJoin(parent_labels, sep) << "\n";
 }
@@ -878,6 +1212,16 @@ void RollupOutput::PrintToCSV(std::ostream* out, bool tabs,
     names.push_back("current_vmsize");
     names.push_back("current_filesize");
   }
+  if (show_compressed_) {
+    names.push_back("compressedsize");
+  }
+  if (show_samples_) {
+    names.push_back("samples");
+    names.push_back("bytes_per_sample");
+  }
+  if (show_relocs_) {
+    names.push_back("relocs");
+  }
   std::string sep = tabs ? "\t" : ",";
   *out << absl::StrJoin(names, sep) << "\n";
   for (const auto& child_row : toplevel_row_.sorted_children) {
@@ -1088,6 +1432,8 @@ RangeSink::RangeSink(const InputFile* file, const Options& options,
 
 RangeSink::~RangeSink() {}
 
+constexpr uint64_t RangeSink::kNoFileOffset;
+
 uint64_t debug_vmaddr = -1;
 uint64_t debug_fileoff = -1;
 
@@ -1280,6 +1626,10 @@ void RangeSink::AddVMRangeForVMAddr(const char* analyzer,
 
 void RangeSink::AddVMRange(const char* analyzer, uint64_t vmaddr,
                            uint64_t vmsize, const std::string& name) {
+  if (vm_file_offset_ != kNoFileOffset) {
+    AddFileRange(analyzer, name, vm_file_offset_ + vmaddr, vmsize);
+    return;
+  }
   bool verbose = IsVerboseForVMRange(vmaddr, vmsize);
   if (verbose) {
     printf("[%s, %s] AddVMRange(%.*s, %" PRIx64 ", %" PRIx64 ")\n",
@@ -1404,98 +1754,608 @@ absl::string_view RangeSink::ZlibDecompress(absl::string_view data,
   return sv;
 }
 
-// ThreadSafeIterIndex /////////////////////////////////////////////////////////
+// Profile /////////////////////////////////////////////////////////////////////
 
-class ThreadSafeIterIndex {
- public:
-  ThreadSafeIterIndex(int max) : index_(0), max_(max) {}
+struct ProfileSample {
+  uint64_t addr;
+  uint64_t count;
+};
 
-  bool TryGetNext(int* index) {
-    int ret = index_.fetch_add(1, std::memory_order_relaxed);
-    if (ret >= max_) {
-      return false;
-    } else {
-      *index = ret;
-      return true;
+// Parses a --profile file.  Each line holds a hex VM address, optionally
+// followed by a decimal sample count (default 1), so the output of
+// `perf script -F ip` can be used directly.  Blank lines and lines starting
+// with '#' are skipped.  Returns the samples sorted by address, with repeated
+// addresses merged.
+static std::vector<ProfileSample> ParseProfile(string_view data) {
+  std::vector<ProfileSample> samples;
+  int line_number = 0;
+
+  for (string_view line : absl::StrSplit(data, '\n')) {
+    line_number++;
+    std::vector<string_view> fields =
+        absl::StrSplit(line, absl::ByAnyChar(" \t\r"), absl::SkipEmpty());
+    if (fields.empty() || fields[0][0] == '#') {
+      continue;
     }
-  }
 
-  void Abort(string_view error) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    index_ = max_;
-    error_ = std::string(error);
+    ProfileSample sample = {0, 1};
+    try {
+      size_t end;
+      std::string addr(fields[0]);
+      sample.addr = std::stoull(addr, &end, 16);
+      if (end != addr.size()) {
+        throw std::invalid_argument(addr);
+      }
+      if (fields.size() > 1) {
+        std::string count(fields[1]);
+        sample.count = std::stoull(count, &end, 10);
+        if (end != count.size()) {
+          throw std::invalid_argument(count);
+        }
+      }
+    } catch (...) {
+      THROWF("couldn't parse line $0 of profile: $1", line_number, line);
+    }
+    samples.push_back(sample);
   }
 
-  bool TryGetError(std::string* error) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (error_.empty()) {
-      return false;
+  std::sort(samples.begin(), samples.end(),
+            [](const ProfileSample& a, const ProfileSample& b) {
+              return a.addr < b.addr;
+            });
+
+  std::vector<ProfileSample> merged;
+  for (const auto& sample : samples) {
+    if (!merged.empty() && merged.back().addr == sample.addr) {
+      merged.back().count += sample.count;
     } else {
-      *error = error_;
-      return true;
+      merged.push_back(sample);
     }
   }
+  return merged;
+}
 
- private:
-  std::atomic<int> index_;
-  std::string error_;
-  std::mutex mutex_;
-  const int max_;
-};
-
-// Bloaty //////////////////////////////////////////////////////////////////////
-
-// Represents a program execution and associated state.
-
-struct ConfiguredDataSource {
-  ConfiguredDataSource(const DataSourceDefinition& definition_)
-      : definition(definition_),
-        effective_source(definition_.number),
-        munger(new NameMunger()) {}
-
-  const DataSourceDefinition& definition;
-  // This will differ from definition.number for kSymbols, where we use the
-  // --demangle flag to set the true/effective source.
-  DataSource effective_source;
-  std::unique_ptr<NameMunger> munger;
-};
+// Compressed sizes ////////////////////////////////////////////////////////////
 
-class Bloaty {
+// For --compressed: the loaded bytes of a file are compressed in independent
+// blocks, the way a package or OTA image is, and each block's compressed size
+// is spread evenly over its bytes.  A file range's compressed size is then the
+// sum of its shares, so the rows always add up to the total.
+class CompressedSizes {
  public:
-  Bloaty(const InputFileFactory& factory, const Options& options);
-  Bloaty(const Bloaty&) = delete;
-  Bloaty& operator=(const Bloaty&) = delete;
+  struct Block {
+    uint64_t start;  // File offset.
+    uint64_t size;
+    uint64_t compressed;
+  };
 
-  void AddFilename(const std::string& filename, bool base_file);
-  void AddDebugFilename(const std::string& filename);
-  void AddSourceMapFilename(const std::string& filename);
+  // Splits the loaded parts of |file_map| (the base map) into blocks of at
+  // most |block_size| bytes.  Loaded ranges that are next to each other in
+  // the file are compressed as one stream.
+  void AddBlocks(const RangeMap& file_map, uint64_t block_size) {
+    uint64_t run_start = 0;
+    uint64_t run_end = 0;
+    auto flush = [&]() {
+      for (uint64_t start = run_start; start < run_end; start += block_size) {
+        blocks_.push_back(
+            {start, std::min(block_size, run_end - start), 0});
+      }
+    };
+    file_map.ForEachRange([&](uint64_t start, uint64_t length) {
+      uint64_t vmaddr;
+      if (!file_map.Translate(start, &vmaddr)) {
+        return;
+      }
+      if (start != run_end) {
+        flush();
+        run_start = start;
+      }
+      run_end = start + length;
+    });
+    flush();
+  }
 
-  size_t GetSourceCount() const { return sources_.size(); }
+  std::vector<Block>* blocks() { return &blocks_; }
 
-  void DefineCustomDataSource(const CustomDataSource& source);
+  // Call after the blocks are compressed.
+  void Finish() {
+    cumulative_.resize(blocks_.size() + 1);
+    cumulative_[0] = 0;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      cumulative_[i + 1] = cumulative_[i] + blocks_[i].compressed;
+    }
+  }
 
-  void AddDataSource(const std::string& name);
-  void ScanAndRollup(const Options& options, RollupOutput* output);
-  void DisassembleFunction(string_view function, const Options& options,
-                           RollupOutput* output);
+  // The compressed size of the file ranges in [start, end).
+  uint64_t Get(uint64_t start, uint64_t end) const {
+    return CompressedBefore(end) - CompressedBefore(start);
+  }
 
  private:
-  template <size_t T>
-  void AddBuiltInSources(const DataSourceDefinition (&sources)[T],
-                         const Options& options) {
-    for (size_t i = 0; i < T; i++) {
-      const DataSourceDefinition& source = sources[i];
-      auto configured_source = absl::make_unique<ConfiguredDataSource>(source);
-
-      if (configured_source->effective_source == DataSource::kSymbols) {
-        configured_source->effective_source = EffectiveSymbolSource(options);
-      }
-
-      all_known_sources_[source.name] = std::move(configured_source);
+  // The compressed size of everything before file offset |offset|.
+  uint64_t CompressedBefore(uint64_t offset) const {
+    auto it = std::upper_bound(
+        blocks_.begin(), blocks_.end(), offset,
+        [](uint64_t offset, const Block& block) {
+          return offset < block.start;
+        });
+    if (it == blocks_.begin()) {
+      return 0;
     }
+    --it;
+    size_t i = it - blocks_.begin();
+    uint64_t within = std::min(offset - it->start, it->size);
+    return cumulative_[i] + static_cast<uint64_t>(absl::uint128(it->compressed) *
+                                                  within / it->size);
   }
 
-  static DataSource EffectiveSymbolSource(const Options& options) {
+  std::vector<Block> blocks_;
+  std::vector<uint64_t> cumulative_;
+};
+
+// Identical code ///////////////////////////////////////////////////////////////
+
+// While scanning, the "icf" source labels each function with the hash and size
+// of its code, where the copy is, and its name (see Bloaty::AddIdenticalCode()):
+//
+//   <hash>:<size>:<address>:<filename length>:<filename>:<name>
+//
+// The address and filename keep every copy in a row of its own until
+// GroupIdenticalCode() counts them.  Nothing sees these labels before then:
+// --source-filter and rewrites are applied to the grouped labels, and the raw
+// map shows only the name.  Parses such a label into the part that
+// identical copies share (the hash and size) and the rest, or returns false
+// for the labels of other ranges.
+static bool ParseIdenticalCodeLabel(const std::string& label, string_view* key,
+                                    uint64_t* size, string_view* name) {
+  if (label.empty() || label[0] == '[') {
+    return false;
+  }
+  string_view rest(label);
+  auto next_field = [&rest](string_view* field) {
+    size_t end = rest.find(':');
+    if (end == string_view::npos) {
+      return false;
+    }
+    *field = rest.substr(0, end);
+    rest.remove_prefix(end + 1);
+    return true;
+  };
+  string_view hash, size_str, address, filename_size_str;
+  size_t filename_size;
+  if (!next_field(&hash) || !next_field(&size_str) || !next_field(&address) ||
+      !next_field(&filename_size_str) || !absl::SimpleAtoi(size_str, size) ||
+      *size == 0 || !absl::SimpleAtoi(filename_size_str, &filename_size) ||
+      rest.size() <= filename_size) {
+    return false;
+  }
+  *key = string_view(label).substr(0, hash.size() + 1 + size_str.size());
+  *name = rest.substr(filename_size + 1);
+  return true;
+}
+
+// Returns the sources among |source_names| that are based on "icf", which is
+// "icf" itself and the custom sources in |options| that rewrite it.
+static std::vector<CustomDataSource> FindIdenticalCodeSources(
+    const Options& options, const std::vector<std::string>& source_names) {
+  std::vector<CustomDataSource> ret;
+  for (const auto& name : source_names) {
+    // Like Bloaty::DefineCustomDataSource(), the last definition wins.
+    const CustomDataSource* custom = nullptr;
+    for (const auto& custom_source : options.custom_data_source()) {
+      if (custom_source.name() == name) {
+        custom = &custom_source;
+      }
+    }
+    if (custom != nullptr && custom->base_data_source() == "icf") {
+      ret.push_back(*custom);
+    } else if (custom == nullptr && name == "icf") {
+      ret.emplace_back();
+      ret.back().set_name(name);
+      ret.back().set_base_data_source(name);
+    }
+  }
+  return ret;
+}
+
+// Once all files are in |rollup|, replaces the labels of the "icf" source with
+// one label per group of identical functions, like:
+//
+//   [3 copies: 128 bytes reclaimable] foo_func
+//
+// which is named after the group's first function name, and counts the bytes
+// that folding the group into a single copy would save.  Functions without a
+// copy are grouped as "[unique code]".  Must be called before the rollup is
+// shown, but not before it is written as a partial, so that --merge can find
+// copies across shards.
+//
+// |icf_sources| are the sources among |source_names| that are based on "icf"
+// (see FindIdenticalCodeSources()).  Their labels aren't rewritten while
+// scanning, so their rewrites apply to the grouped labels instead.
+static void GroupIdenticalCode(const std::vector<std::string>& source_names,
+                               const std::vector<CustomDataSource>& icf_sources,
+                               Rollup* rollup) {
+  struct Group {
+    uint64_t size;
+    std::set<std::string> copies;
+    std::string name;
+    std::string label;
+  };
+
+  for (size_t depth = 0; depth < source_names.size(); depth++) {
+    auto source = std::find_if(
+        icf_sources.begin(), icf_sources.end(),
+        [&](const CustomDataSource& icf_source) {
+          return icf_source.name() == source_names[depth];
+        });
+    if (source == icf_sources.end()) {
+      continue;
+    }
+    NameMunger munger;
+    for (const auto& regex : source->rewrite()) {
+      munger.AddRegex(regex.pattern(), regex.replacement());
+    }
+
+    std::map<std::string, Group> groups;
+    rollup->ForEachAtDepth(
+        depth, [&groups](const std::string& label, const Rollup& /*row*/) {
+          string_view key, name;
+          uint64_t size;
+          if (!ParseIdenticalCodeLabel(label, &key, &size, &name)) {
+            return;
+          }
+          Group& group = groups[std::string(key)];
+          group.size = size;
+          group.copies.insert(label);
+          if (group.name.empty() || name < group.name) {
+            group.name = std::string(name);
+          }
+        });
+
+    std::set<std::string> used_labels;
+    for (auto& pair : groups) {
+      Group& group = pair.second;
+      uint64_t copies = group.copies.size();
+      if (copies <= 1) {
+        group.label = "[unique code]";
+        continue;
+      }
+      group.label =
+          absl::Substitute("[$0 copies: $1 bytes reclaimable] $2", copies,
+                           (copies - 1) * group.size, group.name);
+      // Different groups can share their first name.
+      if (!used_labels.insert(group.label).second) {
+        absl::StrAppend(&group.label, " #", pair.first.substr(0, 8));
+      }
+    }
+
+    rollup->RelabelAtDepth(depth, [&](const std::string& label) {
+      string_view key, name;
+      uint64_t size;
+      if (!ParseIdenticalCodeLabel(label, &key, &size, &name)) {
+        return munger.Munge(label);
+      }
+      return munger.Munge(groups[std::string(key)].label);
+    });
+  }
+}
+
+// Partial rollups ////////////////////////////////////////////////////////////
+
+// --write-partial: stores the complete results of a run, before any rows are
+// collapsed, so that --merge can add them to the results of other runs.
+// |base| is only set in diff mode.
+static void WritePartialRollup(const Options& options,
+                               const std::vector<std::string>& source_names,
+                               const std::vector<CustomDataSource>& icf_sources,
+                               const Rollup& rollup, const Rollup* base) {
+  PartialRollup partial;
+  for (const auto& name : source_names) {
+    partial.add_data_source(name);
+  }
+  for (const auto& icf_source : icf_sources) {
+    *partial.add_identical_code_source() = icf_source;
+  }
+  rollup.ToPartialNode(partial.mutable_target());
+  if (base) {
+    base->ToPartialNode(partial.mutable_base());
+  }
+  if (options.has_profile_filename()) {
+    partial.set_profile_filename(options.profile_filename());
+  }
+  partial.set_count_relocs(options.count_relocs());
+  partial.set_compressed_size(options.compressed_size());
+
+  std::ofstream out(options.write_partial(), std::ios::binary);
+  if (!out || !partial.SerializeToOstream(&out)) {
+    THROWF("couldn't write partial results to '$0'", options.write_partial());
+  }
+}
+
+// --merge: adds up the partial results of several runs.  Each partial is added
+// into the totals as soon as it is read, so only one of them is in memory at
+// a time.
+static void MergePartialRollups(const Options& options,
+                                const InputFileFactory& file_factory,
+                                RollupOutput* output) {
+  if (options.base_filename_size() > 0) {
+    THROW("--merge doesn't take base files; diff-mode partials include them");
+  }
+  if (options.has_profile_filename() || options.count_relocs() ||
+      options.compressed_size()) {
+    THROW("--profile, --relocs and --compressed can't be used with --merge");
+  }
+
+  LabelPool labels;
+  Rollup rollup(&labels);
+  Rollup base(&labels);
+  PartialRollup header;  // The first partial, without its results.
+  bool diff_mode = false;
+
+  for (int i = 0; i < options.filename_size(); i++) {
+    const std::string& filename = options.filename(i);
+    PartialRollup partial;
+    {
+      std::unique_ptr<InputFile> file(file_factory.OpenFile(filename));
+      if (!partial.ParseFromArray(file->data().data(), file->data().size())) {
+        THROWF("couldn't parse partial results from '$0'", filename);
+      }
+    }
+
+    if (i == 0) {
+      header = partial;
+      header.clear_target();
+      header.clear_base();
+      diff_mode = partial.has_base();
+    } else if (!std::equal(partial.data_source().begin(),
+                           partial.data_source().end(),
+                           header.data_source().begin(),
+                           header.data_source().end()) ||
+               partial.has_base() != diff_mode ||
+               partial.has_profile_filename() !=
+                   header.has_profile_filename() ||
+               partial.count_relocs() != header.count_relocs() ||
+               partial.compressed_size() != header.compressed_size() ||
+               !std::equal(partial.identical_code_source().begin(),
+                           partial.identical_code_source().end(),
+                           header.identical_code_source().begin(),
+                           header.identical_code_source().end(),
+                           [](const CustomDataSource& a,
+                              const CustomDataSource& b) {
+                             return a.SerializeAsString() ==
+                                    b.SerializeAsString();
+                           })) {
+      THROWF("partial results in '$0' and '$1' come from different options",
+             options.filename(0), filename);
+    }
+
+    rollup.AddPartialNode(partial.target());
+    if (diff_mode) {
+      base.AddPartialNode(partial.base());
+    }
+  }
+
+  std::vector<std::string> source_names(header.data_source().begin(),
+                                        header.data_source().end());
+  if (options.data_source_size() > 0 &&
+      !std::equal(options.data_source().begin(), options.data_source().end(),
+                  source_names.begin(), source_names.end())) {
+    THROWF("data sources don't match the partial results, which have: $0",
+           absl::StrJoin(source_names, ","));
+  }
+
+  // The report shows the columns of the original runs.
+  Options report_options = options;
+  if (header.has_profile_filename()) {
+    report_options.set_profile_filename(header.profile_filename());
+  } else if (options.sort_by() == Options::SORTBY_SAMPLES) {
+    THROW("sorting by samples requires partial results made with --profile");
+  }
+  report_options.set_count_relocs(header.count_relocs());
+  if (!header.count_relocs() && options.sort_by() == Options::SORTBY_RELOCS) {
+    THROW("sorting by relocs requires partial results made with --relocs");
+  }
+  report_options.set_compressed_size(header.compressed_size());
+  if (!header.compressed_size() &&
+      options.sort_by() == Options::SORTBY_COMPRESSED) {
+    THROW(
+        "sorting by compressed size requires partial results made with "
+        "--compressed");
+  }
+
+  std::vector<CustomDataSource> icf_sources(
+      header.identical_code_source().begin(),
+      header.identical_code_source().end());
+
+  if (options.has_write_partial()) {
+    if (options.has_source_filter()) {
+      THROW("--source-filter can't be used with --merge and --write-partial");
+    }
+    WritePartialRollup(report_options, source_names, icf_sources, rollup,
+                       diff_mode ? &base : nullptr);
+    return;
+  }
+
+  // Partials aren't filtered if they have "icf" sources, so --source-filter
+  // is applied here, to the grouped labels.
+  std::unique_ptr<ReImpl> regex;
+  if (options.has_source_filter()) {
+    regex = absl::make_unique<ReImpl>(options.source_filter());
+    if (!regex->ok()) {
+      THROW("invalid regex for source_filter");
+    }
+  }
+
+  for (const auto& name : source_names) {
+    output->AddDataSourceName(name);
+  }
+  GroupIdenticalCode(source_names, icf_sources, &rollup);
+  if (regex) rollup.FilterRows(*regex);
+  if (diff_mode) {
+    GroupIdenticalCode(source_names, icf_sources, &base);
+    if (regex) base.FilterRows(*regex);
+    rollup.CreateDiffModeRollupOutput(&base, report_options, output);
+  } else {
+    rollup.CreateRollupOutput(report_options, output);
+  }
+}
+
+// ThreadSafeIterIndex /////////////////////////////////////////////////////////
+
+class ThreadSafeIterIndex {
+ public:
+  ThreadSafeIterIndex(int max) : index_(0), max_(max) {}
+
+  bool TryGetNext(int* index) {
+    int ret = index_.fetch_add(1, std::memory_order_relaxed);
+    if (ret >= max_) {
+      return false;
+    } else {
+      *index = ret;
+      return true;
+    }
+  }
+
+  void Abort(string_view error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_ = max_;
+    error_ = std::string(error);
+  }
+
+  bool TryGetError(std::string* error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_.empty()) {
+      return false;
+    } else {
+      *error = error_;
+      return true;
+    }
+  }
+
+ private:
+  std::atomic<int> index_;
+  std::string error_;
+  std::mutex mutex_;
+  const int max_;
+};
+
+// MemoryBudget ////////////////////////////////////////////////////////////////
+
+// Limits how much memory concurrent file scans may use at once.  Scans reserve
+// their estimated memory before they start and release it when they finish,
+// blocking while the reservation doesn't fit.  A scan is always admitted when
+// no other scan holds a reservation, so a file that is larger than the whole
+// budget is still scanned, just on its own.
+class MemoryBudget {
+ public:
+  MemoryBudget(uint64_t limit) : limit_(limit) {}
+
+  class Reservation {
+   public:
+    // A null |budget| is unlimited.
+    Reservation(MemoryBudget* budget) : budget_(budget) {}
+    Reservation(const Reservation&) = delete;
+    Reservation& operator=(const Reservation&) = delete;
+    ~Reservation() {
+      if (budget_ && bytes_ > 0) {
+        budget_->Release(bytes_);
+      }
+    }
+
+    // May only be called once.
+    void Acquire(uint64_t bytes) {
+      assert(bytes_ == 0);
+      if (budget_) {
+        budget_->Acquire(bytes);
+        bytes_ = bytes;
+      }
+    }
+
+   private:
+    MemoryBudget* budget_;
+    uint64_t bytes_ = 0;
+  };
+
+ private:
+  void Acquire(uint64_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    admitted_.wait(lock, [this, bytes]() {
+      return used_ == 0 || bytes <= limit_ - std::min(used_, limit_);
+    });
+    used_ += bytes;
+  }
+
+  void Release(uint64_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      used_ -= bytes;
+    }
+    admitted_.notify_all();
+  }
+
+  const uint64_t limit_;
+  uint64_t used_ = 0;
+  std::mutex mutex_;
+  std::condition_variable admitted_;
+};
+
+// Bloaty //////////////////////////////////////////////////////////////////////
+
+// Represents a program execution and associated state.
+
+struct ConfiguredDataSource {
+  ConfiguredDataSource(const DataSourceDefinition& definition_)
+      : definition(definition_),
+        effective_source(definition_.number),
+        munger(new NameMunger()) {}
+
+  const DataSourceDefinition& definition;
+  // This will differ from definition.number for kSymbols, where we use the
+  // --demangle flag to set the true/effective source.
+  DataSource effective_source;
+  std::unique_ptr<NameMunger> munger;
+};
+
+class Bloaty {
+ public:
+  Bloaty(const InputFileFactory& factory, const Options& options);
+  Bloaty(const Bloaty&) = delete;
+  Bloaty& operator=(const Bloaty&) = delete;
+
+  void AddFilename(const std::string& filename, bool base_file);
+  void AddDebugFilename(const std::string& filename);
+  void AddSourceMapFilename(const std::string& filename);
+  void SetProfileFilename(const std::string& filename);
+
+  size_t GetSourceCount() const { return sources_.size(); }
+
+  void DefineCustomDataSource(const CustomDataSource& source);
+
+  void AddDataSource(const std::string& name);
+  void ScanAndRollup(const Options& options, RollupOutput* output);
+  void DisassembleFunction(string_view function, const Options& options,
+                           RollupOutput* output);
+  void DisassembleRegex(const std::string& regex, const Options& options,
+                        RollupOutput* output);
+  void WriteSymbolOrdering(const Options& options, RollupOutput* output);
+
+ private:
+  template <size_t T>
+  void AddBuiltInSources(const DataSourceDefinition (&sources)[T],
+                         const Options& options) {
+    for (size_t i = 0; i < T; i++) {
+      const DataSourceDefinition& source = sources[i];
+      auto configured_source = absl::make_unique<ConfiguredDataSource>(source);
+
+      if (configured_source->effective_source == DataSource::kSymbols) {
+        configured_source->effective_source = EffectiveSymbolSource(options);
+      }
+
+      all_known_sources_[source.name] = std::move(configured_source);
+    }
+  }
+
+  static DataSource EffectiveSymbolSource(const Options& options) {
     switch (options.demangle()) {
       case Options::DEMANGLE_NONE:
         return DataSource::kRawSymbols;
@@ -1509,12 +2369,33 @@ class Bloaty {
   }
 
   void ScanAndRollupFiles(const std::vector<std::string>& filenames,
-                          std::vector<std::string>* build_ids,
-                          Rollup* rollup) const;
-  void ScanAndRollupFile(const std::string& filename, Rollup* rollup,
-                         std::vector<std::string>* out_build_ids) const;
+                          const std::vector<std::string>& base_filenames,
+                          std::vector<std::string>* build_ids, Rollup* rollup,
+                          Rollup* base) const;
+  // If |raw_map| is non-null, the file's range maps are printed into it.
+  void ScanAndRollupFile(const std::string& filename, MemoryBudget* budget,
+                         Rollup* rollup,
+                         std::vector<std::string>* out_build_ids,
+                         std::string* raw_map) const;
+  int GetThreadCount(size_t jobs) const;
+  int GetInnerThreadCount(size_t work) const;
+  bool HasIdenticalCodeSource() const;
+  bool CanSkipArchiveMembers() const;
+  bool ArchiveMemberCanMatch(const ArchiveIndex::Member& member,
+                             const ReImpl& regex) const;
+  void AddThinArchiveMembers(const std::string& filename,
+                             std::vector<std::string>* filenames) const;
 
   std::unique_ptr<ObjectFile> GetObjectFile(const std::string& filename) const;
+  void AddPages(const RangeMap& base_vm_map, const std::vector<uint64_t>& relocs,
+                RangeSink* sink) const;
+  void AddIdenticalCode(const ObjectFile& file, const RangeMap& base_vm_map,
+                        RangeSink* sink) const;
+  void AddDominators(const ObjectFile& file, const RangeMap& base_vm_map,
+                     RangeSink* sink) const;
+  void CompressLoadedRanges(const InputFile& file,
+                            const RangeMap& base_file_map,
+                            CompressedSizes* sizes) const;
 
   const InputFileFactory& file_factory_;
   const Options options_;
@@ -1532,20 +2413,30 @@ class Bloaty {
   struct InputFileInfo {
     std::string filename_;
     std::string build_id_;
+
+    // Whether this is a thin archive, whose members are scanned as files of
+    // their own.
+    bool is_thin_archive_ = false;
   };
   std::vector<InputFileInfo> input_files_;
   std::vector<InputFileInfo> base_files_;
   std::map<std::string, std::string> debug_files_;
   std::map<std::string, std::string> sourcemap_files_;
 
-  // For allocating memory, like to decompress compressed sections.
-  std::unique_ptr<google::protobuf::Arena> arena_;
+  // Samples from --profile, sorted by address.
+  std::vector<ProfileSample> profile_;
+
+  // How many files ScanAndRollupFiles() is scanning, counting both sides of a
+  // diff and the members of thin archives.
+  size_t scan_job_count_ = 1;
+
+  // One pool for the labels of every file and thread in the run, so that the
+  // per-thread rollups can be merged by comparing ids.
+  std::shared_ptr<LabelPool> labels_ = std::make_shared<LabelPool>();
 };
 
 Bloaty::Bloaty(const InputFileFactory& factory, const Options& options)
-    : file_factory_(factory),
-      options_(options),
-      arena_(std::make_unique<google::protobuf::Arena>()) {
+    : file_factory_(factory), options_(options) {
   AddBuiltInSources(data_sources, options);
 }
 
@@ -1575,12 +2466,15 @@ std::unique_ptr<ObjectFile> Bloaty::GetObjectFile(
 
 void Bloaty::AddFilename(const std::string& filename, bool is_base) {
   auto object_file = GetObjectFile(filename);
-  std::string build_id = object_file->GetBuildId();
+  InputFileInfo info;
+  info.filename_ = filename;
+  info.build_id_ = object_file->GetBuildId();
+  info.is_thin_archive_ = object_file->IsThinArchive();
 
   if (is_base) {
-    base_files_.push_back({filename, build_id});
+    base_files_.push_back(std::move(info));
   } else {
-    input_files_.push_back({filename, build_id});
+    input_files_.push_back(std::move(info));
   }
 }
 
@@ -1606,6 +2500,11 @@ void Bloaty::AddSourceMapFilename(const std::string& filename) {
   sourcemap_files_[sourcemap_build_id] = sourcemap_filename;
 }
 
+void Bloaty::SetProfileFilename(const std::string& filename) {
+  std::unique_ptr<InputFile> file(file_factory_.OpenFile(filename));
+  profile_ = ParseProfile(file->data());
+}
+
 void Bloaty::DefineCustomDataSource(const CustomDataSource& source) {
   if (source.base_data_source() == "symbols") {
     THROW(
@@ -1648,49 +2547,78 @@ void Bloaty::AddDataSource(const std::string& name) {
 // All of the DualMaps for a given file.
 struct DualMaps {
  public:
-  DualMaps() {
+  // |labels| is the pool of the rollup that the maps will be added to.
+  explicit DualMaps(std::shared_ptr<LabelPool> labels)
+      : labels_(std::move(labels)) {
     // Base map.
     AppendMap();
   }
 
-  DualMap* AppendMap() {
-    maps_.emplace_back(new DualMap);
+  // |is_icf| marks the map of an "icf" source, whose labels are printed as
+  // just their function names.
+  DualMap* AppendMap(bool is_icf = false) {
+    maps_.emplace_back(new DualMap(labels_));
+    is_icf_.push_back(is_icf);
     return maps_.back().get();
   }
 
-  void ComputeRollup(Rollup* rollup) {
+  // |profile| and |relocs| must be sorted by address.  |compressed| is null
+  // unless compressed sizes were requested.
+  void ComputeRollup(const std::vector<ProfileSample>& profile,
+                     const std::vector<uint64_t>& relocs,
+                     const CompressedSizes* compressed, Rollup* rollup) {
     for (auto& map : maps_) {
       map->vm_map.Compress();
       map->file_map.Compress();
     }
-    RangeMap::ComputeRollup(VmMaps(), [=](const std::vector<std::string>& keys,
-                                          uint64_t addr, uint64_t end) {
-      return rollup->AddSizes(keys, end - addr, true);
-    });
-    RangeMap::ComputeRollup(
+
+    // VM ranges are visited in address order, so a single forward sweep over
+    // the profile and relocations attributes each of them to the range that
+    // contains it.
+    auto sample = profile.begin();
+    auto reloc = relocs.begin();
+    RangeMap::ComputeLabelIdRollup(
+        VmMaps(),
+        [&](const std::vector<uint32_t>& keys, uint64_t addr, uint64_t end) {
+          uint64_t samples = 0;
+          while (sample != profile.end() && sample->addr < addr) {
+            ++sample;
+          }
+          while (sample != profile.end() && sample->addr < end) {
+            samples += sample->count;
+            ++sample;
+          }
+          reloc = std::lower_bound(reloc, relocs.end(), addr);
+          auto reloc_end = std::lower_bound(reloc, relocs.end(), end);
+          uint64_t reloc_count = reloc_end - reloc;
+          reloc = reloc_end;
+          return rollup->AddSizes(keys, end - addr, true, samples, reloc_count);
+        });
+    RangeMap::ComputeLabelIdRollup(
         FileMaps(),
-        [=](const std::vector<std::string>& keys, uint64_t addr, uint64_t end) {
-          return rollup->AddSizes(keys, end - addr, false);
+        [=](const std::vector<uint32_t>& keys, uint64_t addr, uint64_t end) {
+          return rollup->AddSizes(keys, end - addr, false, 0, 0,
+                                  compressed ? compressed->Get(addr, end) : 0);
         });
   }
 
-  void PrintMaps(const std::vector<const RangeMap*> maps) {
+  void PrintMaps(const std::vector<const RangeMap*> maps, std::string* out) {
     uint64_t last = 0;
     uint64_t max = maps[0]->GetMaxAddress();
     int hex_digits = max > 0 ? std::ceil(std::log2(max) / 4) : 0;
     RangeMap::ComputeRollup(maps, [&](const std::vector<std::string>& keys,
                                       uint64_t addr, uint64_t end) {
       if (addr > last) {
-        PrintMapRow("[-- Nothing mapped --]", last, addr, hex_digits);
+        PrintMapRow("[-- Nothing mapped --]", last, addr, hex_digits, out);
       }
-      PrintMapRow(KeysToString(keys), addr, end, hex_digits);
+      PrintMapRow(KeysToString(keys), addr, end, hex_digits, out);
       last = end;
     });
-    printf("\n");
+    *out += "\n";
   }
 
-  void PrintFileMaps() { PrintMaps(FileMaps()); }
-  void PrintVMMaps() { PrintMaps(VmMaps()); }
+  void PrintFileMaps(std::string* out) { PrintMaps(FileMaps(), out); }
+  void PrintVMMaps(std::string* out) { PrintMaps(VmMaps(), out); }
 
   std::string KeysToString(const std::vector<std::string>& keys) {
     std::string ret;
@@ -1700,17 +2628,26 @@ struct DualMaps {
       if (i > 1) {
         ret += "\t";
       }
-      ret += keys[i];
+      string_view key, name;
+      uint64_t size;
+      if (is_icf_[i] && ParseIdenticalCodeLabel(keys[i], &key, &size, &name)) {
+        absl::StrAppend(&ret, name);
+      } else {
+        ret += keys[i];
+      }
     }
 
     return ret;
   }
 
   void PrintMapRow(string_view str, uint64_t start, uint64_t end,
-                   int hex_digits) {
-    printf("%.*" PRIx64 "-%.*" PRIx64 "\t %s\t\t%.*s\n", hex_digits, start,
-           hex_digits, end, LeftPad(std::to_string(end - start), 10).c_str(),
-           (int)str.size(), str.data());
+                   int hex_digits, std::string* out) {
+    char range[64];
+    snprintf(range, sizeof(range), "%.*" PRIx64 "-%.*" PRIx64, hex_digits,
+             start, hex_digits, end);
+    absl::StrAppend(out, range, "\t ",
+                    LeftPad(std::to_string(end - start), 10), "\t\t", str,
+                    "\n");
   }
 
   DualMap* base_map() { return maps_[0].get(); }
@@ -1732,35 +2669,373 @@ struct DualMaps {
     return ret;
   }
 
+  // Shared by all maps, and by the maps of every other file in the run, so
+  // that each distinct label is stored only once.
+  std::shared_ptr<LabelPool> labels_;
   std::vector<std::unique_ptr<DualMap>> maps_;
+  std::vector<bool> is_icf_;
 };
 
-void Bloaty::ScanAndRollupFile(const std::string& filename, Rollup* rollup,
-                               std::vector<std::string>* out_build_ids) const {
+// kPages source: splits the loaded VM ranges of the base map at page
+// boundaries and labels each piece with its page.  When a profile (such as a
+// trace of faulting addresses) was given, pages that it never touches are
+// grouped together instead, so that "-d symbols,pages" shows how many pages
+// each symbol pulls in, and "-d pages,symbols" how much of each touched page
+// is used.  Without a profile, --relocs likewise groups the pages that no
+// relocation dirties.  File ranges that aren't loaded are labeled [Unmapped].
+void Bloaty::AddPages(const RangeMap& base_vm_map,
+                      const std::vector<uint64_t>& relocs,
+                      RangeSink* sink) const {
+  const uint64_t page_size = options_.page_size();
+  auto sample = profile_.begin();
+  auto reloc = relocs.begin();
+  base_vm_map.ForEachRange([&](uint64_t start, uint64_t length) {
+    uint64_t end = start + length;
+    while (start < end) {
+      uint64_t page = start & ~(page_size - 1);
+      uint64_t page_end = std::min(end, page + page_size);
+      std::string label;
+      while (sample != profile_.end() && sample->addr < page) {
+        ++sample;
+      }
+      reloc = std::lower_bound(reloc, relocs.end(), page);
+      if (options_.has_profile_filename()) {
+        bool touched =
+            sample != profile_.end() && sample->addr < page + page_size;
+        label = touched ? "" : "[untouched pages]";
+      } else if (options_.count_relocs()) {
+        bool dirtied = reloc != relocs.end() && *reloc < page + page_size;
+        label = dirtied ? "" : "[clean pages]";
+      }
+      if (label.empty()) {
+        label = absl::StrCat("page 0x", absl::Hex(page, absl::kZeroPad8));
+      }
+      sink->AddVMRange("pages", start, page_end - start, label);
+      start = page_end;
+    }
+  });
+  sink->AddFileRange("pages_catchall", "[Unmapped]",
+                     sink->input_file().data());
+}
+
+// kIdenticalCode source: labels each function with the hash and size of its
+// code and its name, for GroupIdenticalCode() to group once every file has been
+// scanned.  The rest of the loaded VM space is labeled [not code].  Formats
+// that can't list their functions for disassembly have no functions here.
+void Bloaty::AddIdenticalCode(const ObjectFile& file,
+                              const RangeMap& base_vm_map,
+                              RangeSink* sink) const {
+  DisassemblyBatch batch;
+  ReImpl all_functions("");
+  if (file.GetDisassemblyBatch(all_functions, EffectiveSymbolSource(options_),
+                               &batch)) {
+    // Hash in parallel like DisassembleRegex() does.
+    const auto& functions = batch.functions;
+    std::vector<uint64_t> hashes(functions.size());
+    int num_threads = GetInnerThreadCount(functions.size());
+    std::vector<std::thread> threads(num_threads);
+    ThreadSafeIterIndex index(functions.size());
+
+    bool ignore_addresses = options_.icf_ignore_addresses();
+
+    for (int i = 0; i < num_threads; i++) {
+      threads[i] = std::thread([&batch, &functions, &index, &hashes,
+                                ignore_addresses]() {
+        try {
+          Disassembler disassembler(batch.arch, batch.mode);
+          int j;
+          while (index.TryGetNext(&j)) {
+            if (!functions[j].text.empty()) {
+              hashes[j] = disassembler.HashCode(functions[j].text,
+                                                functions[j].start_address,
+                                                ignore_addresses);
+            }
+          }
+        } catch (const bloaty::Error& e) {
+          index.Abort(e.what());
+        }
+      });
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    std::string error;
+    if (index.TryGetError(&error)) {
+      THROW(error.c_str());
+    }
+
+    const std::string& filename = sink->input_file().filename();
+    for (size_t i = 0; i < functions.size(); i++) {
+      const auto& function = functions[i];
+      if (function.text.empty()) {
+        continue;
+      }
+      sink->AddVMRange("icf", function.start_address, function.text.size(),
+                       absl::StrCat(absl::Hex(hashes[i], absl::kZeroPad16),
+                                    ":", function.text.size(), ":",
+                                    absl::Hex(function.start_address), ":",
+                                    filename.size(), ":", filename, ":",
+                                    function.name));
+    }
+  }
+
+  base_vm_map.ForEachRange([sink](uint64_t start, uint64_t length) {
+    sink->AddVMRange("icf_catchall", start, length, "[not code]");
+  });
+  sink->AddFileRange("icf_catchall", "[Unmapped]", sink->input_file().data());
+}
+
+// Returns the index of the symbol in |symbols| (which are in address order)
+// that contains |addr|, or ReferenceGraph::kNoNode.
+static uint32_t FindSymbol(
+    const std::vector<ReferenceGraphInput::Symbol>& symbols, uint64_t addr) {
+  auto it = std::upper_bound(
+      symbols.begin(), symbols.end(), addr,
+      [](uint64_t addr, const ReferenceGraphInput::Symbol& symbol) {
+        return addr < symbol.vmaddr;
+      });
+  if (it == symbols.begin() || addr - (it - 1)->vmaddr >= (it - 1)->size) {
+    return ReferenceGraph::kNoNode;
+  }
+  return static_cast<uint32_t>(it - 1 - symbols.begin());
+}
+
+// Finds the other symbols that each symbol in |input| refers to, in parallel
+// like AddIdenticalCode().  References come from disassembling x86 functions
+// and from scanning everything else for aligned words that point into a
+// symbol.
+static std::vector<std::vector<uint32_t>> FindSymbolReferences(
+    const ReferenceGraphInput& input, int num_threads) {
+  const auto& symbols = input.symbols;
+  std::vector<std::vector<uint32_t>> refs(symbols.size());
+  std::vector<std::thread> threads(num_threads);
+  ThreadSafeIterIndex index(symbols.size());
+
+  for (int i = 0; i < num_threads; i++) {
+    threads[i] = std::thread([&input, &symbols, &index, &refs]() {
+      try {
+        std::unique_ptr<Disassembler> disassembler;
+        if (input.can_disassemble && input.arch == CS_ARCH_X86) {
+          disassembler.reset(new Disassembler(input.arch, input.mode));
+        }
+        std::vector<uint64_t> addrs;
+        int j;
+        while (index.TryGetNext(&j)) {
+          const auto& symbol = symbols[j];
+          addrs.clear();
+          if (symbol.is_function && disassembler) {
+            disassembler->FindReferences(symbol.contents, symbol.vmaddr,
+                                         &addrs);
+          } else {
+            FindPossiblePointers(symbol.contents, symbol.vmaddr,
+                                 input.pointer_size, input.endian, &addrs);
+          }
+          for (uint64_t addr : addrs) {
+            uint32_t to = FindSymbol(symbols, addr);
+            if (to != ReferenceGraph::kNoNode &&
+                to != static_cast<uint32_t>(j)) {
+              refs[j].push_back(to);
+            }
+          }
+        }
+      } catch (const bloaty::Error& e) {
+        index.Abort(e.what());
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::string error;
+  if (index.TryGetError(&error)) {
+    THROW(error.c_str());
+  }
+  return refs;
+}
+
+// kDominators source: builds the graph of which symbols refer to which and
+// labels each symbol with its top-level dominator, the symbol nearest the
+// roots whose removal would also remove it.  So each row's size is the
+// retained size of the symbol it is named after.
+void Bloaty::AddDominators(const ObjectFile& file, const RangeMap& base_vm_map,
+                           RangeSink* sink) const {
+  ReferenceGraphInput input;
+  if (file.GetReferenceGraphInput(EffectiveSymbolSource(options_), &input)) {
+    const auto& symbols = input.symbols;
+    if (symbols.size() >= ReferenceGraph::kNoNode) {
+      THROW("too many symbols for the dominators data source");
+    }
+
+    std::vector<std::vector<uint32_t>> refs =
+        FindSymbolReferences(input, GetInnerThreadCount(symbols.size()));
+
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    std::vector<uint32_t> roots;
+    for (uint32_t i = 0; i < symbols.size(); i++) {
+      for (uint32_t to : refs[i]) {
+        edges.push_back({i, to});
+      }
+      std::vector<uint32_t>().swap(refs[i]);
+      if (symbols[i].is_root) {
+        roots.push_back(i);
+      }
+    }
+    for (const auto& pointer : input.pointers) {
+      uint32_t from = FindSymbol(symbols, pointer.first);
+      uint32_t to = FindSymbol(symbols, pointer.second);
+      if (from != ReferenceGraph::kNoNode && to != ReferenceGraph::kNoNode &&
+          from != to) {
+        edges.push_back({from, to});
+      }
+    }
+
+    ReferenceGraph graph(symbols.size(), edges);
+    DominatorTree tree = ComputeDominatorTree(graph, roots);
+
+    // The tree's order visits each node after its dominator.
+    std::vector<uint32_t> top(symbols.size());
+    for (uint32_t node : tree.order) {
+      if (node == tree.root) {
+        continue;
+      }
+      uint32_t idom = tree.idom[node];
+      top[node] = idom == tree.root ? node : top[idom];
+    }
+
+    for (uint32_t i = 0; i < symbols.size(); i++) {
+      sink->AddVMRange("dominators", symbols[i].vmaddr, symbols[i].size,
+                       symbols[top[i]].name);
+    }
+  }
+
+  base_vm_map.ForEachRange([sink](uint64_t start, uint64_t length) {
+    sink->AddVMRange("dominators_catchall", start, length, "[no symbol]");
+  });
+  sink->AddFileRange("dominators_catchall", "[Unmapped]",
+                     sink->input_file().data());
+}
+
+// --compressed: compresses the loaded parts of |file| block by block, in
+// parallel like AddIdenticalCode().  Deflate at its highest level stands in
+// for whatever the file will be packaged with.
+void Bloaty::CompressLoadedRanges(const InputFile& file,
+                                  const RangeMap& base_file_map,
+                                  CompressedSizes* sizes) const {
+  sizes->AddBlocks(base_file_map, options_.compression_block_size());
+  auto& blocks = *sizes->blocks();
+  const string_view data = file.data();
+  // Blocks are cut from the loaded ranges, so with a large block size they
+  // are usually much smaller than that; size the buffers for the largest one.
+  uint64_t max_block_size = 0;
+  for (const auto& block : blocks) {
+    max_block_size = std::max(max_block_size, block.size);
+  }
+  const uLong bound = compressBound(max_block_size);
+  int num_threads = GetInnerThreadCount(blocks.size());
+  std::vector<std::thread> threads(num_threads);
+  ThreadSafeIterIndex index(blocks.size());
+
+  for (int i = 0; i < num_threads; i++) {
+    threads[i] = std::thread([&blocks, data, bound, &index]() {
+      std::vector<Bytef> buf(bound);
+      int j;
+      while (index.TryGetNext(&j)) {
+        auto& block = blocks[j];
+        uLongf len = buf.size();
+        if (compress2(buf.data(), &len,
+                      reinterpret_cast<const Bytef*>(data.data()) + block.start,
+                      block.size, Z_BEST_COMPRESSION) != Z_OK) {
+          index.Abort("error compressing file contents");
+          return;
+        }
+        block.compressed = len;
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::string error;
+  if (index.TryGetError(&error)) {
+    THROW(error.c_str());
+  }
+  sizes->Finish();
+}
+
+void Bloaty::ScanAndRollupFile(const std::string& filename,
+                               MemoryBudget* budget, Rollup* rollup,
+                               std::vector<std::string>* out_build_ids,
+                               std::string* raw_map) const {
+  // Declared first so that it is released only after everything below,
+  // including the file mapping and the arena, has been freed.
+  MemoryBudget::Reservation reservation(budget);
+
+  // For allocating memory, like to decompress compressed sections.  Each file
+  // gets its own, so that the memory is freed as soon as the file is done.
+  google::protobuf::Arena arena;
+
   auto file = GetObjectFile(filename);
 
-  DualMaps maps;
+  // With --source-filter, archive members that can't match aren't parsed.
+  std::vector<uint64_t> skipped_members;
+  ArchiveIndex index;
+  if (CanSkipArchiveMembers() && file->ReadArchiveIndex(true, &index) &&
+      index.has_symbol_table) {
+    ReImpl regex(options_.source_filter());
+    for (const auto& member : index.members) {
+      if (!member.contents.empty() && !ArchiveMemberCanMatch(member, regex)) {
+        skipped_members.push_back(member.contents.data() -
+                                  file->file_data().data().data());
+      }
+    }
+    std::sort(skipped_members.begin(), skipped_members.end());
+  }
+
+  DualMaps maps(labels_);
   std::vector<std::unique_ptr<RangeSink>> sinks;
   std::vector<RangeSink*> sink_ptrs;
   std::vector<RangeSink*> filename_sink_ptrs;
+  std::vector<RangeSink*> page_sink_ptrs;
+  std::vector<RangeSink*> icf_sink_ptrs;
+  std::vector<RangeSink*> dominator_sink_ptrs;
 
   // Base map always goes first.
   sinks.push_back(absl::make_unique<RangeSink>(
       &file->file_data(), options_, DataSource::kSegments, nullptr, nullptr));
   NameMunger empty_munger;
   sinks.back()->AddOutput(maps.base_map(), &empty_munger);
+  sinks.back()->SetSkippedMembers(&skipped_members);
   sink_ptrs.push_back(sinks.back().get());
 
   for (auto source : sources_) {
     sinks.push_back(absl::make_unique<RangeSink>(
         &file->file_data(), options_, source->effective_source, maps.base_map(),
-        arena_.get()));
-    sinks.back()->AddOutput(maps.AppendMap(), source->munger.get());
+        &arena));
+    // GroupIdenticalCode() rewrites the labels of "icf" sources once they are
+    // grouped.
+    bool is_icf = source->effective_source == DataSource::kIdenticalCode;
+    sinks.back()->AddOutput(maps.AppendMap(is_icf),
+                            is_icf ? &empty_munger : source->munger.get());
+    sinks.back()->SetSkippedMembers(&skipped_members);
     // We handle the kInputFiles data source internally, without handing it off
     // to the file format implementation.  This seems slightly simpler, since
-    // the file format has to deal with armembers too.
+    // the file format has to deal with armembers too.  kPages is derived from
+    // the base map in the same way, so it works for every format, and
+    // kIdenticalCode and kDominators from the symbols that the format lists.
     if (source->effective_source == DataSource::kInputFiles) {
       filename_sink_ptrs.push_back(sinks.back().get());
+    } else if (source->effective_source == DataSource::kPages) {
+      page_sink_ptrs.push_back(sinks.back().get());
+    } else if (source->effective_source == DataSource::kIdenticalCode) {
+      icf_sink_ptrs.push_back(sinks.back().get());
+    } else if (source->effective_source == DataSource::kDominators) {
+      dominator_sink_ptrs.push_back(sinks.back().get());
     } else {
       sink_ptrs.push_back(sinks.back().get());
     }
@@ -1793,6 +3068,16 @@ void Bloaty::ScanAndRollupFile(const std::string& filename, Rollup* rollup,
     }
   }
 
+  // Estimating reads every section header, so it is only done for
+  // --max-memory.
+  if (budget) {
+    uint64_t estimate = file->EstimateScanMemory();
+    if (debug_file) {
+      estimate += debug_file->EstimateScanMemory();
+    }
+    reservation.Acquire(estimate);
+  }
+
   int64_t filesize_before =
       rollup->file_total() + rollup->filtered_file_total();
   file->ProcessFile(sink_ptrs);
@@ -1811,7 +3096,32 @@ void Bloaty::ScanAndRollupFile(const std::string& filename, Rollup* rollup,
         });
   }
 
-  maps.ComputeRollup(rollup);
+  std::vector<uint64_t> relocs;
+  if (options_.count_relocs()) {
+    file->ReadDynamicRelocations(&relocs);
+    std::sort(relocs.begin(), relocs.end());
+  }
+
+  for (auto sink : page_sink_ptrs) {
+    AddPages(maps.base_map()->vm_map, relocs, sink);
+  }
+
+  for (auto sink : icf_sink_ptrs) {
+    AddIdenticalCode(*file, maps.base_map()->vm_map, sink);
+  }
+
+  for (auto sink : dominator_sink_ptrs) {
+    AddDominators(*file, maps.base_map()->vm_map, sink);
+  }
+
+  std::unique_ptr<CompressedSizes> compressed;
+  if (options_.compressed_size()) {
+    compressed.reset(new CompressedSizes);
+    CompressLoadedRanges(file->file_data(), maps.base_map()->file_map,
+                         compressed.get());
+  }
+
+  maps.ComputeRollup(profile_, relocs, compressed.get(), rollup);
 
   // The ObjectFile implementation must guarantee this.
   int64_t filesize =
@@ -1819,48 +3129,176 @@ void Bloaty::ScanAndRollupFile(const std::string& filename, Rollup* rollup,
   (void)filesize;
   assert(filesize == file->file_data().data().size());
 
-  if (verbose_level > 0 || options_.dump_raw_map()) {
-    printf("Maps for %s:\n\n", filename.c_str());
+  if (raw_map) {
+    absl::StrAppend(raw_map, "Maps for ", filename, ":\n\n");
     if (show != ShowDomain::kShowVM) {
-      printf("FILE MAP:\n");
-      maps.PrintFileMaps();
+      *raw_map += "FILE MAP:\n";
+      maps.PrintFileMaps(raw_map);
     }
     if (show != ShowDomain::kShowFile) {
-      printf("VM MAP:\n");
-      maps.PrintVMMaps();
+      *raw_map += "VM MAP:\n";
+      maps.PrintVMMaps(raw_map);
+    }
+  }
+}
+
+int Bloaty::GetThreadCount(size_t jobs) const {
+  int num_threads = options_.threads() > 0
+                        ? options_.threads()
+                        : std::thread::hardware_concurrency();
+  return static_cast<int>(std::min<size_t>(num_threads, jobs));
+}
+
+// For work inside the scan of one file, like hashing its functions.  The scan
+// pool already runs a thread per file, and each of them may start this many
+// more, so only the threads that the pool leaves over are handed out.
+int Bloaty::GetInnerThreadCount(size_t work) const {
+  int scan_threads = std::max(GetThreadCount(scan_job_count_), 1);
+  int num_threads = std::max(GetThreadCount(SIZE_MAX) / scan_threads, 1);
+  return static_cast<int>(std::min<size_t>(num_threads, work));
+}
+
+bool Bloaty::HasIdenticalCodeSource() const {
+  for (auto source : sources_) {
+    if (source->effective_source == DataSource::kIdenticalCode) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Bloaty::CanSkipArchiveMembers() const {
+  // A member can be ruled out from the archive's symbol table only if every
+  // label it could get is a symbol name.  (Symbols that aren't global, and so
+  // aren't in the table, are missed.)
+  if (!options_.has_source_filter()) {
+    return false;
+  }
+  for (auto source : sources_) {
+    switch (source->effective_source) {
+      case DataSource::kRawSymbols:
+      case DataSource::kShortSymbols:
+      case DataSource::kFullSymbols:
+      case DataSource::kTemplates:
+        break;
+      default:
+        return false;
+    }
+    if (!source->munger->IsEmpty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Bloaty::ArchiveMemberCanMatch(const ArchiveIndex::Member& member,
+                                   const ReImpl& regex) const {
+  for (const auto& symbol : member.symbols) {
+    for (auto source : sources_) {
+      if (ReImpl::PartialMatch(
+              ItaniumDemangle(symbol, source->effective_source), regex)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void Bloaty::AddThinArchiveMembers(const std::string& filename,
+                                   std::vector<std::string>* filenames) const {
+  // The symbol table is only needed to rule members out.
+  bool can_skip = CanSkipArchiveMembers();
+  ArchiveIndex index;
+  GetObjectFile(filename)->ReadArchiveIndex(can_skip, &index);
+  std::unique_ptr<ReImpl> regex;
+  if (can_skip && index.has_symbol_table) {
+    regex = absl::make_unique<ReImpl>(options_.source_filter());
+  }
+
+  // Member paths are relative to the archive's directory.
+  size_t slash = filename.rfind('/');
+  for (const auto& member : index.members) {
+    if (regex && !ArchiveMemberCanMatch(member, *regex)) {
+      continue;
+    }
+    if (member.path[0] != '/' && slash != std::string::npos) {
+      filenames->push_back(filename.substr(0, slash + 1) + member.path);
+    } else {
+      filenames->push_back(member.path);
     }
   }
 }
 
-void Bloaty::ScanAndRollupFiles(const std::vector<std::string>& filenames,
-                                std::vector<std::string>* build_ids,
-                                Rollup* rollup) const {
-  int num_cpus = std::thread::hardware_concurrency();
-  int num_threads = std::min(num_cpus, static_cast<int>(filenames.size()));
+void Bloaty::ScanAndRollupFiles(
+    const std::vector<std::string>& filenames,
+    const std::vector<std::string>& base_filenames,
+    std::vector<std::string>* build_ids, Rollup* rollup, Rollup* base) const {
+  // The files for both sides of a diff are scanned by a single pool, so that
+  // (for example) a one-file-vs-one-file diff scans both files concurrently.
+  // Each job is tagged with the side it rolls up into.
+  enum Side { kTarget = 0, kBase = 1, kNumSides = 2 };
+
+  struct Job {
+    const std::string* filename;
+    Side side;
+  };
+
+  std::vector<Job> jobs;
+  for (const auto& filename : filenames) {
+    jobs.push_back({&filename, kTarget});
+  }
+  for (const auto& filename : base_filenames) {
+    jobs.push_back({&filename, kBase});
+  }
+
+  int num_threads = GetThreadCount(jobs.size());
 
   struct PerThreadData {
-    Rollup rollup;
+    explicit PerThreadData(LabelPool* labels)
+        : rollups{Rollup(labels), Rollup(labels)} {}
+    Rollup rollups[kNumSides];
     std::vector<std::string> build_ids;
   };
 
-  std::vector<PerThreadData> thread_data(num_threads);
+  std::vector<PerThreadData> thread_data;
+  thread_data.reserve(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    thread_data.emplace_back(labels_.get());
+  }
   std::vector<std::thread> threads(num_threads);
-  ThreadSafeIterIndex index(filenames.size());
+  ThreadSafeIterIndex index(jobs.size());
 
+  std::unique_ptr<MemoryBudget> budget;
+  if (options_.max_memory() > 0) {
+    budget = absl::make_unique<MemoryBudget>(options_.max_memory());
+  }
+
+  // Raw maps are collected per job and printed in input order once all jobs
+  // are done, so that the output doesn't depend on the thread count.
+  bool dump_raw_map = verbose_level > 0 || options_.dump_raw_map();
+  std::vector<std::string> raw_maps(dump_raw_map ? jobs.size() : 0);
+
+  // The labels of "icf" sources are filtered once ScanAndRollup() has grouped
+  // them.
   std::unique_ptr<ReImpl> regex = nullptr;
-  if (options_.has_source_filter()) {
+  if (options_.has_source_filter() && !HasIdenticalCodeSource()) {
     regex = absl::make_unique<ReImpl>(options_.source_filter());
   }
 
   for (int i = 0; i < num_threads; i++) {
-    thread_data[i].rollup.SetFilterRegex(regex.get());
+    for (auto& side_rollup : thread_data[i].rollups) {
+      side_rollup.SetFilterRegex(regex.get());
+    }
 
     threads[i] = std::thread(
-        [this, &index, &filenames](PerThreadData* data) {
+        [this, &index, &jobs, &budget, &raw_maps](PerThreadData* data) {
           try {
             int j;
             while (index.TryGetNext(&j)) {
-              ScanAndRollupFile(filenames[j], &data->rollup, &data->build_ids);
+              const Job& job = jobs[j];
+              ScanAndRollupFile(*job.filename, budget.get(),
+                                &data->rollups[job.side], &data->build_ids,
+                                raw_maps.empty() ? nullptr : &raw_maps[j]);
             }
           } catch (const bloaty::Error& e) {
             index.Abort(e.what());
@@ -1872,16 +3310,45 @@ void Bloaty::ScanAndRollupFiles(const std::vector<std::string>& filenames,
   for (int i = 0; i < num_threads; i++) {
     threads[i].join();
     PerThreadData* data = &thread_data[i];
-    if (i == 0) {
-      *rollup = std::move(data->rollup);
-    } else {
-      rollup->Add(data->rollup);
-    }
-
     build_ids->insert(build_ids->end(), data->build_ids.begin(),
                       data->build_ids.end());
   }
 
+  for (const auto& raw_map : raw_maps) {
+    fputs(raw_map.c_str(), stdout);
+  }
+
+  // Merge the per-thread rollups of each side as a pairwise tree reduction: in
+  // each round, rollup i absorbs rollup i + stride, and all merges within a
+  // round (for both sides) run concurrently.  This keeps the serial tail at
+  // O(log threads) merges instead of O(threads).
+  for (int stride = 1; stride < num_threads; stride *= 2) {
+    std::vector<std::thread> mergers;
+    for (int side = 0; side < kNumSides; side++) {
+      if (side == kBase && base_filenames.empty()) {
+        continue;
+      }
+      for (int i = 0; i + stride < num_threads; i += 2 * stride) {
+        mergers.emplace_back(
+            [](Rollup* dst, Rollup* src) { dst->Add(std::move(*src)); },
+            &thread_data[i].rollups[side],
+            &thread_data[i + stride].rollups[side]);
+      }
+    }
+    for (auto& merger : mergers) {
+      merger.join();
+    }
+    if (verbose_level > 1) {
+      printf("Merged rollups with stride %d (%zu merges)\n", stride,
+             mergers.size());
+    }
+  }
+
+  if (num_threads > 0) {
+    *rollup = std::move(thread_data[0].rollups[kTarget]);
+    *base = std::move(thread_data[0].rollups[kBase]);
+  }
+
   std::string error;
   if (index.TryGetError(&error)) {
     THROW(error.c_str());
@@ -1889,7 +3356,8 @@ void Bloaty::ScanAndRollupFiles(const std::vector<std::string>& filenames,
 }
 
 void Bloaty::ScanAndRollup(const Options& options, RollupOutput* output) {
-  if (input_files_.empty()) {
+  // With --shard, a shard may legitimately get none of the files.
+  if (input_files_.empty() && options.shard_count() <= 1) {
     THROW("no filename specified");
   }
 
@@ -1897,33 +3365,67 @@ void Bloaty::ScanAndRollup(const Options& options, RollupOutput* output) {
     output->AddDataSourceName(name);
   }
 
-  Rollup rollup;
+  std::vector<CustomDataSource> icf_sources =
+      FindIdenticalCodeSources(options, source_names_);
+  if (!icf_sources.empty() && options.has_source_filter() &&
+      options.has_write_partial()) {
+    THROW(
+        "--source-filter can't be used with --write-partial and the icf "
+        "source; pass it to --merge instead");
+  }
+
+  Rollup rollup(labels_.get());
+  Rollup base(labels_.get());
   std::vector<std::string> build_ids;
   std::vector<std::string> input_filenames;
+  std::vector<std::string> base_filenames;
   for (const auto& file_info : input_files_) {
     input_filenames.push_back(file_info.filename_);
+    if (file_info.is_thin_archive_) {
+      AddThinArchiveMembers(file_info.filename_, &input_filenames);
+    }
   }
-  ScanAndRollupFiles(input_filenames, &build_ids, &rollup);
-
-  if (!base_files_.empty()) {
-    Rollup base;
-    std::vector<std::string> base_filenames;
-    for (const auto& file_info : base_files_) {
-      base_filenames.push_back(file_info.filename_);
+  for (const auto& file_info : base_files_) {
+    base_filenames.push_back(file_info.filename_);
+    if (file_info.is_thin_archive_) {
+      AddThinArchiveMembers(file_info.filename_, &base_filenames);
     }
-    ScanAndRollupFiles(base_filenames, &build_ids, &base);
-    rollup.AddEntriesFrom(base);
-    rollup.CreateDiffModeRollupOutput(&base, options, output);
+  }
+  scan_job_count_ = input_filenames.size() + base_filenames.size();
+  ScanAndRollupFiles(input_filenames, base_filenames, &build_ids, &rollup,
+                     &base);
+
+  // The diff mode of a partial is decided by the whole run, since a shard may
+  // have no base files of its own.
+  bool diff_mode = options.base_filename_size() > 0;
+  if (options.has_write_partial()) {
+    WritePartialRollup(options, source_names_, icf_sources, rollup,
+                       diff_mode ? &base : nullptr);
   } else {
-    rollup.CreateRollupOutput(options, output);
+    // The labels of "icf" sources are only final once they are grouped, so
+    // ScanAndRollupFiles() leaves --source-filter to this.
+    std::unique_ptr<ReImpl> regex;
+    if (options.has_source_filter() && !icf_sources.empty()) {
+      regex = absl::make_unique<ReImpl>(options.source_filter());
+    }
+    GroupIdenticalCode(source_names_, icf_sources, &rollup);
+    if (regex) rollup.FilterRows(*regex);
+    if (diff_mode) {
+      GroupIdenticalCode(source_names_, icf_sources, &base);
+      if (regex) base.FilterRows(*regex);
+      rollup.CreateDiffModeRollupOutput(&base, options, output);
+    } else {
+      rollup.CreateRollupOutput(options, output);
+    }
   }
 
   for (const auto& build_id : build_ids) {
     debug_files_.erase(build_id);
   }
 
-  // Error out if some --debug-files were not used.
-  if (!debug_files_.empty()) {
+  // Error out if some --debug-files were not used.  With --shard, the files
+  // of other shards may be the ones that use them.
+  if (!debug_files_.empty() && options.shard_count() <= 1) {
     std::string input_files;
     std::string unused_debug;
     for (const auto& pair : debug_files_) {
@@ -1962,6 +3464,183 @@ void Bloaty::DisassembleFunction(string_view function, const Options& options,
   THROWF("Couldn't find function $0 to disassemble", function);
 }
 
+void Bloaty::DisassembleRegex(const std::string& regex, const Options& options,
+                              RollupOutput* output) {
+  ReImpl re(regex);
+  if (!re.ok()) {
+    THROW("invalid regex for disassemble_regex");
+  }
+
+  std::string disassembly;
+  size_t function_count = 0;
+
+  for (const auto& file_info : input_files_) {
+    auto file = GetObjectFile(file_info.filename_);
+    DisassemblyBatch batch;
+    if (!file->GetDisassemblyBatch(re, EffectiveSymbolSource(options),
+                                   &batch)) {
+      continue;
+    }
+
+    // Each thread opens its own Capstone handle and writes into its own slots
+    // of |results|, so the output order doesn't depend on scheduling.
+    const auto& functions = batch.functions;
+    std::vector<std::string> results(functions.size());
+    int num_threads = GetThreadCount(functions.size());
+    std::vector<std::thread> threads(num_threads);
+    ThreadSafeIterIndex index(functions.size());
+
+    for (int i = 0; i < num_threads; i++) {
+      threads[i] = std::thread([&batch, &functions, &index, &results]() {
+        try {
+          Disassembler disassembler(batch.arch, batch.mode);
+          int j;
+          while (index.TryGetNext(&j)) {
+            results[j] = disassembler.Disassemble(
+                functions[j].text, functions[j].start_address,
+                batch.symbol_map);
+          }
+        } catch (const bloaty::Error& e) {
+          index.Abort(e.what());
+        }
+      });
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    std::string error;
+    if (index.TryGetError(&error)) {
+      THROW(error.c_str());
+    }
+
+    for (size_t i = 0; i < functions.size(); i++) {
+      absl::StrAppend(&disassembly, functions[i].name, ":\n", results[i],
+                      "\n");
+    }
+    function_count += functions.size();
+  }
+
+  if (function_count == 0) {
+    THROWF("Couldn't find any functions matching $0 to disassemble", regex);
+  }
+
+  output->SetDisassembly(disassembly);
+}
+
+// --symbol-ordering-file: orders the functions of the input file so that the
+// hot ones share as few pages as possible (see symbol_order.h), and writes
+// their names for the linker.  Calls between functions are only found by
+// disassembling x86 code; elsewhere, functions are just sorted by how dense
+// their samples are.
+void Bloaty::WriteSymbolOrdering(const Options& options,
+                                 RollupOutput* output) {
+  if (input_files_.size() != 1) {
+    THROW("--symbol-ordering-file takes exactly one input file");
+  }
+  const std::string& filename = input_files_[0].filename_;
+  auto file = GetObjectFile(filename);
+
+  // The linker looks up the names as they are in the symbol table.
+  ReferenceGraphInput input;
+  if (!file->GetReferenceGraphInput(DataSource::kRawSymbols, &input)) {
+    THROWF("can't order the functions of '$0' (only ELF binaries and shared "
+           "libraries are supported)",
+           filename);
+  }
+  const auto& symbols = input.symbols;
+  if (symbols.size() >= ReferenceGraph::kNoNode) {
+    THROW("too many symbols for --symbol-ordering-file");
+  }
+
+  std::vector<OrderedFunction> functions;
+  std::vector<uint32_t> function_index(symbols.size(), ReferenceGraph::kNoNode);
+  std::vector<uint32_t> function_symbol;
+  for (uint32_t i = 0; i < symbols.size(); i++) {
+    if (symbols[i].is_function && symbols[i].size > 0) {
+      function_index[i] = functions.size();
+      function_symbol.push_back(i);
+      functions.push_back({symbols[i].vmaddr, symbols[i].size, 0});
+    }
+  }
+  if (functions.empty()) {
+    THROWF("no functions to order in '$0'", filename);
+  }
+
+  // Without a profile every function counts as equally hot, so functions
+  // are only grouped with their callers.
+  const bool has_profile = options.has_profile_filename();
+  for (auto& function : functions) {
+    if (!has_profile) {
+      function.samples = 1;
+      continue;
+    }
+    auto sample = std::lower_bound(
+        profile_.begin(), profile_.end(), function.vmaddr,
+        [](const ProfileSample& sample, uint64_t addr) {
+          return sample.addr < addr;
+        });
+    while (sample != profile_.end() &&
+           sample->addr - function.vmaddr < function.size) {
+      function.samples += sample->count;
+      ++sample;
+    }
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t>> calls;
+  if (input.can_disassemble && input.arch == CS_ARCH_X86) {
+    std::vector<std::vector<uint32_t>> refs =
+        FindSymbolReferences(input, GetThreadCount(symbols.size()));
+    for (uint32_t i = 0; i < symbols.size(); i++) {
+      uint32_t from = function_index[i];
+      for (uint32_t to_symbol : refs[i]) {
+        uint32_t to = function_index[to_symbol];
+        if (from != ReferenceGraph::kNoNode && to != ReferenceGraph::kNoNode) {
+          calls.push_back({from, to});
+        }
+      }
+    }
+  }
+
+  ReferenceGraph graph(functions.size(), calls);
+  std::vector<uint32_t> order =
+      ComputeFunctionOrder(functions, graph, options.page_size());
+
+  // Local functions in different files can share a name; the linker places
+  // all of them where the name first appears.
+  std::ofstream out(options.symbol_ordering_file());
+  std::unordered_set<std::string> written;
+  for (uint32_t i : order) {
+    const std::string& name = symbols[function_symbol[i]].name;
+    if (!name.empty() && written.insert(name).second) {
+      out << name << "\n";
+    }
+  }
+  out.close();
+  if (!out) {
+    THROWF("couldn't write symbol ordering to '$0'",
+           options.symbol_ordering_file());
+  }
+
+  std::string summary =
+      absl::Substitute("Wrote $0 symbols to $1\n", written.size(),
+                       options.symbol_ordering_file());
+  if (has_profile) {
+    // Functions are in address order, so the first one is where .text starts.
+    std::vector<uint64_t> addrs;
+    for (const auto& function : functions) {
+      addrs.push_back(function.vmaddr);
+    }
+    uint64_t before = CountHotPages(functions, addrs, options.page_size());
+    addrs = LayOutFunctions(functions, order, functions[0].vmaddr);
+    uint64_t after = CountHotPages(functions, addrs, options.page_size());
+    absl::StrAppend(&summary, "Hot .text pages: ", before, " before, ", after,
+                    " after (", options.page_size(), "-byte pages)\n");
+  }
+  output->SetSummary(summary);
+}
+
 const char usage[] = R"(Bloaty McBloatface: a size profiler for binaries.
 
 USAGE: bloaty [OPTION]... FILE... [-- BASE_FILE...]
@@ -1971,6 +3650,11 @@ Options:
   --csv              Output in CSV format instead of human-readable.
   --tsv              Output in TSV format instead of human-readable.
   -c FILE            Load configuration from <file>.
+  --compressed       Also show each row's share of the file's size once its
+                     loaded bytes are compressed (with deflate) in
+                     independent blocks.
+  --compression-block-size=BYTES
+                     Block size for --compressed (default 65536).
   -d SOURCE,SOURCE   Comma-separated list of sources to scan.
   --debug-file=FILE  Use this file for debug symbols and/or symbol table.
   --source-map=ID=FILE
@@ -1985,19 +3669,54 @@ Options:
                      The default is --demangle=short.
   --disassemble=FUNCTION
                      Disassemble this function (EXPERIMENTAL)
+  --disassemble-regex=PATTERN
+                     Disassemble every function whose name matches
+                     this regex, in address order (EXPERIMENTAL)
   --domain=DOMAIN    Which domains to show.  Possible values are:
                        --domain=vm
                        --domain=file
                        --domain=both (the default)
+  --icf-ignore-addresses
+                     Make the "icf" data source ignore the addresses that
+                     functions refer to, so that copies match even when
+                     what they call or load is at another address.
+  --merge            Add up the partial results in FILE... (written by
+                     --write-partial) and report them as one run.
+  --max-memory=BYTES
+                     Only scan as many files at once as fit in about BYTES
+                     of memory, estimated from each file's size plus its
+                     compressed sections' uncompressed size.
   -n NUM             How many rows to show per level before collapsing
                      other keys into '[Other]'.  Set to '0' for unlimited.
                      Defaults to 20.
+  --page-size=BYTES  Page size for the "pages" data source (default 4096).
+  --profile=FILE     Count the sampled addresses in FILE against each row
+                     and show the samples and VM bytes per sample.  FILE
+                     has one hex VM address per line, optionally followed
+                     by a sample count (e.g. `perf script -F ip` output).
+  --relocs           Count the dynamic relocations (REL, RELA, RELR and
+                     Android packed) that write into each row (ELF only).
+  --shard=I/N        Only scan the input files whose index modulo N is I
+                     (counting from 0).  Use with --write-partial.
   -s SORTBY          Whether to sort by VM or File size.  Possible values
                      are:
                        -s vm
                        -s file
                        -s both (the default: sorts by max(vm, file)).
+                       -s samples (requires --profile)
+                       -s relocs (requires --relocs)
+                       -s compressed (requires --compressed)
+  --symbol-ordering-file=FILE
+                     Instead of a report, write the input file's function
+                     names to FILE, ordered to pack the hot ones (from
+                     --profile) into as few pages as possible.  FILE is
+                     meant for lld's --symbol-ordering-file.
+  --threads=NUM      How many threads to scan files with.  Defaults to one
+                     per CPU.
   -w                 Wide output; don't truncate long labels.
+  --write-partial=FILE
+                     Write the complete results to FILE instead of printing
+                     a report, so they can be combined with --merge.
   --help             Display this message and exit.
   --list-sources     Show a list of available sources and exit.
   --source-filter=PATTERN
@@ -2131,6 +3850,12 @@ bool DoParseOptions(bool skip_unknown, int* argc, char** argv[],
       output_options->output_format = OutputFormat::kCSV;
     } else if (args.TryParseFlag("--tsv")) {
       output_options->output_format = OutputFormat::kTSV;
+    } else if (args.TryParseFlag("--relocs")) {
+      options->set_count_relocs(true);
+    } else if (args.TryParseFlag("--compressed")) {
+      options->set_compressed_size(true);
+    } else if (args.TryParseFlag("--icf-ignore-addresses")) {
+      options->set_icf_ignore_addresses(true);
     } else if (args.TryParseFlag("--raw-map")) {
       options->set_dump_raw_map(true);
     } else if (args.TryParseOption("-c", &option)) {
@@ -2172,6 +3897,8 @@ bool DoParseOptions(bool skip_unknown, int* argc, char** argv[],
       options->set_debug_vmaddr(uint64_option);
     } else if (args.TryParseOption("--disassemble", &option)) {
       options->mutable_disassemble_function()->assign(std::string(option));
+    } else if (args.TryParseOption("--disassemble-regex", &option)) {
+      options->mutable_disassemble_regex()->assign(std::string(option));
     } else if (args.TryParseIntegerOption("-n", &int_option)) {
       if (int_option == 0) {
         options->set_max_rows_per_level(INT64_MAX);
@@ -2196,9 +3923,45 @@ bool DoParseOptions(bool skip_unknown, int* argc, char** argv[],
         options->set_sort_by(Options::SORTBY_FILESIZE);
       } else if (option == "both") {
         options->set_sort_by(Options::SORTBY_BOTH);
+      } else if (option == "samples") {
+        options->set_sort_by(Options::SORTBY_SAMPLES);
+      } else if (option == "relocs") {
+        options->set_sort_by(Options::SORTBY_RELOCS);
+      } else if (option == "compressed") {
+        options->set_sort_by(Options::SORTBY_COMPRESSED);
       } else {
         THROWF("unknown value for -s: $0", option);
       }
+    } else if (args.TryParseUint64Option("--page-size", &uint64_option)) {
+      options->set_page_size(uint64_option);
+    } else if (args.TryParseUint64Option("--compression-block-size",
+                                         &uint64_option)) {
+      options->set_compression_block_size(uint64_option);
+    } else if (args.TryParseUint64Option("--max-memory", &uint64_option)) {
+      options->set_max_memory(uint64_option);
+    } else if (args.TryParseOption("--symbol-ordering-file", &option)) {
+      options->set_symbol_ordering_file(std::string(option));
+    } else if (args.TryParseOption("--shard", &option)) {
+      std::vector<string_view> parts = absl::StrSplit(option, '/');
+      int index, count;
+      if (parts.size() != 2 || !absl::SimpleAtoi(parts[0], &index) ||
+          !absl::SimpleAtoi(parts[1], &count) || count < 1 || index < 0 ||
+          index >= count) {
+        THROWF("--shard should be I/N with 0 <= I < N, got: $0", option);
+      }
+      options->set_shard_index(index);
+      options->set_shard_count(count);
+    } else if (args.TryParseOption("--write-partial", &option)) {
+      options->set_write_partial(std::string(option));
+    } else if (args.TryParseFlag("--merge")) {
+      options->set_merge(true);
+    } else if (args.TryParseIntegerOption("--threads", &int_option)) {
+      if (int_option < 0) {
+        THROW("thread count must be non-negative");
+      }
+      options->set_threads(int_option);
+    } else if (args.TryParseOption("--profile", &option)) {
+      options->set_profile_filename(std::string(option));
     } else if (args.TryParseOption("--source-filter", &option)) {
       options->set_source_filter(std::string(option));
     } else if (args.TryParseOption("--source-map", &option)) {
@@ -2240,7 +4003,9 @@ bool DoParseOptions(bool skip_unknown, int* argc, char** argv[],
   }
 
   if (options->data_source_size() == 0 &&
-      !options->has_disassemble_function()) {
+      !options->has_disassemble_function() &&
+      !options->has_disassemble_regex() && !options->merge() &&
+      !options->has_symbol_ordering_file()) {
     // Default when no sources are specified.
     options->add_data_source("sections");
   }
@@ -2285,12 +4050,36 @@ void BloatyDoMain(const Options& options, const InputFileFactory& file_factory,
     THROW("max_rows_per_level must be at least 1");
   }
 
-  for (auto& filename : options.filename()) {
-    bloaty.AddFilename(filename, false);
+  if (options.shard_count() < 1 || options.shard_index() < 0 ||
+      options.shard_index() >= options.shard_count()) {
+    THROW("shard index must be between 0 and the shard count");
   }
 
-  for (auto& base_filename : options.base_filename()) {
-    bloaty.AddFilename(base_filename, true);
+  if (options.merge()) {
+    if (options.shard_count() > 1) {
+      THROW("--shard can't be used with --merge");
+    }
+    verbose_level = options.verbose_level();
+    MergePartialRollups(options, file_factory, output);
+    return;
+  }
+
+  // Files are assigned to shards by their position on the command line, so
+  // every shard of a run must be given the same file list.
+  auto in_shard = [&options](int index) {
+    return index % options.shard_count() == options.shard_index();
+  };
+
+  for (int i = 0; i < options.filename_size(); i++) {
+    if (in_shard(i)) {
+      bloaty.AddFilename(options.filename(i), false);
+    }
+  }
+
+  for (int i = 0; i < options.base_filename_size(); i++) {
+    if (in_shard(i)) {
+      bloaty.AddFilename(options.base_filename(i), true);
+    }
   }
 
   for (auto& debug_filename : options.debug_filename()) {
@@ -2316,12 +4105,60 @@ void BloatyDoMain(const Options& options, const InputFileFactory& file_factory,
     }
   }
 
+  if (options.page_size() == 0 ||
+      (options.page_size() & (options.page_size() - 1)) != 0) {
+    THROW("page size must be a power of two");
+  }
+
+  if (options.has_profile_filename()) {
+    if (options.base_filename_size() > 0) {
+      THROW("--profile can't be used in diff mode");
+    }
+    // The profile's addresses belong to one binary; applying it to several
+    // input files would count every sample once per file.
+    if (options.filename_size() > 1) {
+      THROW("--profile can't be used with more than one input file");
+    }
+    bloaty.SetProfileFilename(options.profile_filename());
+  } else if (options.sort_by() == Options::SORTBY_SAMPLES) {
+    THROW("sorting by samples requires --profile");
+  }
+
+  if (options.count_relocs() && options.base_filename_size() > 0) {
+    THROW("--relocs can't be used in diff mode");
+  } else if (!options.count_relocs() &&
+             options.sort_by() == Options::SORTBY_RELOCS) {
+    THROW("sorting by relocs requires --relocs");
+  }
+
+  if (options.compressed_size() && options.base_filename_size() > 0) {
+    THROW("--compressed can't be used in diff mode");
+  } else if (!options.compressed_size() &&
+             options.sort_by() == Options::SORTBY_COMPRESSED) {
+    THROW("sorting by compressed size requires --compressed");
+  } else if (options.compression_block_size() == 0 ||
+             options.compression_block_size() > UINT32_MAX) {
+    THROW("compression block size must be between 1 and 4294967295");
+  }
+
+  if (options.has_symbol_ordering_file()) {
+    if (options.base_filename_size() > 0) {
+      THROW("--symbol-ordering-file can't be used in diff mode");
+    } else if (options.data_source_size() > 0) {
+      THROW("--symbol-ordering-file doesn't take data sources");
+    }
+  }
+
   verbose_level = options.verbose_level();
 
-  if (options.data_source_size() > 0) {
+  if (options.has_symbol_ordering_file()) {
+    bloaty.WriteSymbolOrdering(options, output);
+  } else if (options.data_source_size() > 0) {
     bloaty.ScanAndRollup(options, output);
   } else if (options.has_disassemble_function()) {
     bloaty.DisassembleFunction(options.disassemble_function(), options, output);
+  } else if (options.has_disassemble_regex()) {
+    bloaty.DisassembleRegex(options.disassemble_regex(), options, output);
   }
 }
 
@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <inttypes.h>
 
+#include <algorithm>
 #include <memory>
 #include <set>
 #include <string>
@@ -39,6 +40,7 @@
 #include "bloaty.pb.h"
 #include "range_map.h"
 #include "re.h"
+#include "util.h"
 
 namespace bloaty {
 
@@ -47,13 +49,18 @@ extern int verbose_level;
 class NameMunger;
 class Options;
 struct DualMap;
+struct DisassemblyBatch;
 struct DisassemblyInfo;
+struct ReferenceGraphInput;
 
 enum class DataSource {
   kArchiveMembers,
   kCompileUnits,
+  kDominators,
+  kIdenticalCode,
   kInlines,
   kInputFiles,
+  kPages,
   kRawRanges,
   kSections,
   kSegments,
@@ -64,7 +71,8 @@ enum class DataSource {
 
   kRawSymbols,
   kFullSymbols,
-  kShortSymbols
+  kShortSymbols,
+  kTemplates
 };
 
 class InputFile {
@@ -169,6 +177,14 @@ public:
     }
   }
 
+  // For formats without a VM address space, like WebAssembly, whose debug
+  // info gives addresses as offsets into part of the file.  After this call,
+  // the VM-only functions below add the file range at |fileoff| + vmaddr
+  // instead, so that DWARF can be read as usual.
+  void MapVMAddressesToFileOffset(uint64_t fileoff) {
+    vm_file_offset_ = fileoff;
+  }
+
   // The VM-only functions below may not be used to populate the base map!
 
   // Adds a region to the memory map.  It should not overlap any previous
@@ -212,6 +228,19 @@ public:
   absl::string_view ZlibDecompress(absl::string_view contents,
                                    uint64_t uncompressed_size);
 
+  // Archive members that the file format should label "[AR Skipped Member]"
+  // instead of parsing, given as the offsets of their contents in the file,
+  // sorted.  |offsets| must outlive this sink.
+  void SetSkippedMembers(const std::vector<uint64_t>* offsets) {
+    skipped_members_ = offsets;
+  }
+  bool IsSkippedMember(absl::string_view contents) const {
+    return skipped_members_ &&
+           std::binary_search(skipped_members_->begin(),
+                              skipped_members_->end(),
+                              contents.data() - file_->data().data());
+  }
+
   static constexpr uint64_t kUnknownSize = RangeMap::kUnknownSize;
 
  private:
@@ -231,6 +260,12 @@ public:
   const DualMap* translator_;
   std::vector<std::pair<DualMap*, const NameMunger*>> outputs_;
   google::protobuf::Arena *arena_;
+
+  // Set by MapVMAddressesToFileOffset().
+  static constexpr uint64_t kNoFileOffset = UINT64_MAX;
+  uint64_t vm_file_offset_ = kNoFileOffset;
+
+  const std::vector<uint64_t>* skipped_members_ = nullptr;
 };
 
 // NameMunger //////////////////////////////////////////////////////////////////
@@ -254,7 +289,59 @@ class NameMunger {
   std::vector<std::pair<std::unique_ptr<ReImpl>, std::string>> regexes_;
 };
 
-typedef std::map<absl::string_view, std::pair<uint64_t, uint64_t>> SymbolTable;
+// The start address and size of every symbol in a file, sorted by address.
+// DWARF variable locations give only an address, so compileunits uses this to
+// find how many bytes each one covers.
+class SymbolSizes {
+ public:
+  struct Entry {
+    uint64_t addr;
+    uint64_t size;
+  };
+
+  // Call in symbol table order, then call Sort() before any lookups.  When
+  // several symbols start at the same address, the first one wins.
+  void Add(uint64_t addr, uint64_t size) { entries_.push_back({addr, size}); }
+  void Sort();
+
+  bool empty() const { return entries_.empty(); }
+  const std::vector<Entry>& entries() const { return entries_; }
+
+  // Returns true if any of |sinks| will need a file's SymbolSizes, so that
+  // ProcessFile() can collect them during the symbols pass.
+  static bool NeededBy(const std::vector<RangeSink*>& sinks) {
+    for (auto sink : sinks) {
+      if (sink->data_source() == DataSource::kCompileUnits) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  std::vector<Entry> entries_;
+};
+
+// The members of an archive, as listed by ObjectFile::ReadArchiveIndex().
+struct ArchiveIndex {
+  struct Member {
+    // Where the member's contents are in the archive.  Empty for the members
+    // of a thin archive, which are stored in files of their own.
+    absl::string_view contents;
+
+    // For thin archives, the path of the member's file, which is relative to
+    // the archive's directory unless it is absolute.
+    std::string path;
+
+    // The symbols that the archive's symbol table says this member defines.
+    std::vector<std::string> symbols;
+  };
+
+  std::vector<Member> members;
+
+  // If false, the archive has no symbol table and every |symbols| is empty.
+  bool has_symbol_table = false;
+};
 
 // Represents an object/executable file in a format like ELF, Mach-O, PE, etc.
 // To support a new file type, implement this interface.
@@ -275,6 +362,42 @@ class ObjectFile {
                                   DataSource symbol_source,
                                   DisassemblyInfo* info) const = 0;
 
+  // Collects every function whose name (as displayed for |symbol_source|)
+  // matches |regex|.  Returns false if this format can't be disassembled.
+  virtual bool GetDisassemblyBatch(const ReImpl& regex,
+                                   DataSource symbol_source,
+                                   DisassemblyBatch* batch) const = 0;
+
+  // Lists the symbols of this file and where they might refer to each other,
+  // for the dominators data source.  Returns false if this format (or this
+  // kind of file, like an object file) can't provide them.
+  virtual bool GetReferenceGraphInput(DataSource /*symbol_source*/,
+                                      ReferenceGraphInput* /*input*/) const {
+    return false;
+  }
+
+  // Lists the members of this archive, and if |read_symbol_table|, the symbols
+  // that the archive's symbol table says each one defines.  Returns false if
+  // this isn't an archive.
+  virtual bool ReadArchiveIndex(bool /*read_symbol_table*/,
+                                ArchiveIndex* /*index*/) const {
+    return false;
+  }
+
+  // Whether this is a thin archive, whose members are files of their own.
+  virtual bool IsThinArchive() const { return false; }
+
+  // Appends the VM addresses that the dynamic loader writes to when it applies
+  // this file's relocations.  Formats without dynamic relocations add nothing.
+  virtual void ReadDynamicRelocations(
+      std::vector<uint64_t>* /*targets*/) const {}
+
+  // Returns a rough estimate of the memory that scanning this file takes: the
+  // file itself plus any sections that have to be decompressed first.
+  virtual uint64_t EstimateScanMemory() const {
+    return file_data().data().size();
+  }
+
   const InputFile& file_data() const { return *file_data_; }
 
   // Sets the debug file for |this|.  |file| must outlive this instance.
@@ -299,11 +422,11 @@ std::unique_ptr<ObjectFile> TryOpenSourceMapFile(
 
 // Provided by dwarf.cc.  To use these, a module should fill in a dwarf::File
 // and then call these functions.
-void ReadDWARFCompileUnits(const dwarf::File& file, const DualMap& map,
+void ReadDWARFCompileUnits(const dwarf::File& file, const SymbolSizes& symbols,
                            const dwarf::CU* skeleton, RangeSink* sink);
-inline void ReadDWARFCompileUnits(const dwarf::File& file, const DualMap& map,
-                                  RangeSink* sink) {
-  return ReadDWARFCompileUnits(file, map, nullptr, sink);
+inline void ReadDWARFCompileUnits(const dwarf::File& file,
+                                  const SymbolSizes& symbols, RangeSink* sink) {
+  return ReadDWARFCompileUnits(file, symbols, nullptr, sink);
 }
 void ReadDWARFInlines(const dwarf::File& file, RangeSink* sink,
                       bool include_line);
@@ -320,6 +443,10 @@ std::string ItaniumDemangle(absl::string_view symbol, DataSource source);
 // Contains a RangeMap for VM space and file space for a given file.
 
 struct DualMap {
+  DualMap() : DualMap(std::make_shared<LabelPool>()) {}
+  explicit DualMap(std::shared_ptr<LabelPool> labels)
+      : vm_map(labels), file_map(labels) {}
+
   RangeMap vm_map;
   RangeMap file_map;
 };
@@ -332,6 +459,84 @@ struct DisassemblyInfo {
   uint64_t start_address;
 };
 
+// All of the functions of one file that matched --disassemble-regex, in
+// address order.  They share one symbol map for naming call targets.
+struct DisassemblyBatch {
+  struct Function {
+    std::string name;
+    absl::string_view text;
+    uint64_t start_address;
+  };
+
+  DualMap symbol_map;
+  cs_arch arch;
+  cs_mode mode;
+  std::vector<Function> functions;
+};
+
+// The symbols of one binary, for building the graph of which symbols refer
+// to which (see reference_graph.h).
+struct ReferenceGraphInput {
+  struct Symbol {
+    std::string name;
+    uint64_t vmaddr;
+    uint64_t size;
+    absl::string_view contents;  // Empty if the symbol isn't in the file.
+    bool is_function;
+
+    // Whether something outside the binary can refer to this symbol, like the
+    // entry point or an exported symbol.
+    bool is_root;
+  };
+
+  // In address order, with one symbol per address.
+  std::vector<Symbol> symbols;
+
+  // (address, value) pairs for pointers that the dynamic loader writes, which
+  // aren't in the file contents.
+  std::vector<std::pair<uint64_t, uint64_t>> pointers;
+
+  cs_arch arch;
+  cs_mode mode;
+  bool can_disassemble;
+  int pointer_size;
+  Endian endian;
+};
+
+// Owns a Capstone handle, so that one thread can disassemble many functions
+// without reopening it for each one.
+class Disassembler {
+ public:
+  Disassembler(cs_arch arch, cs_mode mode);
+  ~Disassembler();
+  Disassembler(const Disassembler&) = delete;
+  Disassembler& operator=(const Disassembler&) = delete;
+
+  std::string Disassemble(absl::string_view text, uint64_t start_address,
+                          const DualMap& symbol_map);
+
+  // Returns a hash of the function's code that is the same for identical
+  // copies at different addresses.  On x86, calls and jumps out of the
+  // function and RIP-relative operands are hashed as the address they refer
+  // to, or with |ignore_addresses| as a placeholder (as are absolute memory
+  // operands), so that copies match even when what they refer to has moved;
+  // other architectures hash the bytes as they are.  The hash is the same on
+  // every run.
+  uint64_t HashCode(absl::string_view text, uint64_t start_address,
+                    bool ignore_addresses);
+
+  // Appends the addresses that the function refers to outside of itself: the
+  // targets of its calls and jumps, RIP-relative operands, and immediates that
+  // are large enough to be addresses.  x86 only; other architectures find
+  // nothing.
+  void FindReferences(absl::string_view text, uint64_t start_address,
+                      std::vector<uint64_t>* refs);
+
+ private:
+  cs_arch arch_;
+  csh handle_;
+};
+
 std::string DisassembleFunction(const DisassemblyInfo& info);
 void DisassembleFindReferences(const DisassemblyInfo& info, RangeSink* sink);
 
@@ -354,9 +559,13 @@ struct RollupRow {
   DomainSizes filtered_size = {0, 0};
 
   int64_t other_count = 0;
+  int64_t samples = 0;  // Profile samples, if a profile was given.
+  int64_t relocs = 0;   // Dynamic relocations, if requested.
+  int64_t compressed = 0;  // Compressed file size, if requested.
   int64_t sortkey;
   double vmpercent;
   double filepercent;
+  double compressedpercent;
 
   // The size of the base in a diff mode. Otherwise stay 0.
   DomainSizes old_size = {0, 0};
@@ -410,9 +619,18 @@ struct RollupOutput {
 
   absl::string_view GetDisassembly() { return disassembly_; }
 
+  // Text printed after the report, like what --symbol-ordering-file did.
+  void SetSummary(absl::string_view summary) {
+    summary_ = std::string(summary);
+  }
+  absl::string_view GetSummary() { return summary_; }
+
   // For debugging.
   const RollupRow& toplevel_row() const { return toplevel_row_; }
   bool diff_mode() const { return diff_mode_; }
+  bool show_samples() const { return show_samples_; }
+  bool show_relocs() const { return show_relocs_; }
+  bool show_compressed() const { return show_compressed_; }
 
  private:
   friend class Rollup;
@@ -420,10 +638,20 @@ struct RollupOutput {
   std::vector<std::string> source_names_;
   RollupRow toplevel_row_;
   std::string disassembly_;
+  std::string summary_;
 
   // When we are in diff mode, rollup sizes are relative to the baseline.
   bool diff_mode_ = false;
 
+  // When a profile was given, rows carry sample counts to print.
+  bool show_samples_ = false;
+
+  // When --relocs was given, rows carry dynamic relocation counts to print.
+  bool show_relocs_ = false;
+
+  // When --compressed was given, rows carry compressed file sizes to print.
+  bool show_compressed_ = false;
+
   static bool IsSame(const std::string& a, const std::string& b);
   void PrettyPrint(const OutputOptions& options, std::ostream* out) const;
   void PrintToCSV(std::ostream* out, bool tabs, bool csvDiff) const;
@@ -38,6 +38,28 @@ static std::string RightPad(const std::string& input, size_t size) {
   return ret;
 }
 
+// 64-bit FNV-1a.  Unlike std::hash, it doesn't change between runs, so the
+// hashes can be compared across processes (as --merge does).
+class CodeHasher {
+ public:
+  void Add(string_view bytes) {
+    for (unsigned char c : bytes) {
+      hash_ = (hash_ ^ c) * 0x100000001b3;
+    }
+  }
+
+  void AddInt(uint64_t val) {
+    for (int i = 0; i < 8; i++) {
+      hash_ = (hash_ ^ ((val >> (i * 8)) & 0xff)) * 0x100000001b3;
+    }
+  }
+
+  uint64_t value() const { return hash_; }
+
+ private:
+  uint64_t hash_ = 0xcbf29ce484222325;
+};
+
 }  // anonymous namespace
 
 void DisassembleFindReferences(const DisassemblyInfo& info, RangeSink* sink) {
@@ -132,23 +154,27 @@ bool TryGetJumpTarget(cs_arch arch, cs_insn *in, uint64_t* target) {
   }
 }
 
-std::string DisassembleFunction(const DisassemblyInfo& info) {
-  std::string ret;
-
-  csh handle;
-  if (cs_open(info.arch, info.mode, &handle) != CS_ERR_OK ||
-      cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON) != CS_ERR_OK) {
+Disassembler::Disassembler(cs_arch arch, cs_mode mode) : arch_(arch) {
+  if (cs_open(arch, mode, &handle_) != CS_ERR_OK ||
+      cs_option(handle_, CS_OPT_DETAIL, CS_OPT_ON) != CS_ERR_OK) {
     THROW("Couldn't initialize Capstone");
   }
+}
 
-  if (info.text.size() == 0) {
+Disassembler::~Disassembler() { cs_close(&handle_); }
+
+std::string Disassembler::Disassemble(string_view text, uint64_t start_address,
+                                      const DualMap& symbol_map) {
+  std::string ret;
+
+  if (text.size() == 0) {
     THROW("Tried to disassemble empty function.");
   }
 
   cs_insn *insn;
   size_t count =
-      cs_disasm(handle, reinterpret_cast<const uint8_t *>(info.text.data()),
-                info.text.size(), info.start_address, 0, &insn);
+      cs_disasm(handle_, reinterpret_cast<const uint8_t *>(text.data()),
+                text.size(), start_address, 0, &insn);
 
   if (count == 0) {
     THROW("Error disassembling function.");
@@ -159,9 +185,9 @@ std::string DisassembleFunction(const DisassemblyInfo& info) {
   for (size_t i = 0; i < count; i++) {
     cs_insn *in = insn + i;
     uint64_t target;
-    if (TryGetJumpTarget(info.arch, in, &target) &&
-        target >= info.start_address &&
-        target < info.start_address + info.text.size()) {
+    if (TryGetJumpTarget(arch_, in, &target) &&
+        target >= start_address &&
+        target < start_address + text.size()) {
       local_labels[target] = 0;  // Fill in real value later.
     }
   }
@@ -180,7 +206,7 @@ std::string DisassembleFunction(const DisassemblyInfo& info) {
     std::string match;
     std::string label;
 
-    if (info.arch == CS_ARCH_X86) {
+    if (arch_ == CS_ARCH_X86) {
       if (in->id == X86_INS_LEA) {
         ReImpl::GlobalReplace(&op_str, "\\w?word ptr ", "");
       } else if (in->id == X86_INS_NOP) {
@@ -203,7 +229,7 @@ std::string DisassembleFunction(const DisassemblyInfo& info) {
     }
 
     uint64_t target;
-    if (TryGetJumpTarget(info.arch, in, &target)) {
+    if (TryGetJumpTarget(arch_, in, &target)) {
       auto iter = local_labels.find(target);
       std::string label;
       if (iter != local_labels.end()) {
@@ -212,7 +238,7 @@ std::string DisassembleFunction(const DisassemblyInfo& info) {
         } else {
           op_str = "<" + std::to_string(iter->second);
         }
-      } else if (info.symbol_map.vm_map.TryGetLabel(target, &label)) {
+      } else if (symbol_map.vm_map.TryGetLabel(target, &label)) {
         op_str = label;
       }
     }
@@ -221,8 +247,177 @@ std::string DisassembleFunction(const DisassemblyInfo& info) {
                     RightPad(std::string(mnemonic), 8), " ", op_str, "\n");
   }
 
-  cs_close(&handle);
+  cs_free(insn, count);
   return ret;
 }
 
+// Whether |in| refers to something outside of the function at
+// [start, end) by a relative offset, so that its bytes change with the
+// function's address even if what it refers to doesn't.
+static bool HasRelativeReference(cs_arch arch, cs_insn* in, uint64_t start,
+                                 uint64_t end) {
+  uint64_t target;
+  if (TryGetJumpTarget(arch, in, &target)) {
+    return target < start || target >= end;
+  }
+  const cs_x86& x86 = in->detail->x86;
+  for (size_t i = 0; i < x86.op_count; i++) {
+    if (x86.operands[i].type == X86_OP_MEM &&
+        x86.operands[i].mem.base == X86_REG_RIP) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether |op| reads or writes memory at an absolute address, as code that
+// isn't position independent does.  Segment-relative operands (like the
+// thread pointer's fs:0x28) aren't addresses.
+static bool IsAbsoluteAddress(const cs_x86_op& op) {
+  return op.type == X86_OP_MEM && op.mem.base == X86_REG_INVALID &&
+         op.mem.segment == X86_REG_INVALID;
+}
+
+// Whether |in| has an operand that --icf-ignore-addresses hashes as a
+// placeholder.
+static bool HasAbsoluteAddress(cs_insn* in) {
+  const cs_x86& x86 = in->detail->x86;
+  for (size_t i = 0; i < x86.op_count; i++) {
+    if (IsAbsoluteAddress(x86.operands[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t Disassembler::HashCode(string_view text, uint64_t start_address,
+                                bool ignore_addresses) {
+  CodeHasher hasher;
+  hasher.AddInt(text.size());
+  if (arch_ != CS_ARCH_X86) {
+    hasher.Add(text);
+    return hasher.value();
+  }
+
+  cs_insn* in = cs_malloc(handle_);
+  uint64_t address = start_address;
+  uint64_t end_address = start_address + text.size();
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(text.data());
+  size_t size = text.size();
+
+  while (size > 0) {
+    string_view rest(reinterpret_cast<const char*>(ptr), size);
+    if (!cs_disasm_iter(handle_, &ptr, &size, &address, in)) {
+      // Not everything in a function symbol is code; hash the rest as is.
+      hasher.Add(rest);
+      break;
+    }
+
+    if (!HasRelativeReference(arch_, in, start_address, end_address) &&
+        !(ignore_addresses && HasAbsoluteAddress(in))) {
+      hasher.Add(
+          string_view(reinterpret_cast<const char*>(in->bytes), in->size));
+      continue;
+    }
+
+    // Hash the instruction's encoding without its displacement or immediate,
+    // followed by its operands with relative ones made absolute (or, with
+    // |ignore_addresses|, with addresses replaced by a placeholder).  Capstone
+    // already reports branch targets as absolute addresses.
+    uint64_t target;
+    bool is_branch = TryGetJumpTarget(arch_, in, &target);
+    const cs_x86& x86 = in->detail->x86;
+    hasher.AddInt(in->id);
+    hasher.Add(string_view(reinterpret_cast<const char*>(x86.prefix),
+                           sizeof(x86.prefix)));
+    hasher.Add(string_view(reinterpret_cast<const char*>(x86.opcode),
+                           sizeof(x86.opcode)));
+    hasher.AddInt(x86.rex);
+    hasher.AddInt(x86.modrm);
+    for (size_t i = 0; i < x86.op_count; i++) {
+      const cs_x86_op& op = x86.operands[i];
+      hasher.AddInt(op.type);
+      hasher.AddInt(op.size);
+      switch (op.type) {
+        case X86_OP_REG:
+          hasher.AddInt(op.reg);
+          break;
+        case X86_OP_IMM:
+          hasher.AddInt(ignore_addresses && is_branch ? 0 : op.imm);
+          break;
+        case X86_OP_MEM:
+          hasher.AddInt(op.mem.segment);
+          hasher.AddInt(op.mem.base);
+          hasher.AddInt(op.mem.index);
+          hasher.AddInt(op.mem.scale);
+          if (ignore_addresses && (op.mem.base == X86_REG_RIP ||
+                                   IsAbsoluteAddress(op))) {
+            hasher.AddInt(0);
+          } else {
+            hasher.AddInt(op.mem.base == X86_REG_RIP
+                              ? in->address + in->size + op.mem.disp
+                              : op.mem.disp);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  cs_free(in, 1);
+  return hasher.value();
+}
+
+void Disassembler::FindReferences(string_view text, uint64_t start_address,
+                                  std::vector<uint64_t>* refs) {
+  if (arch_ != CS_ARCH_X86) {
+    return;
+  }
+
+  cs_insn* in = cs_malloc(handle_);
+  uint64_t address = start_address;
+  uint64_t end_address = start_address + text.size();
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(text.data());
+  size_t size = text.size();
+
+  while (size > 0) {
+    if (!cs_disasm_iter(handle_, &ptr, &size, &address, in)) {
+      // As in DisassembleFindReferences(), the rest may be data.
+      break;
+    }
+
+    uint64_t target;
+    if (TryGetJumpTarget(arch_, in, &target)) {
+      if (target < start_address || target >= end_address) {
+        refs->push_back(target);
+      }
+      continue;
+    }
+
+    const cs_x86& x86 = in->detail->x86;
+    for (size_t i = 0; i < x86.op_count; i++) {
+      const cs_x86_op& op = x86.operands[i];
+      if (op.type == X86_OP_MEM && op.mem.base == X86_REG_RIP &&
+          op.mem.index == X86_REG_INVALID) {
+        refs->push_back(in->address + in->size + op.mem.disp);
+      } else if (op.type == X86_OP_MEM && op.mem.base == X86_REG_INVALID &&
+                 op.mem.disp > 0xffff) {
+        // An absolute address, as in non-PIC code or a jump table.
+        refs->push_back(op.mem.disp);
+      } else if (op.type == X86_OP_IMM && op.size >= 4 && op.imm > 0xffff) {
+        refs->push_back(op.imm);
+      }
+    }
+  }
+
+  cs_free(in, 1);
+}
+
+std::string DisassembleFunction(const DisassemblyInfo& info) {
+  Disassembler disassembler(info.arch, info.mode);
+  return disassembler.Disassemble(info.text, info.start_address,
+                                  info.symbol_map);
+}
+
 }  // namespace bloaty
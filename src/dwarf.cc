@@ -405,7 +405,7 @@ uint64_t TryReadPcPair(const dwarf::CU& cu, const GeneralDIE& die,
 // To view DIEs for a given file, try:
 //   readelf --debug-dump=info foo.bin
 void AddDIE(const dwarf::CU& cu, const GeneralDIE& die,
-            const DualMap& symbol_map, RangeSink* sink) {
+            std::vector<uint64_t>* locations, RangeSink* sink) {
   uint64_t low_pc = TryReadPcPair(cu, die, sink);
 
   // Sometimes the DIE has a "location", which gives the location as an address.
@@ -425,20 +425,9 @@ void AddDIE(const dwarf::CU& cu, const GeneralDIE& die,
         BLOATY_UNREACHABLE();
       }
 
-      // Unfortunately the location doesn't include a size, so we look that part
-      // up in the symbol map.
-      uint64_t size;
-      if (symbol_map.vm_map.TryGetSize(addr, &size)) {
-        sink->AddVMRangeIgnoreDuplicate("dwarf_location", addr, size,
-                                        cu.unit_name());
-      } else {
-        if (verbose_level > 0) {
-          fprintf(stderr,
-                  "bloaty: warning: couldn't find DWARF location in symbol "
-                  "table, address: %" PRIx64 ", name: %s\n",
-                  addr, cu.unit_name().c_str());
-        }
-      }
+      // The location doesn't include a size, so we look that up in the symbol
+      // table once the whole CU has been read.
+      locations->push_back(addr);
     }
   }
 
@@ -580,17 +569,62 @@ struct DwoFilePointer {
   std::string dwo_name;
 };
 
+void SymbolSizes::Sort() {
+  std::stable_sort(
+      entries_.begin(), entries_.end(),
+      [](const Entry& a, const Entry& b) { return a.addr < b.addr; });
+  entries_.erase(std::unique(entries_.begin(), entries_.end(),
+                             [](const Entry& a, const Entry& b) {
+                               return a.addr == b.addr;
+                             }),
+                 entries_.end());
+}
+
+// Adds the DW_OP_addr locations collected from one CU, sizing each one by the
+// symbol that starts at that address.  Sorting the locations first lets us
+// resolve them all in one forward pass over the symbols.
+static void AddDWARFLocations(const dwarf::CU& cu, const SymbolSizes& symbols,
+                              std::vector<uint64_t>* locations,
+                              RangeSink* sink) {
+  if (locations->empty()) {
+    return;
+  }
+
+  std::sort(locations->begin(), locations->end());
+  locations->erase(std::unique(locations->begin(), locations->end()),
+                   locations->end());
+
+  const auto& entries = symbols.entries();
+  auto it = entries.begin();
+  for (uint64_t addr : *locations) {
+    it = std::lower_bound(it, entries.end(), addr,
+                          [](const SymbolSizes::Entry& entry, uint64_t addr) {
+                            return entry.addr < addr;
+                          });
+    if (it != entries.end() && it->addr == addr) {
+      sink->AddVMRangeIgnoreDuplicate("dwarf_location", addr, it->size,
+                                      cu.unit_name());
+    } else if (verbose_level > 0) {
+      fprintf(stderr,
+              "bloaty: warning: couldn't find DWARF location in symbol "
+              "table, address: %" PRIx64 ", name: %s\n",
+              addr, cu.unit_name().c_str());
+    }
+  }
+}
+
 // The DWARF debug info can help us get compileunits info.  DIEs for compilation
 // units, functions, and global variables often have attributes that will
 // resolve to addresses.
 static void ReadDWARFDebugInfo(dwarf::InfoReader& reader,
                                dwarf::InfoReader::Section section,
-                               const DualMap& symbol_map, RangeSink* sink) {
+                               const SymbolSizes& symbols,
+                               dwarf::IndirectStringSink* strings,
+                               RangeSink* sink) {
   dwarf::CUIter iter = reader.GetCUIter(section);
   dwarf::CU cu;
-  cu.SetIndirectStringCallback([sink, &cu](string_view str) {
-    sink->AddFileRange("dwarf_strp", cu.unit_name(), str);
-  });
+  cu.SetIndirectStringSink(strings);
+  std::vector<uint64_t> locations;
 
   while (iter.NextCU(reader, &cu)) {
     dwarf::DIEReader die_reader = cu.GetDIEReader();
@@ -619,7 +653,7 @@ static void ReadDWARFDebugInfo(dwarf::InfoReader& reader,
       auto file = MmapInputFileFactory().OpenFile(dwo_info.comp_dir + "/" + dwo_info.dwo_name);
       dwarf::File dwo_dwarf;
       cu.dwarf().open(*file, &dwo_dwarf, sink);
-      ReadDWARFCompileUnits(dwo_dwarf, symbol_map, &cu, sink);
+      ReadDWARFCompileUnits(dwo_dwarf, symbols, &cu, sink);
     }
 
     if (cu.unit_name().empty()) {
@@ -627,7 +661,8 @@ static void ReadDWARFDebugInfo(dwarf::InfoReader& reader,
     }
 
     sink->AddFileRange("dwarf_debuginfo", cu.unit_name(), cu.entire_unit());
-    AddDIE(cu, compileunit_die, symbol_map, sink);
+    locations.clear();
+    AddDIE(cu, compileunit_die, &locations, sink);
 
     if (compileunit_die.stmt_list) {
       ReadDWARFStmtListRange(cu, *compileunit_die.stmt_list, sink);
@@ -648,13 +683,15 @@ static void ReadDWARFDebugInfo(dwarf::InfoReader& reader,
           die.declaration) {
         die_reader.SkipChildren(cu, abbrev);
       } else {
-        AddDIE(cu, die, symbol_map, sink);
+        AddDIE(cu, die, &locations, sink);
       }
     }
+
+    AddDWARFLocations(cu, symbols, &locations, sink);
   }
 }
 
-void ReadDWARFCompileUnits(const dwarf::File& file, const DualMap& symbol_map,
+void ReadDWARFCompileUnits(const dwarf::File& file, const SymbolSizes& symbols,
                            const dwarf::CU* skeleton, RangeSink* sink) {
   if (!file.debug_info.size()) {
     THROW("missing debug info");
@@ -664,13 +701,15 @@ void ReadDWARFCompileUnits(const dwarf::File& file, const DualMap& symbol_map,
     ReadDWARFAddressRanges(file, sink);
   }
 
-  // Share a reader to avoid re-parsing debug abbreviations.
+  // Share a reader to avoid re-parsing debug abbreviations, and share the
+  // string sink so that .debug_types doesn't re-add strings from .debug_info.
   dwarf::InfoReader reader(file, skeleton);
+  dwarf::IndirectStringSink strings(file, sink);
 
-  ReadDWARFDebugInfo(reader, dwarf::InfoReader::Section::kDebugInfo, symbol_map,
-                     sink);
-  ReadDWARFDebugInfo(reader, dwarf::InfoReader::Section::kDebugTypes,
-                     symbol_map, sink);
+  ReadDWARFDebugInfo(reader, dwarf::InfoReader::Section::kDebugInfo, symbols,
+                     &strings, sink);
+  ReadDWARFDebugInfo(reader, dwarf::InfoReader::Section::kDebugTypes, symbols,
+                     &strings, sink);
   ReadDWARFPubNames(reader, file.debug_pubnames, sink);
   ReadDWARFPubNames(reader, file.debug_pubtypes, sink);
 }
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "dwarf/debug_info.h"
+#include "bloaty.h"
 #include "dwarf_constants.h"
 #include "dwarf/dwarf_util.h"
 
@@ -290,5 +291,18 @@ void DIEReader::SkipChildren(const CU& cu, const AbbrevTable::Abbrev* abbrev) {
   }
 }
 
+IndirectStringSink::IndirectStringSink(const File& file, RangeSink* sink)
+    : sink_(sink) {
+  sections_[0].data = file.debug_str;
+  sections_[1].data = file.debug_line_str;
+  for (auto& section : sections_) {
+    section.seen.resize((section.data.size() + 63) / 64);
+  }
+}
+
+void IndirectStringSink::AddFileRange(const CU& cu, string_view str) {
+  sink_->AddFileRange("dwarf_strp", cu.unit_name(), str);
+}
+
 }  // namespace dwarf
 }  // namespace bloaty
@@ -48,7 +48,7 @@
 #ifndef BLOATY_DWARF_DEBUG_INFO_H_
 #define BLOATY_DWARF_DEBUG_INFO_H_
 
-#include <functional>
+#include <vector>
 #include <unordered_map>
 
 #include "absl/strings/string_view.h"
@@ -204,6 +204,7 @@ class AbbrevTable {
 class CUIter;
 class CU;
 class DIEReader;
+class IndirectStringSink;
 
 // Stores/caches abbreviation info and CU names.
 class InfoReader {
@@ -266,15 +267,10 @@ class CU {
   uint64_t range_lists_base() const { return range_lists_base_; }
   const AbbrevTable& unit_abbrev() const { return *unit_abbrev_; }
 
-  void AddIndirectString(absl::string_view range) const {
-    if (strp_callback_) {
-      strp_callback_(range);
-    }
-  }
+  inline void AddIndirectString(absl::string_view range) const;
 
-  void SetIndirectStringCallback(
-      std::function<void(absl::string_view)> strp_sink) {
-    strp_callback_ = strp_sink;
+  void SetIndirectStringSink(IndirectStringSink* strp_sink) {
+    strp_sink_ = strp_sink;
   }
 
   bool IsValidDwarfAddress(uint64_t addr) const {
@@ -312,9 +308,61 @@ class CU {
   uint64_t str_offsets_base_ = 0;
   uint64_t range_lists_base_ = 0;
 
-  std::function<void(absl::string_view)> strp_callback_;
+  IndirectStringSink* strp_sink_ = nullptr;
 };
 
+// Attributes the .debug_str and .debug_line_str entries that DIEs refer to
+// (DW_FORM_strp and friends) to the referring CU.  Common strings like type
+// names are referenced from thousands of DIEs, but only the first reference
+// can win the range, so repeats are filtered out inline with a bitmap holding
+// one bit per byte of each string section.
+class IndirectStringSink {
+ public:
+  IndirectStringSink(const File& file, RangeSink* sink);
+  IndirectStringSink(const IndirectStringSink&) = delete;
+  IndirectStringSink& operator=(const IndirectStringSink&) = delete;
+
+  void Add(const CU& cu, absl::string_view str) {
+    if (!TestAndSetSeen(str)) {
+      AddFileRange(cu, str);
+    }
+  }
+
+ private:
+  struct StringSection {
+    absl::string_view data;
+    std::vector<uint64_t> seen;
+  };
+
+  // Returns true if a string starting at the same place has been added before.
+  // Strings outside of the string sections are never filtered.
+  bool TestAndSetSeen(absl::string_view str) {
+    for (auto& section : sections_) {
+      uintptr_t ofs = reinterpret_cast<uintptr_t>(str.data()) -
+                      reinterpret_cast<uintptr_t>(section.data.data());
+      if (ofs < section.data.size()) {
+        uint64_t bit = 1ULL << (ofs % 64);
+        uint64_t& word = section.seen[ofs / 64];
+        bool ret = word & bit;
+        word |= bit;
+        return ret;
+      }
+    }
+    return false;
+  }
+
+  void AddFileRange(const CU& cu, absl::string_view str);
+
+  RangeSink* sink_;
+  StringSection sections_[2];
+};
+
+void CU::AddIndirectString(absl::string_view range) const {
+  if (strp_sink_) {
+    strp_sink_->Add(*this, range);
+  }
+}
+
 // DIEReader: for reading a sequence of Debugging Information Entries in a
 // compilation unit.
 class DIEReader {
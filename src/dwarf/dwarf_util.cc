@@ -30,42 +30,6 @@ bool IsValidDwarfAddress(uint64_t addr, uint8_t address_size) {
   return true;
 }
 
-uint64_t ReadLEB128Internal(bool is_signed, string_view* data) {
-  uint64_t ret = 0;
-  int shift = 0;
-  int maxshift = 70;
-  const char* ptr = data->data();
-  const char* limit = ptr + data->size();
-
-  while (ptr < limit && shift < maxshift) {
-    char byte = *(ptr++);
-    ret |= static_cast<uint64_t>(byte & 0x7f) << shift;
-    shift += 7;
-    if ((byte & 0x80) == 0) {
-      data->remove_prefix(ptr - data->data());
-      if (is_signed && shift < 64 && (byte & 0x40)) {
-        ret |= -(1ULL << shift);
-      }
-      return ret;
-    }
-  }
-
-  THROW("corrupt DWARF data, unterminated LEB128");
-}
-
-void SkipLEB128(string_view* data) {
-  size_t limit =
-      std::min(static_cast<size_t>(data->size()), static_cast<size_t>(10));
-  for (size_t i = 0; i < limit; i++) {
-    if (((*data)[i] & 0x80) == 0) {
-      data->remove_prefix(i + 1);
-      return;
-    }
-  }
-
-  THROW("corrupt DWARF data, unterminated LEB128");
-}
-
 absl::string_view ReadDebugStrEntry(absl::string_view section, size_t ofs) {
   SkipBytes(ofs, &section);
   return ReadNullTerminated(&section);
@@ -24,14 +24,13 @@
 namespace bloaty {
 namespace dwarf {
 
-uint64_t ReadLEB128Internal(bool is_signed, absl::string_view* data);
-
 // Reads a DWARF LEB128 varint, where high bits indicate continuation.
 template <typename T>
 T ReadLEB128(absl::string_view* data) {
   typedef typename std::conditional<std::is_signed<T>::value, int64_t,
                                     uint64_t>::type Int64Type;
-  Int64Type val = ReadLEB128Internal(std::is_signed<T>::value, data);
+  Int64Type val =
+      ReadLEB128Internal(std::is_signed<T>::value, 64, data, "DWARF");
   if (val > std::numeric_limits<T>::max() ||
       val < std::numeric_limits<T>::min()) {
     THROW("DWARF data contained larger LEB128 than we were expecting");
@@ -39,8 +38,6 @@ T ReadLEB128(absl::string_view* data) {
   return static_cast<T>(val);
 }
 
-void SkipLEB128(absl::string_view* data);
-
 bool IsValidDwarfAddress(uint64_t addr, uint8_t address_size);
 
 inline int DivRoundUp(int n, int d) {
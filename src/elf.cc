@@ -13,11 +13,15 @@
 // limitations under the License.
 
 #include <algorithm>
+#include <map>
 #include <string>
 #include <iostream>
 #include "absl/numeric/int128.h"
+#include "absl/strings/ascii.h"
 #include "absl/strings/escaping.h"
+#include "absl/strings/match.h"
 #include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
 #include "absl/strings/substitute.h"
 #include "third_party/freebsd_elf/elf.h"
 #include "bloaty.h"
@@ -574,7 +578,8 @@ bool ElfFile::FindSectionByName(absl::string_view name, Section* section) const
 // The best documentation I've been able to find for this file format is
 // Wikipedia: https://en.wikipedia.org/wiki/Ar_(Unix)
 //
-// So far we only parse the System V / GNU variant.
+// We parse the System V / GNU variant (including GNU thin archives, whose
+// members are stored in separate files) and the BSD variant.
 
 class ArFile {
  public:
@@ -582,7 +587,14 @@ class ArFile {
       : magic_(StrictSubstr(data, 0, kMagicSize)),
         contents_(data.substr(std::min<size_t>(data.size(), kMagicSize))) {}
 
-  bool IsOpen() const { return magic() == string_view(kMagic); }
+  bool IsOpen() const {
+    return magic() == string_view(kMagic) || is_thin();
+  }
+
+  // In a thin archive, each member's header gives the path of the file that
+  // holds its contents, relative to the archive.  Only the symbol table and
+  // long filename table are stored in the archive itself.
+  bool is_thin() const { return magic() == string_view(kThinMagic); }
 
   string_view magic() const { return magic_; }
   string_view contents() const { return contents_; }
@@ -593,15 +605,16 @@ class ArFile {
       kLongFilenameTable,  // Stores long filenames, users should ignore.
       kNormal,             // Regular data file.
     } file_type;
-    string_view filename;  // Only when file_type == kNormal
+    string_view filename;  // For kSymbolTable, identifies the table format.
     size_t size;
     string_view header;
-    string_view contents;
+    string_view contents;  // Empty for the kNormal members of thin archives.
   };
 
   class MemberReader {
    public:
-    MemberReader(const ArFile& ar) : remaining_(ar.contents()) {}
+    MemberReader(const ArFile& ar)
+        : remaining_(ar.contents()), is_thin_(ar.is_thin()) {}
     bool ReadMember(MemberFile* file);
     bool IsEof() const { return remaining_.size() == 0; }
 
@@ -618,13 +631,21 @@ class ArFile {
 
     string_view long_filenames_;
     string_view remaining_;
+    bool is_thin_;
   };
 
+  // Calls |func(offset, symbol)| for each entry of a kSymbolTable member,
+  // where |offset| is the offset of the defining member's header from the
+  // start of the archive.
+  template <class Func>
+  static void ForEachIndexEntry(const MemberFile& table, Func func);
+
  private:
   const string_view magic_;
   const string_view contents_;
 
   static constexpr const char* kMagic = "!<arch>\n";
+  static constexpr const char* kThinMagic = "!<thin>\n";
   static constexpr int kMagicSize = 8;
 };
 
@@ -651,19 +672,23 @@ bool ArFile::MemberReader::ReadMember(MemberFile* file) {
   string_view file_id(&header->file_id[0], sizeof(header->file_id));
   string_view size_str(&header->size[0], sizeof(header->size));
   file->size = StringViewToSize(size_str);
-  file->contents = Consume(file->size);
   file->file_type = MemberFile::kNormal;
+  file->filename = string_view();
 
   if (file_id[0] == '/') {
     // Special filename, internal to the format.
-    if (file_id[1] == ' ') {
+    if (file_id[1] == ' ' || absl::StartsWith(file_id, "/SYM64/")) {
       file->file_type = MemberFile::kSymbolTable;
+      file->filename = file_id[1] == ' ' ? "/" : "/SYM64/";
     } else if (file_id[1] == '/') {
       file->file_type = MemberFile::kLongFilenameTable;
-      long_filenames_ = file->contents;
     } else if (isdigit(file_id[1])) {
-      size_t offset = StringViewToSize(file_id.substr(1));
-      size_t end = long_filenames_.find('/', offset);
+      // In thin archives, GNU ar may follow the offset with a slash, and the
+      // names are paths, which is why we look for "/\n" to end them.
+      string_view digits = file_id.substr(1);
+      digits = digits.substr(0, digits.find('/'));
+      size_t offset = StringViewToSize(digits);
+      size_t end = long_filenames_.find("/\n", offset);
 
       if (end == std::string::npos) {
         THROW("Unterminated long filename");
@@ -673,20 +698,99 @@ bool ArFile::MemberReader::ReadMember(MemberFile* file) {
     } else {
       THROW("Unexpected special filename in AR archive");
     }
+  } else if (absl::StartsWith(file_id, "#1/")) {
+    // BSD long filename, stored at the start of the member's contents.  We
+    // count it as part of the header.
+    size_t name_size = StringViewToSize(file_id.substr(3));
+    if (name_size > file->size) {
+      THROW("BSD filename is larger than its AR member");
+    }
+    file->contents = Consume(file->size);
+    string_view name = file->contents.substr(0, name_size);
+    file->filename = name.substr(0, name.find('\0'));
+    file->header = string_view(file->header.data(), sizeof(Header) + name_size);
+    file->contents.remove_prefix(name_size);
   } else {
-    // Normal filename, slash-terminated.
+    // Normal filename: GNU terminates it with a slash and BSD pads it with
+    // spaces.
     size_t slash = file_id.find('/');
-
-    if (slash == std::string::npos) {
-      THROW("BSD-style AR not yet implemented");
+    if (slash != std::string::npos) {
+      file->filename = file_id.substr(0, slash);
+    } else {
+      file->filename = absl::StripTrailingAsciiWhitespace(file_id);
     }
+  }
 
-    file->filename = file_id.substr(0, slash);
+  if (file->file_type == MemberFile::kNormal &&
+      absl::StartsWith(file->filename, "__.SYMDEF")) {
+    // BSD symbol table, named "__.SYMDEF", "__.SYMDEF SORTED",
+    // "__.SYMDEF_64" or "__.SYMDEF_64 SORTED".
+    file->file_type = MemberFile::kSymbolTable;
+  }
+
+  if (absl::StartsWith(file_id, "#1/")) {
+    // Already consumed above.
+  } else if (is_thin_ && file->file_type == MemberFile::kNormal) {
+    file->contents = string_view();
+  } else {
+    file->contents = Consume(file->size);
+  }
+
+  if (file->file_type == MemberFile::kLongFilenameTable) {
+    long_filenames_ = file->contents;
   }
 
   return true;
 }
 
+template <class Func>
+void ArFile::ForEachIndexEntry(const MemberFile& table, Func func) {
+  string_view data = table.contents;
+
+  if (table.filename == "/" || table.filename == "/SYM64/") {
+    // GNU: a big-endian count, that many member offsets, then that many
+    // NUL-terminated names.
+    bool is_64 = table.filename == "/SYM64/";
+    uint64_t count = is_64 ? ReadBigEndian<uint64_t>(&data)
+                           : ReadBigEndian<uint32_t>(&data);
+    std::vector<uint64_t> offsets;
+    offsets.reserve(std::min<uint64_t>(count, data.size() / 4));
+    for (uint64_t i = 0; i < count; i++) {
+      offsets.push_back(is_64 ? ReadBigEndian<uint64_t>(&data)
+                              : ReadBigEndian<uint32_t>(&data));
+    }
+    for (uint64_t offset : offsets) {
+      size_t end = data.find('\0');
+      if (end == string_view::npos) {
+        THROW("unterminated name in AR symbol table");
+      }
+      func(offset, data.substr(0, end));
+      data.remove_prefix(end + 1);
+    }
+  } else {
+    // BSD: the size of an array of {name offset, member offset} pairs, the
+    // array, then the size of the string table and the table itself.  We
+    // only read the little-endian form, which is what current toolchains
+    // write.
+    bool is_64 = absl::StartsWith(table.filename, "__.SYMDEF_64");
+    auto read_word = [is_64](string_view* data) -> uint64_t {
+      return is_64 ? ReadLittleEndian<uint64_t>(data)
+                   : ReadLittleEndian<uint32_t>(data);
+    };
+    uint64_t entries_size = read_word(&data);
+    string_view entries = StrictSubstr(data, 0, entries_size);
+    data.remove_prefix(entries_size);
+    uint64_t strtab_size = read_word(&data);
+    string_view strtab = StrictSubstr(data, 0, strtab_size);
+    while (!entries.empty()) {
+      uint64_t name = read_word(&entries);
+      uint64_t offset = read_word(&entries);
+      string_view symbol = StrictSubstr(strtab, name);
+      func(offset, symbol.substr(0, symbol.find('\0')));
+    }
+  }
+}
+
 void MaybeAddFileRange(const char* analyzer, RangeSink* sink, string_view label,
                        string_view range) {
   if (sink) {
@@ -711,8 +815,18 @@ void ForEachElf(const InputFile& file, RangeSink* sink, Func func) {
       MaybeAddFileRange("ar_archive", sink, "[AR Headers]", member.header);
       switch (member.file_type) {
         case ArFile::MemberFile::kNormal: {
+          if (ar_file.is_thin()) {
+            // Scanned as a file of its own.
+            break;
+          }
           ElfFile elf(member.contents);
-          if (elf.IsOpen()) {
+          if (elf.IsOpen() && sink && sink->IsSkippedMember(member.contents)) {
+            // Still counted, so that the section indexes of the members that
+            // follow don't change.
+            MaybeAddFileRange("ar_archive", sink, "[AR Skipped Member]",
+                              member.contents);
+            index_base += elf.section_count();
+          } else if (elf.IsOpen()) {
             func(elf, member.filename, index_base);
             index_base += elf.section_count();
           } else {
@@ -845,16 +959,16 @@ static bool ReadElfArchMode(const InputFile& file, cs_arch* arch, cs_mode* mode)
   return capstone_available;
 }
 
-static void ReadELFSymbols(const InputFile& file, RangeSink* sink,
-                           SymbolTable* table, bool disassemble) {
+// Calls |func| for every defined, sized, non-section symbol in the symbol
+// tables of |file| (or of each member, if |file| is an archive).
+template <class Func>
+static void ForEachELFSymbol(const InputFile& file, RangeSink* sink,
+                             Func&& func) {
   bool is_object = IsObjectFile(file.data());
-  DisassemblyInfo info;
-  DisassemblyInfo* infop = &info;
-  bool capstone_available = ReadElfArchMode(file, &info.arch, &info.mode);
 
   ForEachElf(
       file, sink,
-      [=](const ElfFile& elf, string_view /*filename*/, uint64_t index_base) {
+      [&](const ElfFile& elf, string_view /*filename*/, uint64_t index_base) {
         for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
           ElfFile::Section section;
           elf.ReadSection(i, &section);
@@ -894,35 +1008,164 @@ static void ReadELFSymbols(const InputFile& file, RangeSink* sink,
             string_view name = strtab_section.ReadString(sym.st_name);
             uint64_t full_addr =
                 ToVMAddr(sym.st_value, index_base + sym.st_shndx, is_object);
-            if (sink && !(capstone_available && disassemble)) {
-              sink->AddVMRangeAllowAlias(
-                  "elf_symbols", full_addr, sym.st_size,
-                  ItaniumDemangle(name, sink->data_source()));
-            }
-            if (table) {
-              table->insert(
-                  std::make_pair(name, std::make_pair(full_addr, sym.st_size)));
-            }
-            if (capstone_available && disassemble &&
-                ELF64_ST_TYPE(sym.st_info) == STT_FUNC) {
-              if (verbose_level > 1) {
-                printf("Disassembling function: %s\n", name.data());
-              }
-              // TODO(brandonvu) Continue if VM pointer cannot be translated. Issue #315
-              uint64_t unused;
-              if (!sink->Translator()->vm_map.Translate(full_addr, &unused)) {
-                WARN("Can't translate VM pointer ($0) to file", full_addr);
-                continue;
-              }
-              infop->text = sink->TranslateVMToFile(full_addr).substr(0, sym.st_size);
-              infop->start_address = full_addr;
-              DisassembleFindReferences(*infop, sink);
-            }
+            func(sym, name, full_addr);
+          }
+        }
+      });
+}
+
+static void ReadELFSymbols(const InputFile& file, RangeSink* sink,
+                           SymbolSizes* sizes, bool disassemble) {
+  DisassemblyInfo info;
+  bool capstone_available = ReadElfArchMode(file, &info.arch, &info.mode);
+
+  ForEachELFSymbol(
+      file, sink,
+      [&](const Elf64_Sym& sym, string_view name, uint64_t full_addr) {
+        if (sink && !(capstone_available && disassemble)) {
+          sink->AddVMRangeAllowAlias(
+              "elf_symbols", full_addr, sym.st_size,
+              ItaniumDemangle(name, sink->data_source()));
+        }
+        if (sizes) {
+          sizes->Add(full_addr, sym.st_size);
+        }
+        if (capstone_available && disassemble &&
+            ELF64_ST_TYPE(sym.st_info) == STT_FUNC) {
+          if (verbose_level > 1) {
+            printf("Disassembling function: %s\n", name.data());
+          }
+          // TODO(brandonvu) Continue if VM pointer cannot be translated. Issue #315
+          uint64_t unused;
+          if (!sink->Translator()->vm_map.Translate(full_addr, &unused)) {
+            WARN("Can't translate VM pointer ($0) to file", full_addr);
+            return;
           }
+          info.text = sink->TranslateVMToFile(full_addr).substr(0, sym.st_size);
+          info.start_address = full_addr;
+          DisassembleFindReferences(info, sink);
         }
       });
 }
 
+// An index of the function symbols of an ELF file, built from nothing but the
+// section headers and the symbol table.  This lets us find functions to
+// disassemble without building the full segment and symbol maps.
+class ElfSymbolIndex {
+ public:
+  struct Symbol {
+    string_view name;
+    uint64_t vmaddr;
+    uint64_t size;
+    bool is_function;
+  };
+
+  // Symbols are read from |symbol_file| and function bytes from |file|.  These
+  // differ when the symbols come from a separate debug file.
+  ElfSymbolIndex(const InputFile& file, const InputFile& symbol_file) {
+    bool is_object = IsObjectFile(file.data());
+    ForEachElf(file, nullptr,
+               [&](const ElfFile& elf, string_view /*filename*/,
+                   uint64_t index_base) {
+                 for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
+                   ElfFile::Section section;
+                   elf.ReadSection(i, &section);
+                   const auto& header = section.header();
+                   if (!(header.sh_flags & SHF_ALLOC) ||
+                       header.sh_type == SHT_NOBITS) {
+                     continue;
+                   }
+                   loaded_.push_back(
+                       {ToVMAddr(header.sh_addr, index_base + i, is_object),
+                        section.contents()});
+                 }
+               });
+    std::sort(loaded_.begin(), loaded_.end(),
+              [](const LoadedRange& a, const LoadedRange& b) {
+                return a.vmaddr < b.vmaddr;
+              });
+
+    ForEachELFSymbol(
+        symbol_file, nullptr,
+        [this](const Elf64_Sym& sym, string_view name, uint64_t full_addr) {
+          symbols_.push_back({name, full_addr, sym.st_size,
+                              ELF64_ST_TYPE(sym.st_info) == STT_FUNC});
+        });
+
+    // As in the symbol maps, the first symbol with a given name wins.
+    by_name_.resize(symbols_.size());
+    for (size_t i = 0; i < symbols_.size(); i++) {
+      by_name_[i] = i;
+    }
+    std::stable_sort(by_name_.begin(), by_name_.end(),
+                     [this](size_t a, size_t b) {
+                       return symbols_[a].name < symbols_[b].name;
+                     });
+  }
+
+  // Returns the first symbol named |name|, or nullptr if there is none.
+  const Symbol* Find(string_view name) const {
+    auto it = std::lower_bound(by_name_.begin(), by_name_.end(), name,
+                               [this](size_t i, string_view name) {
+                                 return symbols_[i].name < name;
+                               });
+    if (it == by_name_.end() || symbols_[*it].name != name) {
+      return nullptr;
+    }
+    return &symbols_[*it];
+  }
+
+  // Returns all symbols, in address order.
+  std::vector<const Symbol*> SymbolsByAddress() const {
+    std::vector<const Symbol*> ret;
+    for (const auto& symbol : symbols_) {
+      ret.push_back(&symbol);
+    }
+    std::stable_sort(ret.begin(), ret.end(),
+                     [](const Symbol* a, const Symbol* b) {
+                       return a->vmaddr < b->vmaddr;
+                     });
+    return ret;
+  }
+
+  // Finds the bytes of [vmaddr, vmaddr + size) in the file.
+  bool TryGetText(uint64_t vmaddr, uint64_t size, string_view* text) const {
+    auto it = std::upper_bound(loaded_.begin(), loaded_.end(), vmaddr,
+                               [](uint64_t addr, const LoadedRange& range) {
+                                 return addr < range.vmaddr;
+                               });
+    if (it == loaded_.begin()) {
+      return false;
+    }
+    --it;
+    uint64_t offset = vmaddr - it->vmaddr;
+    if (offset > it->contents.size() ||
+        size > it->contents.size() - offset) {
+      return false;
+    }
+    *text = it->contents.substr(offset, size);
+    return true;
+  }
+
+  // Adds every symbol to |map|, so disassembly can name call targets.
+  void AddToMap(DataSource symbol_source, RangeMap* map) const {
+    for (const auto& symbol : symbols_) {
+      map->AddRange(symbol.vmaddr, symbol.size,
+                    ItaniumDemangle(symbol.name, symbol_source));
+    }
+  }
+
+ private:
+  struct LoadedRange {
+    uint64_t vmaddr;
+    string_view contents;
+  };
+
+  std::vector<LoadedRange> loaded_;
+  std::vector<Symbol> symbols_;
+  std::vector<size_t> by_name_;
+};
+
 static void ReadELFSymbolTableEntries(const ElfFile& elf,
                                       const ElfFile::Section& section,
                                       uint64_t index_base, bool is_object,
@@ -973,6 +1216,261 @@ static void ReadELFRelaEntries(const ElfFile::Section& section,
   }
 }
 
+// Dynamic relocations /////////////////////////////////////////////////////////
+
+// Section types for compact relocation formats, which older <elf.h> headers
+// don't define.
+constexpr Elf64_Word kShtRelr = 19;
+constexpr Elf64_Word kShtAndroidRel = 0x60000001;
+constexpr Elf64_Word kShtAndroidRela = 0x60000002;
+constexpr Elf64_Word kShtAndroidRelr = 0x6fffff00;
+
+// Reads one word of the file's address size and byte order.
+static uint64_t ReadElfWord(const ElfFile& elf, string_view* data) {
+  if (elf.is_64bit()) {
+    uint64_t val = ReadFixed<uint64_t>(data);
+    return elf.is_native_endian() ? val : ByteSwap(val);
+  } else {
+    uint32_t val = ReadFixed<uint32_t>(data);
+    return elf.is_native_endian() ? val : ByteSwap(val);
+  }
+}
+
+// REL and RELA entries both start with r_offset, so we only need the table's
+// stride.  In the common case (64-bit, native byte order) this is a plain
+// strided load.
+static void ReadRelOffsets(const ElfFile& elf, const ElfFile::Section& section,
+                           std::vector<uint64_t>* targets) {
+  string_view table = section.contents();
+  uint64_t entsize = section.header().sh_entsize;
+  size_t word = elf.is_64bit() ? 8 : 4;
+  if (entsize < word) {
+    THROWF("relocation section has invalid entry size $0", entsize);
+  }
+
+  size_t count = table.size() / entsize;
+  targets->reserve(targets->size() + count);
+  if (elf.is_64bit() && elf.is_native_endian()) {
+    const char* p = table.data();
+    for (size_t i = 0; i < count; i++, p += entsize) {
+      uint64_t offset;
+      memcpy(&offset, p, sizeof(offset));
+      targets->push_back(offset);
+    }
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      string_view entry = table.substr(i * entsize, word);
+      targets->push_back(ReadElfWord(elf, &entry));
+    }
+  }
+}
+
+// RELR is a list of words.  An even word is an address to relocate.  An odd
+// word is a bitmap whose bit i (for i >= 1) relocates the i-1'th word after
+// the last relocated address; each bitmap then advances by a full window.
+static void ReadRelrOffsets(const ElfFile& elf, string_view table,
+                            std::vector<uint64_t>* targets) {
+  const uint64_t word = elf.is_64bit() ? 8 : 4;
+  const uint64_t window = (word * 8 - 1) * word;
+  uint64_t base = 0;
+  while (!table.empty()) {
+    uint64_t entry = ReadElfWord(elf, &table);
+    if ((entry & 1) == 0) {
+      targets->push_back(entry);
+      base = entry + word;
+    } else {
+      // Expand the set bits directly rather than testing all of them.
+      for (uint64_t bits = entry >> 1; bits != 0; bits &= bits - 1) {
+        targets->push_back(base + CountTrailingZeros64(bits) * word);
+      }
+      base += window;
+    }
+  }
+}
+
+// Android's packed relocations ("APS2") are a stream of SLEB128 values,
+// divided into groups that may share an offset delta, r_info or addend.
+static void ReadAndroidPackedOffsets(const ElfFile& elf, string_view data,
+                                     std::vector<uint64_t>* targets) {
+  enum {
+    kGroupedByInfo = 1,
+    kGroupedByOffsetDelta = 2,
+    kGroupedByAddend = 4,
+    kGroupHasAddend = 8,
+  };
+
+  if (!absl::ConsumePrefix(&data, "APS2")) {
+    THROW("Android packed relocations don't start with APS2");
+  }
+  auto read = [&data]() {
+    return ReadLEB128Internal(true, 64, &data, "Android packed relocation");
+  };
+
+  // Each relocation writes a different word of the loaded image.  A group
+  // that shares its offset delta reads no input per relocation, so without
+  // this check a few bytes could claim billions of them.  p_memsz is no more
+  // trustworthy than the count, so the bound only counts loaded bytes that are
+  // in the file, and no more bytes than the file has.
+  const uint64_t word = elf.is_64bit() ? 8 : 4;
+  uint64_t loaded_bytes = 0;
+  for (Elf64_Xword i = 0; i < elf.header().e_phnum; i++) {
+    ElfFile::Segment segment;
+    elf.ReadSegment(i, &segment);
+    if (segment.header().p_type == PT_LOAD) {
+      loaded_bytes += segment.contents().size();
+    }
+  }
+  uint64_t max_relocs =
+      std::min<uint64_t>(loaded_bytes, elf.entire_file().size()) / word;
+
+  uint64_t remaining = read();
+  uint64_t offset = read();
+  if (remaining > max_relocs) {
+    THROWF("Android packed relocations claim $0 relocations, but the loaded "
+           "segments in the file only have room for $1",
+           remaining, max_relocs);
+  }
+  while (remaining > 0) {
+    uint64_t group_size = read();
+    uint64_t flags = read();
+    if (group_size == 0 || group_size > remaining) {
+      THROW("invalid group size in Android packed relocations");
+    }
+    uint64_t group_delta = (flags & kGroupedByOffsetDelta) ? read() : 0;
+    if (flags & kGroupedByInfo) {
+      read();
+    }
+    if ((flags & kGroupHasAddend) && (flags & kGroupedByAddend)) {
+      read();
+    }
+
+    for (uint64_t i = 0; i < group_size; i++) {
+      offset += (flags & kGroupedByOffsetDelta) ? group_delta : read();
+      if (!(flags & kGroupedByInfo)) {
+        read();
+      }
+      if ((flags & kGroupHasAddend) && !(flags & kGroupedByAddend)) {
+        read();
+      }
+      targets->push_back(offset);
+    }
+    remaining -= group_size;
+  }
+}
+
+// Collects the addresses that the dynamic loader writes to, from every
+// loadable relocation section.
+static void ReadELFDynamicRelocations(const InputFile& file,
+                                      std::vector<uint64_t>* targets) {
+  if (IsObjectFile(file.data())) {
+    return;
+  }
+
+  ForEachElf(file, nullptr,
+             [targets](const ElfFile& elf, string_view /*filename*/,
+                       uint32_t /*index_base*/) {
+               for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
+                 ElfFile::Section section;
+                 elf.ReadSection(i, &section);
+                 if (!(section.header().sh_flags & SHF_ALLOC)) {
+                   continue;
+                 }
+
+                 switch (section.header().sh_type) {
+                   case SHT_REL:
+                   case SHT_RELA:
+                     ReadRelOffsets(elf, section, targets);
+                     break;
+                   case kShtRelr:
+                   case kShtAndroidRelr:
+                     ReadRelrOffsets(elf, section.contents(), targets);
+                     break;
+                   case kShtAndroidRel:
+                   case kShtAndroidRela:
+                     ReadAndroidPackedOffsets(elf, section.contents(), targets);
+                     break;
+                 }
+               }
+             });
+}
+
+// Reference graph /////////////////////////////////////////////////////////////
+
+// Returns the RELATIVE relocation type for |e_machine|, or 0 if we don't know
+// it.
+static Elf64_Word RelativeRelocationType(Elf64_Half e_machine) {
+  switch (e_machine) {
+    case EM_386:
+    case EM_X86_64:
+      return 8;
+    case EM_ARM:
+      return 23;
+    case EM_AARCH64:
+      return 1027;
+    default:
+      return 0;
+  }
+}
+
+// Reads the RELATIVE relocations in RELA sections as (address, value) pairs.
+// In position-independent binaries these are most of the pointers in data,
+// and the file only holds zeros where they go.  REL and RELR relocations keep
+// the value in the file, so they are found by scanning the contents instead.
+static void ReadELFRelativePointers(
+    const ElfFile& elf, std::vector<std::pair<uint64_t, uint64_t>>* pointers) {
+  Elf64_Word relative = RelativeRelocationType(elf.header().e_machine);
+  if (relative == 0) {
+    return;
+  }
+
+  for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
+    ElfFile::Section section;
+    elf.ReadSection(i, &section);
+    if (section.header().sh_type != SHT_RELA ||
+        !(section.header().sh_flags & SHF_ALLOC)) {
+      continue;
+    }
+
+    Elf64_Word count = section.GetEntryCount();
+    for (Elf64_Word j = 0; j < count; j++) {
+      Elf64_Rela rela;
+      section.ReadRelocationWithAddend(j, &rela, nullptr);
+      Elf64_Word type = elf.is_64bit() ? ELF64_R_TYPE(rela.r_info)
+                                       : ELF32_R_TYPE(rela.r_info);
+      if (type == relative) {
+        pointers->push_back({rela.r_offset, rela.r_addend});
+      }
+    }
+  }
+}
+
+// Appends the addresses that can be reached from outside the binary: the
+// entry point and the defined dynamic symbols.
+static void ReadELFRootAddresses(const ElfFile& elf,
+                                 std::vector<uint64_t>* addrs) {
+  if (elf.header().e_entry != 0) {
+    addrs->push_back(elf.header().e_entry);
+  }
+
+  for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
+    ElfFile::Section section;
+    elf.ReadSection(i, &section);
+    if (section.header().sh_type != SHT_DYNSYM) {
+      continue;
+    }
+
+    Elf64_Word count = section.GetEntryCount();
+    for (Elf64_Word j = 1; j < count; j++) {
+      Elf64_Sym sym;
+      section.ReadSymbol(j, &sym, nullptr);
+      if (sym.st_shndx != STN_UNDEF &&
+          ELF64_ST_TYPE(sym.st_info) != STT_SECTION) {
+        addrs->push_back(sym.st_value);
+      }
+    }
+  }
+}
+
 // Adds file ranges for the symbol tables and string tables *themselves* (ie.
 // the space that the symtab/strtab take up in the file).  This will cover
 //   .symtab
@@ -1241,6 +1739,57 @@ void ReadDWARFSections(const InputFile &file, dwarf::File *dwarf,
   }
 }
 
+// Adds the uncompressed size of every compressed section to the file size,
+// since ReadDWARFSections() decompresses those sections into memory.  This is
+// only an estimate for --max-memory, so it skips headers it can't read instead
+// of failing; the scan itself reports a malformed file.
+static uint64_t EstimateELFScanMemory(const InputFile& file) {
+  // zlib can't expand its input more than this, so a larger claimed size is
+  // clamped to what the compressed bytes could hold.
+  static constexpr uint64_t kMaxZlibRatio = 1032;
+  uint64_t ret = file.data().size();
+  auto add = [&ret](string_view compressed, uint64_t uncompressed_size) {
+    ret += std::min<uint64_t>(uncompressed_size,
+                              compressed.size() * kMaxZlibRatio);
+  };
+
+  try {
+    ForEachElf(
+        file, nullptr,
+        [&add](const ElfFile& elf, string_view /*filename*/,
+               uint32_t /*index_base*/) {
+          for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
+            ElfFile::Section section;
+            elf.ReadSection(i, &section);
+            string_view contents = section.contents();
+            if (section.header().sh_flags & SHF_COMPRESSED) {
+              size_t chdr_size =
+                  elf.is_64bit() ? sizeof(Elf64_Chdr) : sizeof(Elf32_Chdr);
+              if (contents.size() < chdr_size) {
+                continue;
+              }
+              Elf64_Chdr chdr;
+              absl::string_view range;
+              elf.ReadStruct<Elf32_Chdr>(contents, 0, ChdrMunger(), &range,
+                                         &chdr);
+              if (chdr.ch_type == ELFCOMPRESS_ZLIB) {
+                contents.remove_prefix(range.size());
+                add(contents, chdr.ch_size);
+              }
+            } else if (absl::StartsWith(section.GetName(), ".zdebug_") &&
+                       absl::ConsumePrefix(&contents, "ZLIB") &&
+                       contents.size() >= 8) {
+              uint64_t size = ReadBigEndian<uint64_t>(&contents);
+              add(contents, size);
+            }
+          }
+        });
+  } catch (const bloaty::Error&) {
+    // Keep what was counted before the error.
+  }
+  return ret;
+}
+
 void AddCatchAll(RangeSink* sink) {
   // The last-line fallback to make sure we cover the entire VM space.
   if (sink->IsBaseMap() || sink->data_source() != DataSource::kSegments) {
@@ -1296,7 +1845,75 @@ class ElfObjectFile : public ObjectFile {
     return std::string();
   }
 
+  void ReadDynamicRelocations(std::vector<uint64_t>* targets) const override {
+    ReadELFDynamicRelocations(file_data(), targets);
+  }
+
+  uint64_t EstimateScanMemory() const override {
+    return EstimateELFScanMemory(file_data());
+  }
+
+  bool ReadArchiveIndex(bool read_symbol_table,
+                        ArchiveIndex* index) const override {
+    ArFile ar_file(file_data().data());
+    if (!ar_file.IsOpen()) {
+      return false;
+    }
+
+    ArFile::MemberFile member;
+    ArFile::MemberReader reader(ar_file);
+    ArFile::MemberFile table;
+    std::map<uint64_t, size_t> members_by_offset;
+    while (reader.ReadMember(&member)) {
+      if (member.file_type == ArFile::MemberFile::kSymbolTable) {
+        table = member;
+        index->has_symbol_table = read_symbol_table;
+      } else if (member.file_type == ArFile::MemberFile::kNormal) {
+        members_by_offset[member.header.data() - file_data().data().data()] =
+            index->members.size();
+        index->members.emplace_back();
+        ArchiveIndex::Member* out = &index->members.back();
+        out->contents = member.contents;
+        if (ar_file.is_thin()) {
+          out->path = std::string(member.filename);
+        }
+      }
+    }
+
+    if (index->has_symbol_table) {
+      auto add_symbol = [index, &members_by_offset](uint64_t offset,
+                                                    string_view symbol) {
+        auto it = members_by_offset.find(offset);
+        if (it == members_by_offset.end()) {
+          THROW("AR symbol table refers to a member that doesn't exist");
+        }
+        index->members[it->second].symbols.emplace_back(symbol);
+      };
+      try {
+        ArFile::ForEachIndexEntry(table, add_symbol);
+      } catch (const bloaty::Error&) {
+        // The symbol table is only used to skip members, so one that doesn't
+        // match the members just means that none are skipped.
+        index->has_symbol_table = false;
+        for (auto& member : index->members) {
+          member.symbols.clear();
+        }
+      }
+    }
+
+    return true;
+  }
+
+  bool IsThinArchive() const override {
+    ArFile ar_file(file_data().data());
+    return ar_file.IsOpen() && ar_file.is_thin();
+  }
+
   void ProcessFile(const std::vector<RangeSink*>& sinks) const override {
+    // Collected by whichever of symbols and compileunits runs first.
+    SymbolSizes symbol_sizes;
+    bool need_sizes = SymbolSizes::NeededBy(sinks);
+
     for (auto sink : sinks) {
       if (verbose_level > 1) {
         printf("Scanning source %d\n", (int)sink->data_source());
@@ -1310,27 +1927,26 @@ class ElfObjectFile : public ObjectFile {
           break;
         case DataSource::kRawSymbols:
         case DataSource::kShortSymbols:
+        case DataSource::kTemplates:
         case DataSource::kFullSymbols:
-          ReadELFSymbols(debug_file().file_data(), sink, nullptr, false);
+          ReadELFSymbols(debug_file().file_data(), sink,
+                         need_sizes && symbol_sizes.empty() ? &symbol_sizes
+                                                            : nullptr,
+                         false);
           break;
         case DataSource::kArchiveMembers:
           DoReadELFSections(sink, kReportByArchiveMember);
           break;
         case DataSource::kCompileUnits: {
           CheckNotObject("compileunits", sink);
-          SymbolTable symtab;
-          DualMap symbol_map;
-          NameMunger empty_munger;
-          RangeSink symbol_sink(&debug_file().file_data(),
-                                sink->options(),
-                                DataSource::kRawSymbols,
-                                &sinks[0]->MapAtIndex(0), nullptr);
-          symbol_sink.AddOutput(&symbol_map, &empty_munger);
-          ReadELFSymbols(debug_file().file_data(), &symbol_sink, &symtab,
-                         false);
+          if (symbol_sizes.empty()) {
+            ReadELFSymbols(debug_file().file_data(), nullptr, &symbol_sizes,
+                           false);
+          }
+          symbol_sizes.Sort();
           dwarf::File dwarf;
           ReadDWARFSections(debug_file().file_data(), &dwarf, sink);
-          ReadDWARFCompileUnits(dwarf, symbol_map, sink);
+          ReadDWARFCompileUnits(dwarf, symbol_sizes, sink);
           break;
         }
         case DataSource::kInlines: {
@@ -1369,49 +1985,107 @@ class ElfObjectFile : public ObjectFile {
   bool DoGetDisassemblyInfo(const absl::string_view* symbol,
                             DataSource symbol_source,
                             DisassemblyInfo* info) const {
-    // Find the corresponding file range.  This also could be optimized not to
-    // build the entire map.
-    DualMap base_map;
-    NameMunger empty_munger;
-    RangeSink base_sink(&file_data(), bloaty::Options(), DataSource::kSegments,
-                        nullptr, nullptr);
-    base_sink.AddOutput(&base_map, &empty_munger);
-    std::vector<RangeSink*> sink_ptrs{&base_sink};
-    ProcessFile(sink_ptrs);
-
-    // Could optimize this not to build the whole table if necessary.
-    SymbolTable symbol_table;
-    RangeSink symbol_sink(&file_data(), bloaty::Options(), symbol_source,
-                          &base_map, nullptr);
-    symbol_sink.AddOutput(&info->symbol_map, &empty_munger);
-    ReadELFSymbols(debug_file().file_data(), &symbol_sink, &symbol_table,
-                   false);
+    ElfSymbolIndex index(file_data(), debug_file().file_data());
+    index.AddToMap(symbol_source, &info->symbol_map.vm_map);
 
     if (symbol) {
-      auto entry = symbol_table.find(*symbol);
-      if (entry == symbol_table.end()) {
-        entry = symbol_table.find(ItaniumDemangle(*symbol, symbol_source));
-        if (entry == symbol_table.end()) {
+      auto entry = index.Find(*symbol);
+      if (!entry) {
+        entry = index.Find(ItaniumDemangle(*symbol, symbol_source));
+        if (!entry) {
           return false;
         }
       }
-      uint64_t vmaddr = entry->second.first;
-      uint64_t size = entry->second.second;
 
       // TODO(haberman); Add PLT entries to symbol map, so call <plt stub> gets
       // symbolized.
 
-      uint64_t fileoff;
-      if (!base_map.vm_map.Translate(vmaddr, &fileoff)) {
-        THROWF("Couldn't translate VM address for function $0", symbol);
+      if (!index.TryGetText(entry->vmaddr, entry->size, &info->text)) {
+        THROWF("Couldn't translate VM address for function $0", *symbol);
       }
-
-      info->text = StrictSubstr(file_data().data(), fileoff, size);
-      info->start_address = vmaddr;
+      info->start_address = entry->vmaddr;
     }
 
     return ReadElfArchMode(file_data(), &info->arch, &info->mode);
   }
+
+  bool GetReferenceGraphInput(DataSource symbol_source,
+                              ReferenceGraphInput* input) const override {
+    ElfFile elf(file_data().data());
+    if (!elf.IsOpen() || IsObjectFile(file_data().data())) {
+      // Object files are relocated later, so their references aren't known
+      // yet.
+      return false;
+    }
+
+    input->can_disassemble =
+        ReadElfArchMode(file_data(), &input->arch, &input->mode);
+    input->pointer_size = elf.is_64bit() ? 8 : 4;
+    Endian other =
+        GetMachineEndian() == Endian::kLittle ? Endian::kBig : Endian::kLittle;
+    input->endian = elf.is_native_endian() ? GetMachineEndian() : other;
+    ReadELFRelativePointers(elf, &input->pointers);
+
+    std::vector<uint64_t> roots;
+    ReadELFRootAddresses(elf, &roots);
+    std::sort(roots.begin(), roots.end());
+
+    ElfSymbolIndex index(file_data(), debug_file().file_data());
+    for (auto symbol : index.SymbolsByAddress()) {
+      // Aliases share an address; the first one names it, as in the symbol
+      // maps.
+      if (!input->symbols.empty() &&
+          input->symbols.back().vmaddr == symbol->vmaddr) {
+        continue;
+      }
+      ReferenceGraphInput::Symbol out;
+      out.name = ItaniumDemangle(symbol->name, symbol_source);
+      out.vmaddr = symbol->vmaddr;
+      out.size = symbol->size;
+      if (!index.TryGetText(symbol->vmaddr, symbol->size, &out.contents)) {
+        out.contents = string_view();
+      }
+      out.is_function = symbol->is_function;
+      auto it = std::lower_bound(roots.begin(), roots.end(), symbol->vmaddr);
+      out.is_root = it != roots.end() && *it - symbol->vmaddr < symbol->size;
+      input->symbols.push_back(std::move(out));
+    }
+
+    return true;
+  }
+
+  bool GetDisassemblyBatch(const ReImpl& regex, DataSource symbol_source,
+                           DisassemblyBatch* batch) const override {
+    if (!ReadElfArchMode(file_data(), &batch->arch, &batch->mode)) {
+      return false;
+    }
+
+    ElfSymbolIndex index(file_data(), debug_file().file_data());
+    index.AddToMap(symbol_source, &batch->symbol_map.vm_map);
+
+    for (auto symbol : index.SymbolsByAddress()) {
+      // Aliases share an address; disassemble each function only once.
+      if (!symbol->is_function ||
+          (!batch->functions.empty() &&
+           batch->functions.back().start_address == symbol->vmaddr)) {
+        continue;
+      }
+
+      std::string name = ItaniumDemangle(symbol->name, symbol_source);
+      if (!ReImpl::PartialMatch(name, regex)) {
+        continue;
+      }
+
+      string_view text;
+      if (!index.TryGetText(symbol->vmaddr, symbol->size, &text)) {
+        WARN("Can't translate VM address for function $0", name);
+        continue;
+      }
+      batch->functions.push_back({std::move(name), text, symbol->vmaddr});
+    }
+
+    return true;
+  }
 };
 
 }  // namespace
@@ -400,7 +400,7 @@ void ParseLoadCommands(RangeSink* sink) {
 }
 
 template <class NList>
-void ParseSymbolsFromSymbolTable(const LoadCommand& cmd, SymbolTable* table,
+void ParseSymbolsFromSymbolTable(const LoadCommand& cmd, SymbolSizes* sizes,
                                  RangeSink* sink) {
   auto symtab_cmd = GetStructPointer<symtab_command>(cmd.command_data);
 
@@ -421,16 +421,19 @@ void ParseSymbolsFromSymbolTable(const LoadCommand& cmd, SymbolTable* table,
     string_view name_region = StrictSubstr(strtab, sym->n_un.n_strx);
     string_view name = ReadNullTerminated(&name_region);
 
+    if (sizes) {
+      sizes->Add(sym->n_value, RangeSink::kUnknownSize);
+    }
+
+    if (!sink) {
+      continue;
+    }
+
     if (sink->data_source() >= DataSource::kSymbols) {
       sink->AddVMRange("macho_symbols", sym->n_value, RangeSink::kUnknownSize,
                        ItaniumDemangle(name, sink->data_source()));
     }
 
-    if (table) {
-      table->insert(std::make_pair(
-          name, std::make_pair(sym->n_value, RangeSink::kUnknownSize)));
-    }
-
     // Capture the trailing NULL.
     name = string_view(name.data(), name.size() + 1);
     sink->AddFileRangeForVMAddr("macho_symtab_name", sym->n_value, name);
@@ -438,16 +441,16 @@ void ParseSymbolsFromSymbolTable(const LoadCommand& cmd, SymbolTable* table,
   }
 }
 
-void ParseSymbols(string_view file_data, SymbolTable* symtab, RangeSink* sink) {
+void ParseSymbols(string_view file_data, SymbolSizes* sizes, RangeSink* sink) {
   ForEachLoadCommand(
       file_data, sink,
-      [symtab, sink](const LoadCommand& cmd) {
+      [sizes, sink](const LoadCommand& cmd) {
         switch (cmd.cmd) {
           case LC_SYMTAB:
             if (cmd.is64bit) {
-              ParseSymbolsFromSymbolTable<nlist_64>(cmd, symtab, sink);
+              ParseSymbolsFromSymbolTable<nlist_64>(cmd, sizes, sink);
             } else {
-              ParseSymbolsFromSymbolTable<struct nlist>(cmd, symtab, sink);
+              ParseSymbolsFromSymbolTable<struct nlist>(cmd, sizes, sink);
             }
             break;
           case LC_DYSYMTAB:
@@ -563,6 +566,10 @@ class MachOObjectFile : public ObjectFile {
   }
 
   void ProcessFile(const std::vector<RangeSink*>& sinks) const override {
+    // Collected by whichever of symbols and compileunits runs first.
+    SymbolSizes symbol_sizes;
+    bool need_sizes = SymbolSizes::NeededBy(sinks);
+
     for (auto sink : sinks) {
       switch (sink->data_source()) {
         case DataSource::kSegments:
@@ -572,21 +579,22 @@ class MachOObjectFile : public ObjectFile {
         case DataSource::kSymbols:
         case DataSource::kRawSymbols:
         case DataSource::kShortSymbols:
+        case DataSource::kTemplates:
         case DataSource::kFullSymbols:
-          ParseSymbols(debug_file().file_data().data(), nullptr, sink);
+          ParseSymbols(debug_file().file_data().data(),
+                       need_sizes && symbol_sizes.empty() ? &symbol_sizes
+                                                          : nullptr,
+                       sink);
           break;
         case DataSource::kCompileUnits: {
-          SymbolTable symtab;
-          DualMap symbol_map;
-          NameMunger empty_munger;
-          RangeSink symbol_sink(&debug_file().file_data(), sink->options(),
-                                DataSource::kRawSymbols,
-                                &sinks[0]->MapAtIndex(0), nullptr);
-          symbol_sink.AddOutput(&symbol_map, &empty_munger);
-          ParseSymbols(debug_file().file_data().data(), &symtab, &symbol_sink);
+          if (symbol_sizes.empty()) {
+            ParseSymbols(debug_file().file_data().data(), &symbol_sizes,
+                         nullptr);
+          }
+          symbol_sizes.Sort();
           dwarf::File dwarf;
           ReadDebugSectionsFromMachO(debug_file().file_data(), &dwarf, sink);
-          ReadDWARFCompileUnits(dwarf, symbol_map, sink);
+          ReadDWARFCompileUnits(dwarf, symbol_sizes, sink);
           ParseSymbols(sink->input_file().data(), nullptr, sink);
           break;
         }
@@ -605,6 +613,13 @@ class MachOObjectFile : public ObjectFile {
     WARN("Mach-O files do not support disassembly yet");
     return false;
   }
+
+  bool GetDisassemblyBatch(const ReImpl& /*regex*/,
+                           DataSource /*symbol_source*/,
+                           DisassemblyBatch* /*batch*/) const override {
+    WARN("Mach-O files do not support disassembly yet");
+    return false;
+  }
 };
 
 }  // namespace macho
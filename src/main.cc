@@ -40,7 +40,7 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  if (!options.dump_raw_map()) {
+  if (!options.dump_raw_map() && !options.has_write_partial()) {
     output.Print(output_options, &std::cout);
   }
   return 0;
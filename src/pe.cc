@@ -237,6 +237,7 @@ class PEObjectFile : public ObjectFile {
         case DataSource::kSymbols:
         case DataSource::kRawSymbols:
         case DataSource::kShortSymbols:
+        case DataSource::kTemplates:
         case DataSource::kFullSymbols:
           // TODO(mj): Generate symbols from debug info, exports, imports, tls
           // data, relocations, resources ...
@@ -256,6 +257,13 @@ class PEObjectFile : public ObjectFile {
     return false;
   }
 
+  bool GetDisassemblyBatch(const ReImpl& /*regex*/,
+                           DataSource /*symbol_source*/,
+                           DisassemblyBatch* /*batch*/) const override {
+    WARN("PE files do not support disassembly yet");
+    return false;
+  }
+
  protected:
   std::unique_ptr<pe::PeFile> pe_file;
 };
@@ -14,10 +14,133 @@
 
 #include "range_map.h"
 
+#include <atomic>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
 #include "bloaty.h"
 
 namespace bloaty {
 
+// LabelPool ///////////////////////////////////////////////////////////////////
+
+namespace {
+
+// The labels of a shard are stored in chunks that are never moved, so that
+// they can be read without taking the lock.  Chunk k holds
+// kFirstChunkSize << k labels, so a couple dozen chunks cover every index
+// that fits in an id.
+constexpr uint32_t kFirstChunkBits = 5;
+constexpr uint32_t kFirstChunkSize = 1 << kFirstChunkBits;
+
+std::string_view ToStd(absl::string_view str) {
+  return std::string_view(str.data(), str.size());
+}
+
+// Returns the chunk and the offset within it of the label at |index|.
+void ChunkOf(uint32_t index, uint32_t* chunk, uint32_t* offset) {
+  uint64_t biased = uint64_t{index} + kFirstChunkSize;
+  uint32_t bit = 0;
+  while (biased >> (bit + 1)) {
+    bit++;
+  }
+  *chunk = bit - kFirstChunkBits;
+  *offset = biased - (uint64_t{1} << bit);
+}
+
+}  // namespace
+
+constexpr int LabelPool::kShardBits;
+constexpr uint32_t LabelPool::kShardCount;
+
+struct LabelPool::Shard {
+  static constexpr int kMaxChunks = 32 - kShardBits - kFirstChunkBits + 1;
+
+  Shard() {
+    for (auto& chunk : chunks) {
+      chunk.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~Shard() {
+    for (auto& chunk : chunks) {
+      delete[] chunk.load(std::memory_order_relaxed);
+    }
+  }
+
+  // Guards |ids| and the writing of new labels.
+  mutable std::mutex mutex;
+
+  // The keys point into |chunks|.
+  std::unordered_map<std::string_view, uint32_t> ids;
+  std::atomic<std::string*> chunks[kMaxChunks];
+};
+
+LabelPool::LabelPool() : shards_(new Shard[kShardCount]) {}
+
+LabelPool::~LabelPool() {}
+
+uint32_t LabelPool::Intern(absl::string_view label) {
+  std::string_view key = ToStd(label);
+  uint32_t shard_index = std::hash<std::string_view>()(key) % kShardCount;
+  Shard& shard = shards_[shard_index];
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.ids.find(key);
+  if (it != shard.ids.end()) {
+    return it->second;
+  }
+
+  uint32_t index = shard.ids.size();
+  if (index > (UINT32_MAX >> kShardBits)) {
+    THROW("too many distinct labels");
+  }
+  uint32_t chunk, offset;
+  ChunkOf(index, &chunk, &offset);
+  std::string* labels = shard.chunks[chunk].load(std::memory_order_relaxed);
+  if (!labels) {
+    labels = new std::string[kFirstChunkSize << chunk];
+    shard.chunks[chunk].store(labels, std::memory_order_release);
+  }
+  labels[offset].assign(label.data(), label.size());
+
+  uint32_t id = (index << kShardBits) | shard_index;
+  shard.ids.emplace(labels[offset], id);
+  return id;
+}
+
+bool LabelPool::Find(absl::string_view label, uint32_t* id) const {
+  std::string_view key = ToStd(label);
+  const Shard& shard =
+      shards_[std::hash<std::string_view>()(key) % kShardCount];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.ids.find(key);
+  if (it == shard.ids.end()) {
+    return false;
+  }
+  *id = it->second;
+  return true;
+}
+
+const std::string& LabelPool::Get(uint32_t id) const {
+  uint32_t chunk, offset;
+  ChunkOf(id >> kShardBits, &chunk, &offset);
+  const Shard& shard = shards_[id & (kShardCount - 1)];
+  return shard.chunks[chunk].load(std::memory_order_acquire)[offset];
+}
+
+size_t LabelPool::size() const {
+  size_t ret = 0;
+  for (uint32_t i = 0; i < kShardCount; i++) {
+    std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    ret += shards_[i].ids.size();
+  }
+  return ret;
+}
+
+// RangeMap ////////////////////////////////////////////////////////////////////
+
 constexpr uint64_t RangeMap::kUnknownSize;
 
 template <class T>
@@ -99,7 +222,7 @@ bool RangeMap::TryGetLabel(uint64_t addr, std::string* label) const {
   if (iter == mappings_.end()) {
     return false;
   } else {
-    *label = iter->second.label;
+    *label = Label(iter->second);
     return true;
   }
 }
@@ -114,9 +237,10 @@ bool RangeMap::TryGetLabelForRange(uint64_t addr, uint64_t size,
   if (iter == mappings_.end()) {
     return false;
   } else {
-    *label = iter->second.label;
+    uint32_t first_label = iter->second.label;
+    *label = Label(iter->second);
     while (iter != mappings_.end() && iter->first + iter->second.size < end) {
-      if (iter->second.label != *label) {
+      if (iter->second.label != first_label) {
         return false;
       }
       ++iter;
@@ -178,6 +302,49 @@ void RangeMap::MaybeSetLabel(T iter, const std::string& label, uint64_t addr,
   }
 }
 
+bool RangeMap::TryExtendPrevious(Map::iterator next, uint64_t addr,
+                                 uint64_t size, uint64_t other,
+                                 uint32_t label) {
+  if (next == mappings_.begin()) {
+    return false;
+  }
+  Entry& prev = std::prev(next)->second;
+  uint64_t prev_start = std::prev(next)->first;
+  // Fallback labels are left for Compress(), whose padding heuristic depends
+  // on seeing the short fallback ranges individually.
+  if (prev.size == kUnknownSize || prev_start + prev.size != addr ||
+      prev.label != label || prev.HasFallbackLabel()) {
+    return false;
+  }
+  // The translation must continue seamlessly, otherwise we would lose the
+  // ability to translate the second half.
+  if (prev.HasTranslation() != (other != kNoTranslation) ||
+      (prev.HasTranslation() && prev.other_start + prev.size != other)) {
+    return false;
+  }
+  prev.size += size;
+  return true;
+}
+
+bool RangeMap::TryMergeWithNext(Map::iterator iter) {
+  auto next = std::next(iter);
+  if (IterIsEnd(next) || next->second.size == kUnknownSize ||
+      iter->first + iter->second.size != next->first ||
+      iter->second.label != next->second.label ||
+      iter->second.HasFallbackLabel()) {
+    return false;
+  }
+  if (iter->second.HasTranslation() != next->second.HasTranslation() ||
+      (iter->second.HasTranslation() &&
+       iter->second.other_start + iter->second.size !=
+           next->second.other_start)) {
+    return false;
+  }
+  iter->second.size += next->second.size;
+  mappings_.erase(next);
+  return true;
+}
+
 void RangeMap::AddDualRange(uint64_t addr, uint64_t size, uint64_t otheraddr,
                             const std::string& label) {
   if (verbose_level > 2) {
@@ -195,7 +362,8 @@ void RangeMap::AddDualRange(uint64_t addr, uint64_t size, uint64_t otheraddr,
       MaybeSetLabel(it, label, addr, kUnknownSize);
     } else {
       auto iter = mappings_.emplace_hint(
-          it, std::make_pair(addr, Entry(label, kUnknownSize, kNoTranslation)));
+          it, std::make_pair(addr, MakeEntry(label, kUnknownSize,
+                                             kNoTranslation)));
       if (verbose_level > 2) {
         printf("  added entry: %s\n", EntryDebugString(iter).c_str());
       }
@@ -207,6 +375,10 @@ void RangeMap::AddDualRange(uint64_t addr, uint64_t size, uint64_t otheraddr,
   uint64_t end = addr + size;
   assert(end >= addr);
 
+  // Only interned once we know that the range adds at least one entry.
+  bool interned = false;
+  Entry labeled(0, false, 0, kNoTranslation);
+
   while (1) {
     // Advance past existing entries that intersect this range until we find a
     // gap.
@@ -232,10 +404,30 @@ void RangeMap::AddDualRange(uint64_t addr, uint64_t size, uint64_t otheraddr,
     uint64_t other = (otheraddr == kNoTranslation) ? kNoTranslation
                                                    : addr - base + otheraddr;
     assert(this_end >= addr);
-    auto iter = mappings_.emplace_hint(
-        it, std::make_pair(addr, Entry(label, this_end - addr, other)));
-    if (verbose_level > 2) {
-      printf("  added entry: %s\n", EntryDebugString(iter).c_str());
+    if (!interned) {
+      labeled = MakeEntry(label, 0, kNoTranslation);
+      interned = true;
+    }
+    Map::iterator iter;
+    if (TryExtendPrevious(it, addr, this_end - addr, other, labeled.label)) {
+      iter = std::prev(it);
+      if (verbose_level > 2) {
+        printf("  extended entry: %s\n", EntryDebugString(iter).c_str());
+      }
+    } else {
+      iter = mappings_.emplace_hint(
+          it, std::make_pair(addr, Entry(labeled.label, labeled.fallback,
+                                         this_end - addr, other)));
+      if (verbose_level > 2) {
+        printf("  added entry: %s\n", EntryDebugString(iter).c_str());
+      }
+    }
+    if (TryMergeWithNext(iter)) {
+      // |it| was absorbed; continue scanning from the merged entry.
+      it = iter;
+      if (verbose_level > 2) {
+        printf("  merged entry: %s\n", EntryDebugString(iter).c_str());
+      }
     }
     CheckConsistency(iter);
     addr = this_end;
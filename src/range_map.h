@@ -34,18 +34,68 @@
 
 #include <exception>
 #include <map>
+#include <memory>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 
 namespace bloaty {
 
 class RangeMapTest;
 
+// Holds one copy of each distinct label, and numbers them with 32-bit ids.
+// Demangled C++ names can be several KB long, and the same label is
+// typically added to many ranges: to both the VM and the file map, once per
+// piece when a range is split, and in a multi-file run, once per file.
+// Entries and rollups store the id instead of their own copy.
+//
+// One pool is shared by all the threads of a run, so it is split into
+// shards, each with its own lock.  Looking up the label of an id takes no
+// lock at all, since labels are never moved once they are added.
+class LabelPool {
+ public:
+  LabelPool();
+  ~LabelPool();
+  LabelPool(const LabelPool&) = delete;
+  LabelPool& operator=(const LabelPool&) = delete;
+
+  // Returns the id of |label|, adding it to the pool if it is new.  Can be
+  // called from several threads at once.
+  uint32_t Intern(absl::string_view label);
+
+  // If |label| is in the pool, sets |id| to its id and returns true.
+  bool Find(absl::string_view label, uint32_t* id) const;
+
+  // Returns the label for an id that was returned by Intern().  The
+  // reference stays valid for the lifetime of the pool.
+  const std::string& Get(uint32_t id) const;
+
+  size_t size() const;
+
+ private:
+  struct Shard;
+
+  // The low bits of an id are its shard, and the rest are its index within
+  // the shard.
+  static constexpr int kShardBits = 6;
+  static constexpr uint32_t kShardCount = 1 << kShardBits;
+
+  std::unique_ptr<Shard[]> shards_;
+};
+
 class RangeMap {
  public:
+  // Creates a map with its own label pool.
   RangeMap() = default;
+
+  // Creates a map whose labels are stored in |labels|, which may be shared
+  // with the other maps of the same file.
+  explicit RangeMap(std::shared_ptr<LabelPool> labels)
+      : labels_(std::move(labels)) {}
+
   RangeMap(RangeMap&& other) = default;
   RangeMap& operator=(RangeMap&& other) = default;
   RangeMap(RangeMap& other) = delete;
@@ -80,8 +130,8 @@ class RangeMap {
   // (in normal Bloaty output it makes no difference, because all labels with
   // the same name are added together).
   //
-  // TODO(haberman): see if we can do this at insertion time instead, so it
-  // doesn't require a second pass.
+  // Exact label matches are already merged at insertion time, so this is
+  // mainly needed to fold short padding ranges into their predecessor.
   void Compress();
 
   // Returns whether this RangeMap fully covers the given range.
@@ -126,14 +176,26 @@ class RangeMap {
       return "[end]";
     } else {
       return EntryDebugString(it->first, it->second.size,
-                              it->second.other_start, it->second.label);
+                              it->second.other_start, Label(it->second));
     }
   }
 
+  // Calls |func| with the labels of each map for every range of addresses,
+  // see below.
   template <class Func>
   static void ComputeRollup(const std::vector<const RangeMap*>& range_maps,
                             Func func);
 
+  // Like ComputeRollup(), but |func| gets the label ids instead, which come
+  // from each map's LabelPool.  When the maps share a pool, ids can be
+  // compared and stored without ever looking at the strings.
+  template <class Func>
+  static void ComputeLabelIdRollup(
+      const std::vector<const RangeMap*>& range_maps, Func func);
+
+  // The pool that this map's label ids refer to, if it has any labels.
+  const std::shared_ptr<LabelPool>& labels() const { return labels_; }
+
   template <class Func>
   void ForEachRange(Func func) const {
     for (auto iter = mappings_.begin(); iter != mappings_.end(); ++iter) {
@@ -144,7 +206,7 @@ class RangeMap {
   template <class Func>
   void ForEachRangeWithStart(uint64_t start, Func func) const {
     for (auto iter = FindContaining(start); iter != mappings_.end(); ++iter) {
-      if (!func(iter->second.label, iter->first,
+      if (!func(Label(iter->second), iter->first,
                 RangeEnd(iter) - iter->first)) {
         return;
       }
@@ -158,14 +220,15 @@ class RangeMap {
   static const uint64_t kNoTranslation = UINT64_MAX;
 
   struct Entry {
-    Entry(const std::string& label_, uint64_t size_, uint64_t other_)
-        : label(label_), size(size_), other_start(other_) {}
-    std::string label;
+    Entry(uint32_t label_, bool fallback_, uint64_t size_, uint64_t other_)
+        : label(label_), fallback(fallback_), size(size_), other_start(other_) {}
+    uint32_t label;  // Id in the map's LabelPool.
+    bool fallback;   // Whether the label starts with '['.
     uint64_t size;
     uint64_t other_start;  // kNoTranslation if there is no mapping.
 
     bool HasTranslation() const { return other_start != kNoTranslation; }
-    bool HasFallbackLabel() const { return !label.empty() && label[0] == '['; }
+    bool HasFallbackLabel() const { return fallback; }
 
     // We assume that short regions that were unattributed (have fallback
     // labels) are actually padding. We could probably make this heuristic
@@ -176,6 +239,26 @@ class RangeMap {
   typedef std::map<uint64_t, Entry> Map;
   Map mappings_;
 
+  // Created on first use if the map wasn't given one.  Within one map, equal
+  // labels always have the same id.
+  std::shared_ptr<LabelPool> labels_;
+
+  uint32_t Intern(const std::string& label) {
+    if (!labels_) {
+      labels_ = std::make_shared<LabelPool>();
+    }
+    return labels_->Intern(label);
+  }
+
+  Entry MakeEntry(const std::string& label, uint64_t size, uint64_t other) {
+    return Entry(Intern(label), !label.empty() && label[0] == '[', size,
+                 other);
+  }
+
+  const std::string& Label(const Entry& entry) const {
+    return labels_->Get(entry.label);
+  }
+
   template <class T>
   void CheckConsistency(T iter) const {
     assert(iter->first + iter->second.size > iter->first);
@@ -203,6 +286,16 @@ class RangeMap {
   void MaybeSetLabel(T iter, const std::string& label, uint64_t addr,
                      uint64_t end);
 
+  // If the entry before |next| ends exactly at |addr|, has the same label, and
+  // has a compatible translation, grows it to cover [addr, addr + size) and
+  // returns true.  Otherwise returns false and leaves the map unchanged.
+  bool TryExtendPrevious(Map::iterator next, uint64_t addr, uint64_t size,
+                         uint64_t other, uint32_t label);
+
+  // Like TryExtendPrevious(), but absorbs the entry after |iter| into |iter|.
+  // The absorbed entry is erased.
+  bool TryMergeWithNext(Map::iterator iter);
+
   // When the size is unknown return |unknown| for the end.
   uint64_t RangeEndUnknownLimit(Map::const_iterator iter,
                                 uint64_t unknown) const {
@@ -250,6 +343,24 @@ class RangeMap {
 template <class Func>
 void RangeMap::ComputeRollup(const std::vector<const RangeMap*>& range_maps,
                              Func func) {
+  // Strings are only copied when the label of a map changes.
+  std::vector<std::string> keys(range_maps.size());
+  std::vector<uint32_t> last_ids;
+  ComputeLabelIdRollup(range_maps, [&](const std::vector<uint32_t>& ids,
+                                       uint64_t addr, uint64_t end) {
+    for (size_t i = 0; i < ids.size(); i++) {
+      if (last_ids.empty() || ids[i] != last_ids[i]) {
+        keys[i] = range_maps[i]->labels_->Get(ids[i]);
+      }
+    }
+    last_ids = ids;
+    func(keys, addr, end);
+  });
+}
+
+template <class Func>
+void RangeMap::ComputeLabelIdRollup(
+    const std::vector<const RangeMap*>& range_maps, Func func) {
   assert(range_maps.size() > 0);
   std::vector<Map::const_iterator> iters;
 
@@ -294,10 +405,14 @@ void RangeMap::ComputeRollup(const std::vector<const RangeMap*>& range_maps,
   //   -----  -----  -----             ---------------
   //
   // All input maps must cover exactly the same domain.
+  //
+  // Consecutive breaks that carry an identical key tuple (for example, a
+  // fine-grained map changing entries under the same label) are coalesced, so
+  // |func| is called once per run of identical keys.
 
   // Outer loop: once per continuous (gapless) region.
   while (true) {
-    std::vector<std::string> keys;
+    std::vector<uint32_t> keys;
     uint64_t current = 0;
 
     if (range_maps[0]->IterIsEnd(iters[0])) {
@@ -340,6 +455,7 @@ void RangeMap::ComputeRollup(const std::vector<const RangeMap*>& range_maps,
     }
 
     bool continuous = true;
+    uint64_t run_start = current;
 
     // Inner loop: once per range within the continuous region.
     while (continuous) {
@@ -349,7 +465,15 @@ void RangeMap::ComputeRollup(const std::vector<const RangeMap*>& range_maps,
         next_break = std::min(next_break, range_maps[i]->RangeEnd(iters[i]));
       }
 
-      func(keys, current, next_break);
+      // Emits the current run.  This must happen before |keys| is modified.
+      bool flushed = false;
+      auto flush = [&]() {
+        if (!flushed) {
+          func(keys, run_start, next_break);
+          run_start = next_break;
+          flushed = true;
+        }
+      };
 
       // Advance all iterators with ranges ending at next_break.
       for (int i = 0; i < iters.size(); i++) {
@@ -376,10 +500,14 @@ void RangeMap::ComputeRollup(const std::vector<const RangeMap*>& range_maps,
             throw std::runtime_error("Entry range extends beyond base range");
           }
           assert(i == 0 || !continuous);
+          flush();
           continuous = false;
         } else {
           assert(continuous);
-          keys[i] = iter->second.label;
+          if (iter->second.label != keys[i]) {
+            flush();
+            keys[i] = iter->second.label;
+          }
         }
       }
       current = next_break;
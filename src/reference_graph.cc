@@ -0,0 +1,223 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reference_graph.h"
+
+#include <algorithm>
+
+namespace bloaty {
+
+constexpr uint32_t ReferenceGraph::kNoNode;
+
+ReferenceGraph::ReferenceGraph(
+    uint32_t node_count,
+    const std::vector<std::pair<uint32_t, uint32_t>>& edges) {
+  // Counting sort by source, then sort and deduplicate each node's targets in
+  // place.
+  offsets_.assign(node_count + 1, 0);
+  for (const auto& edge : edges) {
+    offsets_[edge.first + 1]++;
+  }
+  for (uint32_t i = 0; i < node_count; i++) {
+    offsets_[i + 1] += offsets_[i];
+  }
+  targets_.resize(edges.size());
+  std::vector<uint32_t> fill(offsets_.begin(), offsets_.end() - 1);
+  for (const auto& edge : edges) {
+    targets_[fill[edge.first]++] = edge.second;
+  }
+
+  uint32_t out = 0;
+  for (uint32_t i = 0; i < node_count; i++) {
+    auto begin = targets_.begin() + offsets_[i];
+    auto end = targets_.begin() + offsets_[i + 1];
+    std::sort(begin, end);
+    end = std::unique(begin, end);
+    offsets_[i] = out;
+    out = std::copy(begin, end, targets_.begin() + out) - targets_.begin();
+  }
+  offsets_[node_count] = out;
+  targets_.resize(out);
+  targets_.shrink_to_fit();
+
+  // The reverse edges come out sorted, since we add them in source order.
+  reverse_offsets_.assign(node_count + 1, 0);
+  for (uint32_t target : targets_) {
+    reverse_offsets_[target + 1]++;
+  }
+  for (uint32_t i = 0; i < node_count; i++) {
+    reverse_offsets_[i + 1] += reverse_offsets_[i];
+  }
+  sources_.resize(targets_.size());
+  fill.assign(reverse_offsets_.begin(), reverse_offsets_.end() - 1);
+  for (uint32_t i = 0; i < node_count; i++) {
+    for (uint32_t target : Successors(i)) {
+      sources_[fill[target]++] = i;
+    }
+  }
+}
+
+DominatorTree ComputeDominatorTree(const ReferenceGraph& graph,
+                                   const std::vector<uint32_t>& roots) {
+  const uint32_t kNone = ReferenceGraph::kNoNode;
+  const uint32_t n = graph.node_count();
+  const uint32_t root = n;
+
+  // Number the nodes in depth-first preorder.  Below, everything but |number|
+  // is indexed by these numbers rather than by node.
+  std::vector<uint32_t> number(n + 1, kNone);
+  std::vector<uint32_t> vertex;
+  std::vector<uint32_t> parent;
+  vertex.reserve(n + 1);
+  parent.reserve(n + 1);
+  std::vector<bool> from_root(n, false);
+
+  struct Frame {
+    uint32_t node;
+    uint32_t next_edge;
+  };
+  std::vector<Frame> stack;
+  auto visit = [&](uint32_t start, uint32_t start_parent) {
+    number[start] = vertex.size();
+    vertex.push_back(start);
+    parent.push_back(start_parent);
+    stack.push_back({start, 0});
+    while (!stack.empty()) {
+      Frame& frame = stack.back();
+      auto successors = graph.Successors(frame.node);
+      if (frame.next_edge == successors.size()) {
+        stack.pop_back();
+        continue;
+      }
+      uint32_t next = successors[frame.next_edge++];
+      if (number[next] == kNone) {
+        parent.push_back(number[frame.node]);
+        number[next] = vertex.size();
+        vertex.push_back(next);
+        stack.push_back({next, 0});
+      }
+    }
+  };
+
+  // The root's edges aren't in |graph|, so it is numbered by hand.
+  number[root] = 0;
+  vertex.push_back(root);
+  parent.push_back(kNone);
+  for (uint32_t node : roots) {
+    from_root[node] = true;
+    if (number[node] == kNone) {
+      visit(node, 0);
+    }
+  }
+  for (uint32_t node = 0; node < n; node++) {
+    if (number[node] == kNone) {
+      from_root[node] = true;
+      visit(node, 0);
+    }
+  }
+
+  // Lengauer-Tarjan, with path compression but without balancing.
+  const uint32_t count = vertex.size();
+  std::vector<uint32_t> semi(count);
+  std::vector<uint32_t> label(count);
+  std::vector<uint32_t> ancestor(count, kNone);
+  std::vector<uint32_t> idom(count, kNone);
+  std::vector<uint32_t> bucket_head(count, kNone);
+  std::vector<uint32_t> bucket_next(count, kNone);
+  for (uint32_t i = 0; i < count; i++) {
+    semi[i] = i;
+    label[i] = i;
+  }
+
+  std::vector<uint32_t> path;
+  auto eval = [&](uint32_t v) {
+    if (ancestor[v] == kNone) {
+      return v;
+    }
+    // Compress the path to just below the top of v's tree, from the top down.
+    path.clear();
+    for (uint32_t u = v; ancestor[ancestor[u]] != kNone; u = ancestor[u]) {
+      path.push_back(u);
+    }
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      uint32_t a = ancestor[*it];
+      if (semi[label[a]] < semi[label[*it]]) {
+        label[*it] = label[a];
+      }
+      ancestor[*it] = ancestor[a];
+    }
+    return label[v];
+  };
+
+  for (uint32_t w = count - 1; w > 0; w--) {
+    uint32_t node = vertex[w];
+    auto consider = [&](uint32_t v) {
+      uint32_t u = eval(v);
+      if (semi[u] < semi[w]) {
+        semi[w] = semi[u];
+      }
+    };
+    for (uint32_t pred : graph.Predecessors(node)) {
+      consider(number[pred]);
+    }
+    if (from_root[node]) {
+      consider(0);
+    }
+
+    bucket_next[w] = bucket_head[semi[w]];
+    bucket_head[semi[w]] = w;
+
+    uint32_t p = parent[w];
+    ancestor[w] = p;
+    for (uint32_t v = bucket_head[p]; v != kNone; v = bucket_next[v]) {
+      uint32_t u = eval(v);
+      idom[v] = semi[u] < semi[v] ? u : p;
+    }
+    bucket_head[p] = kNone;
+  }
+
+  for (uint32_t w = 1; w < count; w++) {
+    if (idom[w] != semi[w]) {
+      idom[w] = idom[idom[w]];
+    }
+  }
+
+  DominatorTree tree;
+  tree.root = root;
+  tree.idom.assign(n + 1, kNone);
+  for (uint32_t w = 1; w < count; w++) {
+    tree.idom[vertex[w]] = vertex[idom[w]];
+  }
+  tree.order = std::move(vertex);
+  return tree;
+}
+
+void FindPossiblePointers(absl::string_view contents, uint64_t vmaddr,
+                          int pointer_size, Endian endian,
+                          std::vector<uint64_t>* refs) {
+  uint64_t skip = AlignUp(vmaddr, pointer_size) - vmaddr;
+  if (skip >= contents.size()) {
+    return;
+  }
+  contents.remove_prefix(skip);
+  while (contents.size() >= static_cast<size_t>(pointer_size)) {
+    uint64_t val = pointer_size == 8 ? ReadEndian<uint64_t>(&contents, endian)
+                                     : ReadEndian<uint32_t>(&contents, endian);
+    if (val != 0) {
+      refs->push_back(val);
+    }
+  }
+}
+
+}  // namespace bloaty
@@ -0,0 +1,102 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ReferenceGraph is a directed graph of which symbols refer to which, and
+// ComputeDominatorTree() finds which symbols each one keeps alive.  A symbol
+// D dominates S if every path from the roots to S goes through D, so removing
+// D would also remove S.  The "dominators" data source is built on these.
+//
+// Both are meant to scale to millions of nodes: the graph is stored as
+// compact adjacency arrays, and the dominator tree is computed with the
+// Lengauer-Tarjan algorithm without recursion.
+
+#ifndef BLOATY_REFERENCE_GRAPH_H_
+#define BLOATY_REFERENCE_GRAPH_H_
+
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "util.h"
+
+namespace bloaty {
+
+class ReferenceGraph {
+ public:
+  static constexpr uint32_t kNoNode = UINT32_MAX;
+
+  // Builds a graph with nodes [0, node_count) and the given (from, to) edges,
+  // in any order.  Duplicate edges are dropped.
+  ReferenceGraph(uint32_t node_count,
+                 const std::vector<std::pair<uint32_t, uint32_t>>& edges);
+
+  uint32_t node_count() const { return offsets_.size() - 1; }
+
+  // The nodes that |node| has edges to, in increasing order.
+  absl::Span<const uint32_t> Successors(uint32_t node) const {
+    return absl::MakeConstSpan(targets_.data() + offsets_[node],
+                               offsets_[node + 1] - offsets_[node]);
+  }
+
+  // The nodes that have edges to |node|, in increasing order.
+  absl::Span<const uint32_t> Predecessors(uint32_t node) const {
+    return absl::MakeConstSpan(sources_.data() + reverse_offsets_[node],
+                               reverse_offsets_[node + 1] -
+                                   reverse_offsets_[node]);
+  }
+
+ private:
+  // The successors of node i are targets_[offsets_[i], offsets_[i + 1]), and
+  // likewise for the predecessors.
+  std::vector<uint32_t> offsets_;
+  std::vector<uint32_t> targets_;
+  std::vector<uint32_t> reverse_offsets_;
+  std::vector<uint32_t> sources_;
+};
+
+struct DominatorTree {
+  // The node that the tree is rooted at, numbered graph.node_count().
+  uint32_t root;
+
+  // idom[node] is the immediate dominator of |node|: the closest node that
+  // every path from the root to |node| goes through.  kNoNode for the root.
+  std::vector<uint32_t> idom;
+
+  // All nodes, in an order where each one comes after its immediate
+  // dominator.
+  std::vector<uint32_t> order;
+};
+
+// Computes the dominator tree of |graph| with an added root node, which has
+// an edge to each of |roots|, and then to every node that still can't be
+// reached (in index order).  So a node that nothing refers to is one of the
+// root's children.
+DominatorTree ComputeDominatorTree(const ReferenceGraph& graph,
+                                   const std::vector<uint32_t>& roots);
+
+// Appends every |pointer_size| word in |contents| that is aligned in the VM
+// space (where |contents| starts at |vmaddr|), to be looked up as a possible
+// reference.  Like a conservative garbage collector, this can only add
+// references that aren't really there, which makes retained sizes smaller
+// rather than larger.
+void FindPossiblePointers(absl::string_view contents, uint64_t vmaddr,
+                          int pointer_size, Endian endian,
+                          std::vector<uint64_t>* refs);
+
+}  // namespace bloaty
+
+#endif  // BLOATY_REFERENCE_GRAPH_H_
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -58,6 +59,20 @@ static void FindField(absl::string_view* data, const char* name) {
   THROWF("field \"$0\" not found in source map", name);
 }
 
+// Maps each byte to its Base64 digit value, or -1 if it is not a Base64 digit.
+// Digits with bit 5 set (g-z, 0-9, + and /) are continuation digits and must be
+// followed by another digit.
+static const std::array<int8_t, 256> kBase64Digits = [] {
+  std::array<int8_t, 256> table;
+  table.fill(-1);
+  const char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  for (int i = 0; i < 64; i++) {
+    table[static_cast<uint8_t>(kAlphabet[i])] = i;
+  }
+  return table;
+}();
+
 static int32_t ReadBase64VLQ(absl::string_view* data) {
   uint32_t value = 0;
   uint32_t shift = 0;
@@ -65,25 +80,17 @@ static int32_t ReadBase64VLQ(absl::string_view* data) {
   const char* limit = ptr + data->size();
   while (ptr < limit) {
     auto ch = *(ptr++);
-    // Base64 characters A-Z, a-f do not have the continuation bit set and are
-    // the last digit.
-    if ((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch < 'g')) {
-      uint32_t digit = ch < 'a' ? ch - 'A' : ch - 'a' + 26;
-      value |= digit << shift;
+    int digit = kBase64Digits[static_cast<uint8_t>(ch)];
+    if (digit < 0) {
+      THROWF("Invalid Base64VLQ digit $0", ch);
+    }
+    value |= static_cast<uint32_t>(digit & 0x1f) << shift;
+    if ((digit & 0x20) == 0) {
       data->remove_prefix(ptr - data->data());
       return value & 1
           ? -static_cast<int32_t>(value >> 1)
           : static_cast<int32_t>(value >> 1);
     }
-    if (!(ch >= 'g' && ch <= 'z') && !(ch >= '0' && ch <= '9') && ch != '+' &&
-        ch != '/') {
-      THROWF("Invalid Base64VLQ digit $0", ch);
-    }
-    // Base64 characters g-z, 0-9, + and / have the continuation bit set and
-    // must be followed by another digit.
-    uint32_t digit =
-      ch > '9' ? ch - 'g' : (ch >= '0' ? ch - '0' + 20 : (ch == '+' ? 30 : 31));
-    value |= digit << shift;
     shift += 5;
   }
 
@@ -91,8 +98,7 @@ static int32_t ReadBase64VLQ(absl::string_view* data) {
 }
 
 static bool IsBase64Digit(char ch) {
-  return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') ||
-         (ch >= '0' && ch <= '9') || ch == '+' || ch == '/';
+  return kBase64Digits[static_cast<uint8_t>(ch)] >= 0;
 }
 
 static int ReadBase64VLQSegment(absl::string_view* data, int32_t (&values)[5]) {
@@ -48,6 +48,13 @@ class SourceMapObjectFile : public ObjectFile {
     return false;
   }
 
+  bool GetDisassemblyBatch(const ReImpl& /*regex*/,
+                           DataSource /*symbol_source*/,
+                           DisassemblyBatch* /*batch*/) const override {
+    WARN("Disassembly not supported for source map files");
+    return false;
+  }
+
   void ProcessFileToSink(RangeSink* sink) const;
 
  private:
@@ -0,0 +1,195 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symbol_order.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+namespace bloaty {
+
+namespace {
+
+// A cluster's functions form a circular list through |next| and |prev|,
+// starting at the cluster's leader, so that two clusters can be joined in
+// constant time.
+struct Cluster {
+  uint32_t next;
+  uint32_t prev;
+  uint64_t size;
+  uint64_t weight;
+
+  // The caller with the hottest call to this function.
+  uint32_t best_caller = ReferenceGraph::kNoNode;
+  uint64_t best_caller_weight = 0;
+
+  double Density() const { return static_cast<double>(weight) / size; }
+};
+
+// A merge isn't worth it if it would dilute the caller's cluster by more than
+// this factor.  The value is the one lld uses.
+constexpr double kMaxDensityDegradation = 8.0;
+
+uint32_t FindLeader(std::vector<uint32_t>* leaders, uint32_t node) {
+  // Path halving keeps the chains short without recursion.
+  while ((*leaders)[node] != node) {
+    (*leaders)[node] = (*leaders)[(*leaders)[node]];
+    node = (*leaders)[node];
+  }
+  return node;
+}
+
+}  // namespace
+
+std::vector<uint32_t> ComputeFunctionOrder(
+    const std::vector<OrderedFunction>& functions, const ReferenceGraph& calls,
+    uint64_t max_cluster_size) {
+  const uint32_t n = functions.size();
+  std::vector<Cluster> clusters(n);
+  for (uint32_t i = 0; i < n; i++) {
+    Cluster& cluster = clusters[i];
+    cluster.next = i;
+    cluster.prev = i;
+    cluster.size = std::max<uint64_t>(functions[i].size, 1);
+    cluster.weight = functions[i].samples;
+    for (uint32_t caller : calls.Predecessors(i)) {
+      uint64_t weight =
+          std::min(functions[caller].samples, functions[i].samples);
+      if (caller != i && weight > cluster.best_caller_weight) {
+        cluster.best_caller = caller;
+        cluster.best_caller_weight = weight;
+      }
+    }
+  }
+
+  // Visit the densest functions first, so they get the first pick of their
+  // callers' clusters.
+  std::vector<uint32_t> sorted(n);
+  std::iota(sorted.begin(), sorted.end(), 0);
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [&clusters](uint32_t a, uint32_t b) {
+                     return clusters[a].Density() > clusters[b].Density();
+                   });
+
+  std::vector<uint32_t> leaders(n);
+  std::iota(leaders.begin(), leaders.end(), 0);
+  for (uint32_t i : sorted) {
+    // Each function is only ever merged into another cluster here, so it
+    // still leads its own.
+    Cluster& cluster = clusters[i];
+    if (cluster.best_caller == ReferenceGraph::kNoNode ||
+        cluster.best_caller_weight * 10 <= functions[i].samples) {
+      // The function is mostly reached some other way, like from a caller we
+      // can't see.
+      continue;
+    }
+
+    uint32_t caller_leader = FindLeader(&leaders, cluster.best_caller);
+    if (caller_leader == i) {
+      continue;
+    }
+    Cluster& into = clusters[caller_leader];
+    if (into.size + cluster.size > max_cluster_size) {
+      continue;
+    }
+    double merged_density = static_cast<double>(into.weight + cluster.weight) /
+                            (into.size + cluster.size);
+    if (merged_density * kMaxDensityDegradation < into.Density()) {
+      continue;
+    }
+
+    // Append this cluster's list after the caller's.
+    leaders[i] = caller_leader;
+    uint32_t into_tail = into.prev;
+    uint32_t tail = cluster.prev;
+    into.prev = tail;
+    clusters[tail].next = caller_leader;
+    cluster.prev = into_tail;
+    clusters[into_tail].next = i;
+    into.size += cluster.size;
+    into.weight += cluster.weight;
+    cluster.size = 0;
+    cluster.weight = 0;
+  }
+
+  // Hot clusters go first, densest first.  The cold ones keep their order,
+  // since the sort is stable.
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> cluster_leaders;
+  for (uint32_t i = 0; i < n; i++) {
+    if (leaders[i] == i) {
+      cluster_leaders.push_back(i);
+    }
+  }
+  std::stable_sort(cluster_leaders.begin(), cluster_leaders.end(),
+                   [&clusters](uint32_t a, uint32_t b) {
+                     return clusters[a].Density() > clusters[b].Density();
+                   });
+
+  order.reserve(n);
+  for (uint32_t leader : cluster_leaders) {
+    uint32_t i = leader;
+    do {
+      order.push_back(i);
+      i = clusters[i].next;
+    } while (i != leader);
+  }
+  return order;
+}
+
+std::vector<uint64_t> LayOutFunctions(
+    const std::vector<OrderedFunction>& functions,
+    const std::vector<uint32_t>& order, uint64_t start) {
+  std::vector<uint64_t> addrs(functions.size());
+  uint64_t addr = start;
+  for (uint32_t i : order) {
+    uint64_t vmaddr = functions[i].vmaddr;
+    uint64_t align = std::min<uint64_t>(vmaddr & (~vmaddr + 1), 64);
+    if (align == 0) {
+      align = 64;
+    }
+    addr = (addr + align - 1) & ~(align - 1);
+    addrs[i] = addr;
+    addr += functions[i].size;
+  }
+  return addrs;
+}
+
+uint64_t CountHotPages(const std::vector<OrderedFunction>& functions,
+                       const std::vector<uint64_t>& addrs,
+                       uint64_t page_size) {
+  // The first and last page of each hot function, merged where they overlap.
+  std::vector<std::pair<uint64_t, uint64_t>> pages;
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (functions[i].samples > 0 && functions[i].size > 0) {
+      pages.emplace_back(addrs[i] / page_size,
+                         (addrs[i] + functions[i].size - 1) / page_size);
+    }
+  }
+  std::sort(pages.begin(), pages.end());
+
+  uint64_t count = 0;
+  uint64_t next = 0;  // The first page not yet counted.
+  for (const auto& range : pages) {
+    uint64_t first = std::max(range.first, next);
+    if (range.second >= first) {
+      count += range.second - first + 1;
+      next = range.second + 1;
+    }
+  }
+  return count;
+}
+
+}  // namespace bloaty
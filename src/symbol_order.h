@@ -0,0 +1,63 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ComputeFunctionOrder() picks an order for a binary's functions that packs
+// the hot ones into as few pages as possible, for --symbol-ordering-file.  It
+// uses call-chain clustering (C3, from "Optimizing Function Placement for
+// Large-Scale Data-Center Applications", Ottoni and Maher, CGO 2017), as lld
+// does for --call-graph-profile-sort: each function is placed after its
+// hottest caller, and the resulting clusters are sorted by how dense their
+// samples are.  It takes O(E + N log N) time for N functions and E calls.
+
+#ifndef BLOATY_SYMBOL_ORDER_H_
+#define BLOATY_SYMBOL_ORDER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "reference_graph.h"
+
+namespace bloaty {
+
+struct OrderedFunction {
+  uint64_t vmaddr;
+  uint64_t size;
+  uint64_t samples;  // Profile samples that fall in the function.
+};
+
+// Returns the indexes of |functions| in their new order.  |calls| has an edge
+// from each function to the functions it calls; without branch records, a
+// call is taken to be as hot as the colder of its two ends.  Clusters are
+// grown up to |max_cluster_size| bytes.  Functions without samples come last,
+// in their original order.
+std::vector<uint32_t> ComputeFunctionOrder(
+    const std::vector<OrderedFunction>& functions, const ReferenceGraph& calls,
+    uint64_t max_cluster_size);
+
+// Returns where each function would be placed if the functions were laid out
+// in |order| starting at |start|.  Each function keeps the alignment of its
+// current address, up to 64 bytes.
+std::vector<uint64_t> LayOutFunctions(
+    const std::vector<OrderedFunction>& functions,
+    const std::vector<uint32_t>& order, uint64_t start);
+
+// Returns how many |page_size| pages the functions with samples overlap, when
+// function i is placed at |addrs[i]|.
+uint64_t CountHotPages(const std::vector<OrderedFunction>& functions,
+                       const std::vector<uint64_t>& addrs, uint64_t page_size);
+
+}  // namespace bloaty
+
+#endif  // BLOATY_SYMBOL_ORDER_H_
@@ -0,0 +1,675 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "template_family.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/strip.h"
+
+using absl::string_view;
+
+namespace bloaty {
+
+namespace {
+
+struct Operator {
+  const char* code;
+  const char* name;
+};
+
+const Operator kOperators[] = {
+    {"nw", " new"}, {"na", " new[]"}, {"dl", " delete"}, {"da", " delete[]"},
+    {"aw", " co_await"}, {"ps", "+"}, {"ng", "-"},  {"ad", "&"},
+    {"de", "*"},   {"co", "~"},   {"pl", "+"},   {"mi", "-"},   {"ml", "*"},
+    {"dv", "/"},   {"rm", "%"},   {"an", "&"},   {"or", "|"},   {"eo", "^"},
+    {"aS", "="},   {"pL", "+="},  {"mI", "-="},  {"mL", "*="},  {"dV", "/="},
+    {"rM", "%="},  {"aN", "&="},  {"oR", "|="},  {"eO", "^="},  {"ls", "<<"},
+    {"rs", ">>"},  {"lS", "<<="}, {"rS", ">>="}, {"eq", "=="},  {"ne", "!="},
+    {"lt", "<"},   {"gt", ">"},   {"le", "<="},  {"ge", ">="},  {"ss", "<=>"},
+    {"nt", "!"},   {"aa", "&&"},  {"oo", "||"},  {"pp", "++"},  {"mm", "--"},
+    {"cm", ","},   {"pm", "->*"}, {"pt", "->"},  {"cl", "()"},  {"ix", "[]"},
+    {"qu", "?"},
+};
+
+// Reads the name of one mangled symbol, following the grammar of the Itanium
+// C++ ABI.  Only the parts of the grammar that can appear in the name itself
+// are turned into text.  Template arguments and parameter types are only
+// skipped, but they still have to be parsed, since they can add substitution
+// candidates that the rest of the name refers to.
+//
+// Every method returns false if the input can't be parsed.
+class FamilyParser {
+ public:
+  explicit FamilyParser(string_view mangled) : in_(mangled) {}
+
+  // <encoding> ::= <name> <bare-function-type> | <special-name>
+  //
+  // The parameter types are only read if |skip_params| is set, which is
+  // needed when more of the name comes after them.
+  bool ParseEncoding(std::string* out, bool skip_params) {
+    DepthGuard guard(this);
+    if (!guard.ok()) return false;
+
+    if (Peek('T') || Peek('G')) {
+      return ParseSpecialName(out);
+    }
+    if (!ParseName(out, false)) return false;
+    if (skip_params) {
+      while (!in_.empty() && !Peek('E')) {
+        if (!SkipType()) return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  // Mangled names nest, so a malformed one could otherwise overflow the stack.
+  static constexpr int kMaxDepth = 256;
+
+  class DepthGuard {
+   public:
+    explicit DepthGuard(FamilyParser* parser) : parser_(parser) {
+      parser_->depth_++;
+    }
+    ~DepthGuard() { parser_->depth_--; }
+    bool ok() const { return parser_->depth_ <= kMaxDepth; }
+
+   private:
+    FamilyParser* parser_;
+  };
+
+  bool Peek(char ch) const { return !in_.empty() && in_[0] == ch; }
+  bool Peek(string_view str) const { return absl::StartsWith(in_, str); }
+  bool Consume(char ch) {
+    if (!Peek(ch)) return false;
+    in_.remove_prefix(1);
+    return true;
+  }
+  bool Consume(string_view str) { return absl::ConsumePrefix(&in_, str); }
+  bool PeekDigit() const {
+    return !in_.empty() && absl::ascii_isdigit(in_[0]);
+  }
+
+  bool ReadNumber(uint64_t* val) {
+    if (!PeekDigit()) return false;
+    *val = 0;
+    while (PeekDigit()) {
+      if (*val > UINT32_MAX) return false;
+      *val = *val * 10 + (in_[0] - '0');
+      in_.remove_prefix(1);
+    }
+    return true;
+  }
+
+  // Adds a substitution candidate.  Candidates that are only skipped, like
+  // pointer types, are added as an empty string.
+  void AddCandidate(const std::string& text) { subs_.push_back(text); }
+
+  // <source-name> ::= <positive length number> <identifier>
+  bool ReadSourceName(std::string* out) {
+    uint64_t len;
+    if (!ReadNumber(&len) || len > in_.size()) return false;
+    string_view name = in_.substr(0, len);
+    in_.remove_prefix(len);
+    if (absl::StartsWith(name, "_GLOBAL__N")) {
+      *out = "(anonymous namespace)";
+    } else {
+      out->assign(name.data(), name.size());
+    }
+    return true;
+  }
+
+  // <special-name> ::= TV <type> | TT <type> | TI <type> | TS <type>
+  //                ::= Th <offset> _ <encoding> | Tv <offset> _ <encoding>
+  //                ::= GTt <encoding>
+  //                ::= GV <name> | TW <name> | TH <name>
+  bool ParseSpecialName(std::string* out) {
+    const char* prefix;
+    std::string name;
+    if (Consume("TV")) {
+      prefix = "vtable for ";
+    } else if (Consume("TT")) {
+      prefix = "VTT for ";
+    } else if (Consume("TI")) {
+      prefix = "typeinfo for ";
+    } else if (Consume("TS")) {
+      prefix = "typeinfo name for ";
+    } else if (Consume("Th")) {
+      uint64_t offset;
+      Consume('n');
+      if (!ReadNumber(&offset) || !Consume('_') ||
+          !ParseEncoding(&name, false)) {
+        return false;
+      }
+      *out = "non-virtual thunk to " + name;
+      return true;
+    } else if (Consume("Tv")) {
+      uint64_t offset;
+      Consume('n');
+      if (!ReadNumber(&offset) || !Consume('_')) return false;
+      Consume('n');
+      if (!ReadNumber(&offset) || !Consume('_') ||
+          !ParseEncoding(&name, false)) {
+        return false;
+      }
+      *out = "virtual thunk to " + name;
+      return true;
+    } else if (Consume("GTt")) {
+      if (!ParseEncoding(&name, false)) return false;
+      *out = "transaction clone for " + name;
+      return true;
+    } else if (Consume("GV")) {
+      prefix = "guard variable for ";
+    } else if (Consume("TW")) {
+      prefix = "TLS wrapper function for ";
+    } else if (Consume("TH")) {
+      prefix = "TLS init function for ";
+    } else {
+      return false;
+    }
+    // Only class types are supported, which are spelled like names.
+    if (Peek('S') && !Peek("St")) {
+      if (!ParseSubstitution(&name, false)) return false;
+    } else if (!ParseName(&name, true)) {
+      return false;
+    }
+    *out = prefix + name;
+    return true;
+  }
+
+  // <name> ::= <nested-name>
+  //        ::= <unscoped-name>
+  //        ::= <unscoped-template-name> <template-args>
+  //        ::= <local-name>
+  //
+  // |as_type| is set when the name is a class type, which makes the whole
+  // name a substitution candidate.
+  bool ParseName(std::string* out, bool as_type) {
+    DepthGuard guard(this);
+    if (!guard.ok()) return false;
+
+    if (Peek('N')) {
+      return ParseNestedName(out, as_type);
+    } else if (Peek('Z')) {
+      return ParseLocalName(out);
+    }
+
+    if (Peek('S') && !Peek("St")) {
+      // <unscoped-template-name> ::= <substitution>
+      if (!ParseSubstitution(out, false) || !Peek('I')) return false;
+    } else {
+      std::string name;
+      std::string std_prefix = Consume("St") ? "std::" : "";
+      if (!ParseUnqualifiedName(&name, "")) return false;
+      *out = std_prefix + name;
+      if (Peek('I')) {
+        AddCandidate(*out);
+      }
+    }
+
+    if (Peek('I')) {
+      if (!SkipTemplateArgs()) return false;
+      *out += "<*>";
+    }
+    if (as_type) {
+      AddCandidate(*out);
+    }
+    return true;
+  }
+
+  // Returns "vector" for "std::vector<*>".  Erased template arguments never
+  // contain "::", so this doesn't need to match brackets.
+  static std::string LastComponent(string_view text) {
+    absl::ConsumeSuffix(&text, "<*>");
+    size_t pos = text.rfind("::");
+    if (pos != string_view::npos) {
+      text.remove_prefix(pos + 2);
+    }
+    return std::string(text);
+  }
+
+  // <nested-name> ::= N [<CV-qualifiers>] [<ref-qualifier>] <prefix>
+  //                   <unqualified-name> E
+  //               ::= N [<CV-qualifiers>] [<ref-qualifier>] <template-prefix>
+  //                   <template-args> E
+  //
+  // Every prefix is a substitution candidate.
+  bool ParseNestedName(std::string* out, bool as_type) {
+    if (!Consume('N')) return false;
+    while (Consume('r') || Consume('V') || Consume('K')) {
+    }
+    if (!Consume('R')) Consume('O');
+
+    std::string text;
+    bool first = true;
+    bool substituted = false;
+    while (!Consume('E')) {
+      if (in_.empty()) return false;
+      if (!first && !substituted) {
+        AddCandidate(text);
+      }
+      substituted = false;
+
+      if (Peek('I')) {
+        if (first || !SkipTemplateArgs()) return false;
+        text += "<*>";
+      } else if (first && Peek('S') && !Peek("St")) {
+        if (!ParseSubstitution(&text, false)) return false;
+        substituted = true;
+      } else if (Consume('M')) {
+        // <data-member-prefix> ::= <member source-name> M
+        // The name was already added, and is followed by a lambda.
+        substituted = true;
+      } else {
+        std::string name;
+        std::string class_name = LastComponent(text);
+        if (first && Consume("St")) {
+          text = "std::";
+        } else if (!first) {
+          text += "::";
+        }
+        if (!ParseUnqualifiedName(&name, class_name)) return false;
+        text += name;
+      }
+      first = false;
+    }
+
+    if (first) return false;
+    if (as_type) {
+      AddCandidate(text);
+    }
+    *out = text;
+    return true;
+  }
+
+  // <local-name> ::= Z <function encoding> E <entity name> [<discriminator>]
+  //              ::= Z <function encoding> E s [<discriminator>]
+  bool ParseLocalName(std::string* out) {
+    std::string function;
+    std::string entity;
+    if (!Consume('Z') || !ParseEncoding(&function, true) || !Consume('E')) {
+      return false;
+    }
+    if (Consume('s')) {
+      entity = "string literal";
+    } else {
+      if (Consume('d')) {
+        // Default argument: d [<parameter number>] _ <name>
+        uint64_t num;
+        ReadNumber(&num);
+        if (!Consume('_')) return false;
+      }
+      if (!ParseName(&entity, false)) return false;
+    }
+
+    // <discriminator> ::= _ <digit> | __ <number> _
+    if (Consume("__")) {
+      uint64_t num;
+      if (!ReadNumber(&num) || !Consume('_')) return false;
+    } else if (Consume('_')) {
+      if (!PeekDigit()) return false;
+      in_.remove_prefix(1);
+    }
+
+    *out = function + "::" + entity;
+    return true;
+  }
+
+  // <unqualified-name> ::= <source-name> | <operator-name>
+  //                    ::= <ctor-dtor-name> | <unnamed-type-name>
+  //
+  // |class_name| is the name of the enclosing class, for constructors and
+  // destructors.
+  bool ParseUnqualifiedName(std::string* out, const std::string& class_name) {
+    // GCC marks names with internal linkage.
+    if (in_.size() > 1 && in_[0] == 'L' && absl::ascii_isdigit(in_[1])) {
+      in_.remove_prefix(1);
+    }
+
+    if (PeekDigit()) {
+      if (!ReadSourceName(out)) return false;
+    } else if (Peek('C') && in_.size() > 1 &&
+               (absl::ascii_isdigit(in_[1]) || in_[1] == 'I')) {
+      // Inheriting constructors name the base class type.
+      bool inheriting = in_[1] == 'I';
+      in_.remove_prefix(inheriting ? 3 : 2);
+      if (class_name.empty() || (inheriting && !SkipType())) return false;
+      *out = class_name;
+    } else if (Peek('D') && in_.size() > 1 && in_[1] >= '0' && in_[1] <= '5') {
+      in_.remove_prefix(2);
+      if (class_name.empty()) return false;
+      *out = "~" + class_name;
+    } else if (Consume("Ut")) {
+      uint64_t num;
+      ReadNumber(&num);
+      if (!Consume('_')) return false;
+      *out = "{unnamed type}";
+    } else if (Consume("Ul")) {
+      while (!Consume('E')) {
+        if (in_.empty() || !SkipType()) return false;
+      }
+      uint64_t num;
+      ReadNumber(&num);
+      if (!Consume('_')) return false;
+      *out = "{lambda}";
+    } else if (!ParseOperatorName(out)) {
+      return false;
+    }
+
+    // ABI tags are left out, like template arguments.
+    while (Consume('B')) {
+      std::string tag;
+      if (!ReadSourceName(&tag)) return false;
+    }
+    return true;
+  }
+
+  // <operator-name> ::= <two-letter code> | cv <type> | li <source-name>
+  //                 ::= v <digit> <source-name>
+  bool ParseOperatorName(std::string* out) {
+    if (Consume("cv")) {
+      // The type is left out, like the other types.
+      if (!SkipType()) return false;
+      *out = "operator cast";
+      return true;
+    } else if (Consume("li")) {
+      std::string name;
+      if (!ReadSourceName(&name)) return false;
+      *out = "operator\"\" " + name;
+      return true;
+    } else if (in_.size() > 1 && in_[0] == 'v' && absl::ascii_isdigit(in_[1])) {
+      std::string name;
+      in_.remove_prefix(2);
+      if (!ReadSourceName(&name)) return false;
+      *out = "operator " + name;
+      return true;
+    }
+
+    for (const auto& op : kOperators) {
+      if (Consume(op.code)) {
+        *out = std::string("operator") + op.name;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // <substitution> ::= S_ | S <seq-id> _ | Sa | Sb | Ss | Si | So | Sd
+  //
+  // Substitutions of types that were only skipped can't be named, so they
+  // fail unless |skipping| is set.
+  bool ParseSubstitution(std::string* out, bool skipping) {
+    if (!Consume('S')) return false;
+    if (Consume('a')) {
+      *out = "std::allocator";
+    } else if (Consume('b')) {
+      *out = "std::basic_string";
+    } else if (Consume('s')) {
+      *out = "std::string";
+    } else if (Consume('i')) {
+      *out = "std::istream";
+    } else if (Consume('o')) {
+      *out = "std::ostream";
+    } else if (Consume('d')) {
+      *out = "std::iostream";
+    } else {
+      // <seq-id> is base 36, and S_ comes before S0_.
+      size_t index = 0;
+      if (!Consume('_')) {
+        while (!Consume('_')) {
+          if (in_.empty() || index > UINT32_MAX) return false;
+          char ch = in_[0];
+          if (absl::ascii_isdigit(ch)) {
+            index = index * 36 + (ch - '0');
+          } else if (ch >= 'A' && ch <= 'Z') {
+            index = index * 36 + (ch - 'A' + 10);
+          } else {
+            return false;
+          }
+          in_.remove_prefix(1);
+        }
+        index++;
+      }
+      if (index >= subs_.size()) {
+        return skipping;
+      }
+      *out = subs_[index];
+      if (out->empty() && !skipping) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // <template-args> ::= I <template-arg>+ E
+  bool SkipTemplateArgs() {
+    DepthGuard guard(this);
+    if (!guard.ok() || !Consume('I')) return false;
+    while (!Consume('E')) {
+      if (in_.empty() || !SkipTemplateArg()) return false;
+    }
+    return true;
+  }
+
+  // <template-arg> ::= <type> | X <expression> E | <expr-primary>
+  //                ::= J <template-arg>* E
+  //
+  // Expressions aren't supported.
+  bool SkipTemplateArg() {
+    if (Peek('L')) {
+      return SkipLiteral();
+    } else if (Consume('J')) {
+      while (!Consume('E')) {
+        if (in_.empty() || !SkipTemplateArg()) return false;
+      }
+      return true;
+    }
+    return SkipType();
+  }
+
+  // <expr-primary> ::= L <type> <value> E | L _Z <encoding> E
+  bool SkipLiteral() {
+    if (!Consume('L')) return false;
+    if (Consume("_Z")) {
+      std::string ignored;
+      return ParseEncoding(&ignored, true) && Consume('E');
+    }
+    if (!SkipType()) return false;
+    // Values are numbers, possibly negative or in hex, so they never contain
+    // an 'E'.
+    while (!Consume('E')) {
+      if (in_.empty()) return false;
+      in_.remove_prefix(1);
+    }
+    return true;
+  }
+
+  // <function-type> ::= F [Y] <bare-function-type> [<ref-qualifier>] E
+  bool SkipFunctionType() {
+    if (!Consume('F')) return false;
+    Consume('Y');
+    while (!Consume('E')) {
+      if (Consume("RE") || Consume("OE")) return true;
+      if (in_.empty() || !SkipType()) return false;
+    }
+    return true;
+  }
+
+  bool SkipType() {
+    DepthGuard guard(this);
+    if (!guard.ok() || in_.empty()) return false;
+
+    char ch = in_[0];
+    if (absl::StrContains("vwbcahstijlmxynofdegz", ch)) {
+      // Builtin types aren't substitution candidates.
+      in_.remove_prefix(1);
+      return true;
+    }
+
+    switch (ch) {
+      case 'u': {
+        std::string name;
+        in_.remove_prefix(1);
+        return ReadSourceName(&name);
+      }
+      case 'r':
+      case 'V':
+      case 'K':
+        while (Consume('r') || Consume('V') || Consume('K')) {
+        }
+        if (!SkipType()) return false;
+        break;
+      case 'P':
+      case 'R':
+      case 'O':
+      case 'C':
+      case 'G':
+        in_.remove_prefix(1);
+        if (!SkipType()) return false;
+        break;
+      case 'F':
+        if (!SkipFunctionType()) return false;
+        break;
+      case 'A': {
+        uint64_t size;
+        in_.remove_prefix(1);
+        ReadNumber(&size);
+        if (!Consume('_') || !SkipType()) return false;
+        break;
+      }
+      case 'M':
+        in_.remove_prefix(1);
+        if (!SkipType() || !SkipType()) return false;
+        break;
+      case 'T': {
+        std::string name;
+        if (Consume("Ts") || Consume("Tu") || Consume("Te")) {
+          return ParseName(&name, true);
+        }
+        uint64_t index;
+        in_.remove_prefix(1);
+        ReadNumber(&index);
+        if (!Consume('_')) return false;
+        AddCandidate("");
+        if (Peek('I')) {
+          if (!SkipTemplateArgs()) return false;
+          break;
+        }
+        return true;
+      }
+      case 'D':
+        return SkipDType();
+      case 'S': {
+        std::string name;
+        if (Peek("St")) {
+          return ParseName(&name, true);
+        }
+        if (!ParseSubstitution(&name, true)) return false;
+        if (!Peek('I')) {
+          // A substitution by itself is not a new candidate.
+          return true;
+        }
+        if (!SkipTemplateArgs()) return false;
+        break;
+      }
+      case 'N':
+      case 'Z':
+      default: {
+        std::string name;
+        return ParseName(&name, true);
+      }
+    }
+
+    AddCandidate("");
+    return true;
+  }
+
+  // The types that start with 'D'.
+  bool SkipDType() {
+    if (in_.size() < 2) return false;
+    char ch = in_[1];
+    in_.remove_prefix(2);
+    uint64_t num;
+    switch (ch) {
+      case 'a':
+      case 'c':
+      case 'n':
+      case 'i':
+      case 's':
+      case 'u':
+      case 'f':
+      case 'd':
+      case 'e':
+      case 'h':
+        // Builtin types.
+        return true;
+      case 'F':
+        // DF <bits> _, and DF16b for bfloat16.
+        if (!ReadNumber(&num)) return false;
+        return Consume('_') || Consume('x') || Consume('b');
+      case 'B':
+      case 'U':
+        // _BitInt(N) and unsigned _BitInt(N).
+        return ReadNumber(&num) && Consume('_');
+      case 'p':
+        // Pack expansion.
+        if (!SkipType()) return false;
+        break;
+      case 'v':
+        // Vector type.
+        if (!ReadNumber(&num) || !Consume('_') || !SkipType()) return false;
+        break;
+      case 'x':
+      case 'o':
+        // Exception specifications, which qualify a function type.
+        if (!SkipType()) return false;
+        break;
+      case 'w':
+        while (!Consume('E')) {
+          if (in_.empty() || !SkipType()) return false;
+        }
+        if (!SkipType()) return false;
+        break;
+      default:
+        // decltype() and noexcept() hold expressions.
+        return false;
+    }
+    AddCandidate("");
+    return true;
+  }
+
+  string_view in_;
+  std::vector<std::string> subs_;
+  int depth_ = 0;
+};
+
+constexpr int FamilyParser::kMaxDepth;
+
+}  // namespace
+
+bool TemplateFamily(string_view symbol, std::string* family) {
+  if (!absl::ConsumePrefix(&symbol, "__Z") &&
+      !absl::ConsumePrefix(&symbol, "_Z")) {
+    return false;
+  }
+  FamilyParser parser(symbol);
+  return parser.ParseEncoding(family, false);
+}
+
+}  // namespace bloaty
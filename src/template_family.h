@@ -0,0 +1,43 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// TemplateFamily() reads the name out of an Itanium-mangled symbol, with every
+// template argument list erased, so that all instantiations of a template
+// share one label:
+//
+//   _ZNSt6vectorIiSaIiEE9push_backERKi   ->  std::vector<*>::push_back
+//   _ZNSt6vectorIPcSaIS0_EE9push_backEOS0_  ->  std::vector<*>::push_back
+//
+// The "templates" data source is built on this.  It works on the mangled
+// name directly: template arguments and parameter types are skipped by
+// following the mangling grammar, never by demangling to text and rewriting
+// it.  Overloads of a function also share a label, since parameter types
+// are left out.
+
+#ifndef BLOATY_TEMPLATE_FAMILY_H_
+#define BLOATY_TEMPLATE_FAMILY_H_
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace bloaty {
+
+// Sets |family| and returns true if |symbol| is an Itanium-mangled name that
+// could be parsed.  A leading extra underscore, as on Mach-O, is allowed.
+bool TemplateFamily(absl::string_view symbol, std::string* family);
+
+}  // namespace bloaty
+
+#endif  // BLOATY_TEMPLATE_FAMILY_H_
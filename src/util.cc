@@ -14,6 +14,9 @@
 
 #include "util.h"
 
+#include <algorithm>
+#include <cstring>
+
 using absl::string_view;
 
 namespace bloaty {
@@ -23,6 +26,51 @@ void Throw(const char *str, int line) {
   throw bloaty::Error(str, __FILE__, line);
 }
 
+uint64_t ReadLongLEB128(bool is_signed, int bits, absl::string_view* data,
+                        const char* what) {
+  uint64_t ret = 0;
+  int shift = 0;
+  int maxshift = 70;
+  const char* ptr = data->data();
+  const char* limit = ptr + data->size();
+
+  while (ptr < limit && shift < maxshift) {
+    char byte = *(ptr++);
+    ret |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    shift += 7;
+    if ((byte & 0x80) == 0) {
+      data->remove_prefix(ptr - data->data());
+      if (is_signed && shift < bits && (byte & 0x40)) {
+        ret |= -(1ULL << shift);
+      }
+      return ret;
+    }
+  }
+
+  THROWF("corrupt $0 data, unterminated LEB128", what);
+}
+
+void SkipLEB128(absl::string_view* data, const char* what) {
+  if (data->size() >= 8) {
+    int len = LEB128WordLength(LoadLEB128Word(*data));
+    if (len > 0) {
+      data->remove_prefix(len);
+      return;
+    }
+  }
+
+  size_t limit =
+      std::min(static_cast<size_t>(data->size()), static_cast<size_t>(10));
+  for (size_t i = 0; i < limit; i++) {
+    if (((*data)[i] & 0x80) == 0) {
+      data->remove_prefix(i + 1);
+      return;
+    }
+  }
+
+  THROWF("corrupt $0 data, unterminated LEB128", what);
+}
+
 absl::string_view ReadUntilConsuming(absl::string_view* data, char c) {
   absl::string_view ret = ReadUntil(data, c);
 
@@ -15,6 +15,7 @@
 #ifndef BLOATY_UTIL_H_
 #define BLOATY_UTIL_H_
 
+#include <cstring>
 #include <stdexcept>
 
 #include "absl/numeric/int128.h"
@@ -102,6 +103,20 @@ inline absl::string_view StrictSubstr(absl::string_view data, size_t off) {
   return data.substr(off);
 }
 
+// Requires: x != 0.
+inline int CountTrailingZeros64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(x);
+#else
+  int n = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
 inline size_t AlignUp(size_t offset, size_t granularity) {
   // Granularity must be a power of two.
   BLOATY_ASSERT((granularity & (granularity - 1)) == 0);
@@ -158,6 +173,81 @@ template <class T> T ReadBigEndian(absl::string_view *data) {
   return ReadEndian<T>(data, Endian::kBig);
 }
 
+// LEB128 varints //////////////////////////////////////////////////////////////
+
+// Out-of-line path of ReadLEB128Internal() for varints that end within the
+// last eight bytes of |data| or are longer than eight bytes.
+uint64_t ReadLongLEB128(bool is_signed, int bits, absl::string_view* data,
+                        const char* what);
+
+// The continuation bit of each byte of a little-endian word.
+constexpr uint64_t kLEB128ContinuationBits = 0x8080808080808080ULL;
+
+// Loads the next eight bytes of |data| as a little-endian word.  |data| must
+// have at least eight bytes.
+inline uint64_t LoadLEB128Word(absl::string_view data) {
+  uint64_t word;
+  memcpy(&word, data.data(), sizeof(word));
+  return GetMachineEndian() == Endian::kLittle ? word : ByteSwap(word);
+}
+
+// Returns the length of the varint that starts at the bottom of |word|, or 0
+// if it is not terminated within the word.
+inline int LEB128WordLength(uint64_t word) {
+  uint64_t stops = ~word & kLEB128ContinuationBits;
+  return stops ? (CountTrailingZeros64(stops) >> 3) + 1 : 0;
+}
+
+// Reads a LEB128 varint, where high bits indicate continuation.  Used by both
+// the DWARF and WebAssembly readers.  If |is_signed| and the encoding ends
+// below bit |bits|, the value is sign-extended from its last encoded bit.
+// |what| names the kind of data being read (like "DWARF") for the error
+// thrown on an unterminated varint.
+//
+// This is inline so that |data| stays in registers in the readers' loops: the
+// position of each varint depends on the length of the one before it, so any
+// latency here is paid once per varint.
+inline uint64_t ReadLEB128Internal(bool is_signed, int bits,
+                                   absl::string_view* data, const char* what) {
+  // Single-byte varints are by far the most common, so check for them first.
+  if (!data->empty() && (data->front() & 0x80) == 0) {
+    uint64_t ret = static_cast<uint8_t>(data->front());
+    data->remove_prefix(1);
+    if (is_signed && 7 < bits && (ret & 0x40)) {
+      ret |= -(1ULL << 7);
+    }
+    return ret;
+  }
+
+  if (data->size() >= 8) {
+    // Decode up to eight bytes at once: drop the bytes past the terminator and
+    // the continuation bits, then pack the 7-bit groups together pairwise.
+    uint64_t word = LoadLEB128Word(*data);
+    int len = LEB128WordLength(word);
+    if (len > 0) {
+      uint64_t ret = len < 8 ? word & ((1ULL << (8 * len)) - 1) : word;
+      ret &= ~kLEB128ContinuationBits;
+      ret = ((ret & 0x7f007f007f007f00ULL) >> 1) |
+            (ret & 0x007f007f007f007fULL);
+      ret = ((ret & 0x3fff00003fff0000ULL) >> 2) |
+            (ret & 0x00003fff00003fffULL);
+      ret = ((ret & 0x0fffffff00000000ULL) >> 4) |
+            (ret & 0x000000000fffffffULL);
+      int shift = 7 * len;
+      if (is_signed && shift < bits && ((word >> (8 * len - 2)) & 1)) {
+        ret |= -(1ULL << shift);
+      }
+      data->remove_prefix(len);
+      return ret;
+    }
+  }
+
+  return ReadLongLEB128(is_signed, bits, data, what);
+}
+
+// Skips over a LEB128 varint without decoding it.
+void SkipLEB128(absl::string_view* data, const char* what);
+
 // General data reading  ///////////////////////////////////////////////////////
 
 absl::string_view ReadUntil(absl::string_view* data, char c);
@@ -16,6 +16,7 @@
 #include "source_map.h"
 #include "util.h"
 
+#include "absl/strings/match.h"
 #include "absl/strings/substitute.h"
 
 using absl::string_view;
@@ -23,47 +24,24 @@ using absl::string_view;
 namespace bloaty {
 namespace wasm {
 
-uint64_t ReadLEB128Internal(bool is_signed, size_t size, string_view* data) {
-  uint64_t ret = 0;
-  int shift = 0;
-  int maxshift = 70;
-  const char* ptr = data->data();
-  const char* limit = ptr + data->size();
-
-  while (ptr < limit && shift < maxshift) {
-    char byte = *(ptr++);
-    ret |= static_cast<uint64_t>(byte & 0x7f) << shift;
-    shift += 7;
-    if ((byte & 0x80) == 0) {
-      data->remove_prefix(ptr - data->data());
-      if (is_signed && shift < size && (byte & 0x40)) {
-        ret |= -(1ULL << shift);
-      }
-      return ret;
-    }
-  }
-
-  THROW("corrupt wasm data, unterminated LEB128");
-}
-
 bool ReadVarUInt1(string_view* data) {
-  return static_cast<bool>(ReadLEB128Internal(false, 1, data));
+  return static_cast<bool>(ReadLEB128Internal(false, 1, data, "wasm"));
 }
 
 uint8_t ReadVarUInt7(string_view* data) {
-  return static_cast<char>(ReadLEB128Internal(false, 7, data));
+  return static_cast<char>(ReadLEB128Internal(false, 7, data, "wasm"));
 }
 
 uint32_t ReadVarUInt32(string_view* data) {
-  return static_cast<uint32_t>(ReadLEB128Internal(false, 32, data));
+  return static_cast<uint32_t>(ReadLEB128Internal(false, 32, data, "wasm"));
 }
 
 uint64_t ReadVarUInt64(string_view* data) {
-  return static_cast<uint64_t>(ReadLEB128Internal(false, 64, data));
+  return static_cast<uint64_t>(ReadLEB128Internal(false, 64, data, "wasm"));
 }
 
 int8_t ReadVarint7(string_view* data) {
-  return static_cast<int8_t>(ReadLEB128Internal(true, 7, data));
+  return static_cast<int8_t>(ReadLEB128Internal(true, 7, data, "wasm"));
 }
 
 string_view ReadPiece(size_t bytes, string_view* data) {
@@ -411,6 +389,54 @@ void ParseSymbols(RangeSink* sink) {
                  });
 }
 
+// Emscripten and wasi-sdk can put DWARF in custom sections named like
+// ".debug_info".  Its addresses are offsets into the contents of the Code
+// section.
+void ReadDWARFSections(const InputFile& file, dwarf::File* dwarf,
+                       RangeSink* /*sink*/) {
+  dwarf->file = &file;
+  dwarf->open = &ReadDWARFSections;
+  ForEachSection(file.data(), [dwarf](const Section& section) {
+    string_view name = section.name;
+    if (section.id == 0 && absl::ConsumePrefix(&name, ".debug_")) {
+      dwarf->SetFieldByName(name, section.contents);
+    }
+  });
+}
+
+bool HasDWARF(const InputFile& file) {
+  bool ret = false;
+  FindSection(file.data(), ".debug_info",
+              [&ret](const Section& /*section*/) { ret = true; });
+  return ret;
+}
+
+// Returns the file offset that DWARF addresses are relative to, and adds the
+// range of each function to |sizes|, with those same addresses.
+uint64_t ReadCodeSectionForDWARF(const InputFile& file, SymbolSizes* sizes) {
+  uint64_t code_offset = 0;
+  bool found = false;
+  FindSection(file.data(), Section::names[Section::kCode],
+              [&](const Section& section) {
+                found = true;
+                code_offset = section.contents.data() - file.data().data();
+                string_view data = section.contents;
+                uint32_t count = ReadVarUInt32(&data);
+                for (uint32_t i = 0; i < count; i++) {
+                  string_view func = data;
+                  uint32_t size = ReadVarUInt32(&data);
+                  data = StrictSubstr(data, size);
+                  sizes->Add(func.data() - section.contents.data(),
+                             data.data() - func.data());
+                }
+              });
+  if (!found) {
+    THROW("DWARF debug info requires a Code section");
+  }
+  sizes->Sort();
+  return code_offset;
+}
+
 void AddWebAssemblyFallback(RangeSink* sink) {
   ForEachSection(sink->input_file().data(), [sink](const Section& section) {
     std::string name2 =
@@ -452,6 +478,7 @@ class WebAssemblyObjectFile : public ObjectFile {
         case DataSource::kSymbols:
         case DataSource::kRawSymbols:
         case DataSource::kShortSymbols:
+        case DataSource::kTemplates:
         case DataSource::kFullSymbols:
           ParseSymbols(sink);
           break;
@@ -461,8 +488,10 @@ class WebAssemblyObjectFile : public ObjectFile {
                 dynamic_cast<const sourcemap::SourceMapObjectFile*>(
                   &debug_file())) {
             source_map->ProcessFileToSink(sink);
+          } else if (HasDWARF(debug_file().file_data())) {
+            ProcessDWARF(sink);
           } else {
-            THROW("Data source requires a source map");
+            THROW("Data source requires a source map or DWARF debug info");
           }
           break;
         case DataSource::kArchiveMembers:
@@ -473,12 +502,35 @@ class WebAssemblyObjectFile : public ObjectFile {
     }
   }
 
+  // The DWARF comes from the debug file, but its addresses refer to the Code
+  // section of this one.
+  void ProcessDWARF(RangeSink* sink) const {
+    SymbolSizes symbol_sizes;
+    uint64_t code_offset =
+        ReadCodeSectionForDWARF(sink->input_file(), &symbol_sizes);
+    dwarf::File dwarf;
+    ReadDWARFSections(debug_file().file_data(), &dwarf, sink);
+    sink->MapVMAddressesToFileOffset(code_offset);
+    if (sink->data_source() == DataSource::kCompileUnits) {
+      ReadDWARFCompileUnits(dwarf, symbol_sizes, sink);
+    } else {
+      ReadDWARFInlines(dwarf, sink, true);
+    }
+  }
+
   bool GetDisassemblyInfo(absl::string_view /*symbol*/,
                           DataSource /*symbol_source*/,
                           DisassemblyInfo* /*info*/) const override {
     WARN("WebAssembly files do not support disassembly yet");
     return false;
   }
+
+  bool GetDisassemblyBatch(const ReImpl& /*regex*/,
+                           DataSource /*symbol_source*/,
+                           DisassemblyBatch* /*batch*/) const override {
+    WARN("WebAssembly files do not support disassembly yet");
+    return false;
+  }
 };
 
 }  // namespace wasm
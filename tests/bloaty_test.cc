@@ -168,6 +168,95 @@ TEST_F(BloatyTest, SimpleArchiveFile) {
   });
 }
 
+TEST_F(BloatyTest, BSDArchiveFile) {
+  // The same members as 03-simple.a, in a BSD archive.
+  RunBloaty({"bloaty", "-d", "armembers,symbols", "-n", "0", "03-simple.a"});
+  std::vector<std::tuple<std::string, int, int>> gnu_members;
+  for (const auto& row : top_row_->sorted_children) {
+    if (row.name[0] != '[') {
+      gnu_members.push_back(
+          std::make_tuple(row.name, row.size.vm, row.size.file));
+    }
+  }
+
+  RunBloaty({"bloaty", "-d", "armembers,symbols", "-n", "0", "08-bsd.a"});
+  std::vector<std::tuple<std::string, int, int>> bsd_members;
+  for (const auto& row : top_row_->sorted_children) {
+    if (row.name[0] != '[') {
+      bsd_members.push_back(
+          std::make_tuple(row.name, row.size.vm, row.size.file));
+    }
+  }
+  EXPECT_EQ(3, bsd_members.size());
+  EXPECT_EQ(gnu_members, bsd_members);
+  EXPECT_TRUE(FindRow("[AR Symbol Table]") != nullptr);
+}
+
+TEST_F(BloatyTest, ThinArchiveFile) {
+  // The members are separate files, which are scanned too.
+  uint64_t size, empty_size, simple_size;
+  ASSERT_TRUE(GetFileSize("09-thin.a", &size));
+  ASSERT_TRUE(GetFileSize("01-empty.o", &empty_size));
+  ASSERT_TRUE(GetFileSize("02-simple.o", &simple_size));
+
+  RunBloaty({"bloaty", "-d", "armembers", "09-thin.a"});
+  EXPECT_EQ(size + empty_size + simple_size, top_row_->size.file);
+  auto row = FindRow("02-simple.o");
+  ASSERT_TRUE(row != nullptr);
+  EXPECT_EQ(simple_size, row->size.file);
+  EXPECT_TRUE(FindRow("01-empty.o") != nullptr);
+
+  RunBloaty({"bloaty", "-d", "symbols", "-n", "0", "09-thin.a"});
+  EXPECT_TRUE(FindRow("func1") != nullptr);
+  EXPECT_TRUE(FindRow("data_a") != nullptr);
+}
+
+TEST_F(BloatyTest, ArchiveSourceFilter) {
+  auto has_skipped_members = [this]() {
+    for (const auto& row : top_row_->sorted_children) {
+      if (row.name == "[AR Skipped Member]") {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Only bar.o defines a matching symbol, so the other members aren't parsed.
+  RunBloaty({"bloaty", "-d", "symbols", "--source-filter", "bar_|Skipped",
+             "08-bsd.a"});
+  AssertChildren(*top_row_, {
+    std::make_tuple("bar_x", 4000, 4000),
+    std::make_tuple("bar_func", kUnknown, kSameAsVM),
+    std::make_tuple("bar_y", 4, 4),
+    std::make_tuple("bar_z", 4, 0),
+  });
+  ASSERT_TRUE(has_skipped_members());
+  auto row = FindRow("[AR Skipped Member]");
+  EXPECT_EQ(0, row->size.vm);
+  EXPECT_GT(row->size.file, 0);
+
+  // Without the filter, every member is parsed.
+  RunBloaty({"bloaty", "-d", "symbols", "08-bsd.a"});
+  EXPECT_FALSE(has_skipped_members());
+
+  // Other data sources can't be checked against the symbol table.
+  RunBloaty({"bloaty", "-d", "sections,symbols", "--source-filter",
+             "bar_|Skipped", "08-bsd.a"});
+  EXPECT_FALSE(has_skipped_members());
+
+  // In a thin archive, 01-empty.o isn't even opened.
+  uint64_t size, simple_size;
+  ASSERT_TRUE(GetFileSize("09-thin.a", &size));
+  ASSERT_TRUE(GetFileSize("02-simple.o", &simple_size));
+  RunBloaty({"bloaty", "-d", "symbols", "--source-filter", "func1",
+             "09-thin.a"});
+  AssertChildren(*top_row_, {
+    std::make_tuple("func1", kUnknown, kSameAsVM),
+  });
+  EXPECT_EQ(size + simple_size,
+            top_row_->size.file + top_row_->filtered_size.file);
+}
+
 TEST_F(BloatyTest, SimpleSharedObjectFile) {
   std::string file = "04-simple.so";
   uint64_t size;
@@ -286,6 +375,431 @@ TEST_F(BloatyTest, DiffMode) {
   });
 }
 
+TEST_F(BloatyTest, MaxMemory) {
+  std::vector<std::string> args = {"bloaty", "-d", "compileunits,symbols",
+                                   "04-simple.so", "05-binary.bin",
+                                   "07-binary-stripped.bin",
+                                   "--debug-file=05-binary.bin"};
+  RunBloaty(args);
+  uint64_t vmsize = top_row_->size.vm;
+  uint64_t filesize = top_row_->size.file;
+
+  // A budget smaller than any file admits one file at a time, which must not
+  // change the result.
+  args.push_back("--max-memory=1");
+  RunBloaty(args);
+  EXPECT_EQ(vmsize, top_row_->size.vm);
+  EXPECT_EQ(filesize, top_row_->size.file);
+}
+
+// Prints the current report in both the pretty and the CSV format.
+static std::string PrintReport(bloaty::RollupOutput* output) {
+  std::ostringstream report;
+  bloaty::OutputOptions options;
+  output->Print(options, &report);
+  options.output_format = bloaty::OutputFormat::kCSV;
+  output->Print(options, &report);
+  return report.str();
+}
+
+TEST_F(BloatyTest, ShardAndMerge) {
+  std::vector<std::string> files = {"02-simple.o", "03-simple.a",
+                                    "04-simple.so", "05-binary.bin",
+                                    "06-diff.a"};
+  std::vector<std::string> args = {"bloaty", "-d", "sections,symbols", "-n",
+                                   "5"};
+  args.insert(args.end(), files.begin(), files.end());
+  RunBloaty(args);
+  std::string expected = PrintReport(output_.get());
+
+  // Three shards, so that the shards get different numbers of files.
+  std::vector<std::string> merge = {"bloaty", "-n", "5", "--merge"};
+  for (int i = 0; i < 3; i++) {
+    std::string partial =
+        ::testing::TempDir() + "shard" + std::to_string(i) + ".partial";
+    std::vector<std::string> shard_args = args;
+    shard_args.push_back("--shard=" + std::to_string(i) + "/3");
+    shard_args.push_back("--write-partial=" + partial);
+    RunBloaty(shard_args);
+    merge.push_back(partial);
+  }
+
+  RunBloaty(merge);
+  EXPECT_EQ(expected, PrintReport(output_.get()));
+
+  // Merging partials in two steps gives the same result.
+  std::string combined = ::testing::TempDir() + "combined.partial";
+  RunBloaty({"bloaty", "--merge", merge[4], merge[5],
+             "--write-partial=" + combined});
+  RunBloaty({"bloaty", "-n", "5", "--merge", merge[6], combined});
+  EXPECT_EQ(expected, PrintReport(output_.get()));
+
+  // The data sources are taken from the partials and can't be changed.
+  AssertBloatyFails({"bloaty", "-d", "symbols", "--merge", merge[4]},
+                    "data sources don't match");
+}
+
+TEST_F(BloatyTest, ShardAndMergeDiff) {
+  std::vector<std::string> args = {"bloaty", "-d", "sections,symbols",
+                                   "06-diff.a", "05-binary.bin", "--",
+                                   "03-simple.a", "07-binary-stripped.bin"};
+  RunBloaty(args);
+  std::string expected = PrintReport(output_.get());
+
+  std::vector<std::string> merge = {"bloaty", "--merge"};
+  for (int i = 0; i < 2; i++) {
+    std::string partial =
+        ::testing::TempDir() + "diff" + std::to_string(i) + ".partial";
+    std::vector<std::string> shard_args = args;
+    shard_args.push_back("--shard=" + std::to_string(i) + "/2");
+    shard_args.push_back("--write-partial=" + partial);
+    RunBloaty(shard_args);
+    merge.push_back(partial);
+  }
+
+  RunBloaty(merge);
+  EXPECT_TRUE(output_->diff_mode());
+  EXPECT_EQ(expected, PrintReport(output_.get()));
+}
+
+// Returns the name of the child of |row| that the code of |name| is listed
+// under.  Its symbol table entry and unwind info are listed under [Unmapped]
+// and [not code] too.
+static std::string FindGroup(const bloaty::RollupRow& row,
+                             const std::string& name) {
+  for (const auto& group : row.sorted_children) {
+    if (group.name == "[Unmapped]" || group.name == "[not code]") {
+      continue;
+    }
+    for (const auto& child : group.sorted_children) {
+      if (child.name == name) {
+        return group.name;
+      }
+    }
+  }
+  return "";
+}
+
+TEST_F(BloatyTest, IdenticalCode) {
+  // Under another name, a copy of the binary has a copy of every function.
+  std::string copy = ::testing::TempDir() + "05-binary-copy.bin";
+  {
+    std::ifstream in("05-binary.bin", std::ios::binary);
+    std::ofstream out(copy, std::ios::binary);
+    out << in.rdbuf();
+  }
+
+  std::vector<std::string> args = {"bloaty", "-d", "icf,symbols", "-n", "0",
+                                   "05-binary.bin", copy};
+  RunBloaty(args);
+  bool found_copies = false;
+  for (const auto& row : top_row_->sorted_children) {
+    EXPECT_NE("[unique code]", row.name);
+    if (row.name.rfind("[2 copies", 0) == 0) {
+      found_copies = true;
+      // The symbols of both copies have the same names.
+      EXPECT_EQ(1, row.sorted_children.size());
+    }
+  }
+  EXPECT_TRUE(found_copies);
+  std::string expected = PrintReport(output_.get());
+
+  // Copies are found across shards too.
+  std::vector<std::string> merge = {"bloaty", "-n", "0", "--merge"};
+  for (int i = 0; i < 2; i++) {
+    std::string partial =
+        ::testing::TempDir() + "icf" + std::to_string(i) + ".partial";
+    std::vector<std::string> shard_args = args;
+    shard_args.push_back("--shard=" + std::to_string(i) + "/2");
+    shard_args.push_back("--write-partial=" + partial);
+    RunBloaty(shard_args);
+    merge.push_back(partial);
+  }
+  RunBloaty(merge);
+  EXPECT_EQ(expected, PrintReport(output_.get()));
+
+  // twice_a, twice_b and twice_c are copies at different addresses, so their
+  // calls to helper have different displacements.  twice_d calls helper2, a
+  // copy of helper, and twice_diff has different code.
+  args = {"bloaty", "-d", "icf,symbols", "-n", "0", "10-identical.bin"};
+  RunBloaty(args);
+  std::string group = FindGroup(*top_row_, "twice_a");
+  EXPECT_EQ(0, group.rfind("[3 copies", 0)) << group;
+  EXPECT_EQ(group, FindGroup(*top_row_, "twice_b"));
+  EXPECT_EQ(group, FindGroup(*top_row_, "twice_c"));
+  EXPECT_EQ("[unique code]", FindGroup(*top_row_, "twice_d"));
+  EXPECT_EQ("[unique code]", FindGroup(*top_row_, "twice_diff"));
+
+  // Ignoring the addresses that functions refer to, twice_d is a copy too.
+  args.push_back("--icf-ignore-addresses");
+  RunBloaty(args);
+  group = FindGroup(*top_row_, "twice_a");
+  EXPECT_EQ(0, group.rfind("[4 copies", 0)) << group;
+  EXPECT_EQ(group, FindGroup(*top_row_, "twice_d"));
+  EXPECT_EQ("[unique code]", FindGroup(*top_row_, "twice_diff"));
+}
+
+TEST_F(BloatyTest, IdenticalCodeSourceFilter) {
+  // --source-filter matches the grouped labels.
+  std::vector<std::string> args = {"bloaty", "-d", "icf", "-n", "0",
+                                   "--source-filter=copies",
+                                   "10-identical.bin"};
+  RunBloaty(args);
+  ASSERT_EQ(2, top_row_->sorted_children.size());
+  for (const auto& row : top_row_->sorted_children) {
+    EXPECT_NE(std::string::npos, row.name.find(" copies: ")) << row.name;
+  }
+  EXPECT_GT(top_row_->filtered_size.vm, 0);
+  std::string expected = PrintReport(output_.get());
+
+  // Not what they are grouped by, like the name of the file.
+  RunBloaty({"bloaty", "-d", "icf", "--source-filter=10-identical",
+             "10-identical.bin"});
+  EXPECT_EQ(0, top_row_->sorted_children.size());
+
+  // The labels of other sources still match.
+  RunBloaty({"bloaty", "-d", "icf,symbols", "--source-filter=^twice_b$",
+             "10-identical.bin"});
+  EXPECT_EQ(0, FindGroup(*top_row_, "twice_b").rfind("[3 copies", 0));
+  EXPECT_EQ("", FindGroup(*top_row_, "twice_a"));
+
+  // Partials are grouped by --merge, which applies the filter.
+  std::string partial = ::testing::TempDir() + "icf-filter.partial";
+  args.push_back("--write-partial=" + partial);
+  AssertBloatyFails(args,
+                    "--source-filter can't be used with --write-partial and "
+                    "the icf source; pass it to --merge instead");
+  RunBloaty({"bloaty", "-d", "icf", "--write-partial=" + partial,
+             "10-identical.bin"});
+  RunBloaty({"bloaty", "-n", "0", "--merge", "--source-filter=copies",
+             partial});
+  EXPECT_EQ(expected, PrintReport(output_.get()));
+}
+
+TEST_F(BloatyTest, Dominators) {
+  RunBloaty({"bloaty", "-d", "dominators,symbols", "-n", "0", "05-binary.bin"});
+  bool found_symbol = false;
+  for (const auto& row : top_row_->sorted_children) {
+    if (row.name[0] == '[') {
+      continue;
+    }
+    // Every row is named after a symbol that dominates itself.  A lone
+    // child with the row's name isn't listed.
+    found_symbol = true;
+    bool found_self = row.sorted_children.empty();
+    for (const auto& child : row.sorted_children) {
+      found_self |= child.name == row.name;
+    }
+    EXPECT_TRUE(found_self) << row.name;
+  }
+  EXPECT_TRUE(found_symbol);
+
+  // Object files aren't linked yet, so they have no symbols here.
+  RunBloaty({"bloaty", "-d", "dominators", "02-simple.o"});
+  for (const auto& row : top_row_->sorted_children) {
+    EXPECT_EQ('[', row.name[0]) << row.name;
+  }
+}
+
+TEST_F(BloatyTest, DisassembleRegex) {
+  std::vector<std::string> args = {"bloaty", "--disassemble-regex=_func$",
+                                   "05-binary.bin"};
+  RunBloaty(args);
+  std::string disassembly(output_->GetDisassembly());
+
+  // Each matching function is listed once, under its name, in address order.
+  size_t foo = disassembly.find("foo_func:\n");
+  size_t bar = disassembly.find("bar_func:\n");
+  ASSERT_NE(std::string::npos, foo);
+  ASSERT_NE(std::string::npos, bar);
+  EXPECT_LT(foo, bar);
+  EXPECT_EQ(std::string::npos, disassembly.find("foo_func:\n", foo + 1));
+  EXPECT_EQ(std::string::npos, disassembly.find("main:\n"));
+
+  // The functions are disassembled in parallel, but the output doesn't
+  // depend on the number of threads.
+  for (const char* threads : {"--threads=1", "--threads=4"}) {
+    std::vector<std::string> threaded_args = args;
+    threaded_args.push_back(threads);
+    RunBloaty(threaded_args);
+    EXPECT_EQ(disassembly, output_->GetDisassembly()) << threads;
+  }
+
+  AssertBloatyFails({"bloaty", "--disassemble-regex=^no_such_function$",
+                     "05-binary.bin"}, "Couldn't find any functions");
+  AssertBloatyFails({"bloaty", "--disassemble-regex=(", "05-binary.bin"},
+                    "invalid regex");
+}
+
+TEST_F(BloatyTest, BadShard) {
+  AssertBloatyFails({"bloaty", "--shard=2/2", "05-binary.bin"}, "shard");
+  AssertBloatyFails({"bloaty", "--shard=1", "05-binary.bin"}, "shard");
+  AssertBloatyFails({"bloaty", "--shard=0/0", "05-binary.bin"}, "shard");
+}
+
+// Writes a profile with samples in foo_func and bar_func of both the x86-64
+// and the x86 build of 05-binary.bin.  In each binary the other build's
+// addresses are unmapped, so they are ignored, as is address 0.
+static std::string WriteTestProfile() {
+  std::string profile = ::testing::TempDir() + "05-binary.profile";
+  std::ofstream out(profile);
+  out << "# sampled PCs\n"
+      << "4004f0 10\n0x80483f0 10\n"
+      << "400512\n400513 2\n8048420 3\n"
+      << "\n0 7\n";
+  return profile;
+}
+
+TEST_F(BloatyTest, Profile) {
+  std::string profile = WriteTestProfile();
+
+  RunBloaty({"bloaty", "-d", "symbols", "-s", "samples",
+             "--profile=" + profile, "05-binary.bin"});
+  EXPECT_EQ(13, top_row_->samples);
+  ASSERT_GE(top_row_->sorted_children.size(), 2);
+  EXPECT_EQ("foo_func", top_row_->sorted_children[0].name);
+  EXPECT_EQ(10, top_row_->sorted_children[0].samples);
+  EXPECT_EQ("bar_func", top_row_->sorted_children[1].name);
+  EXPECT_EQ(3, top_row_->sorted_children[1].samples);
+
+  AssertBloatyFails({"bloaty", "--profile=" + profile, "05-binary.bin", "--",
+                     "05-binary.bin"}, "diff mode");
+  AssertBloatyFails({"bloaty", "--profile=" + profile, "05-binary.bin",
+                     "07-binary-stripped.bin"}, "more than one input file");
+  AssertBloatyFails({"bloaty", "-s", "samples", "05-binary.bin"}, "profile");
+  std::remove(profile.c_str());
+}
+
+TEST_F(BloatyTest, SymbolOrdering) {
+  std::string profile = WriteTestProfile();
+  std::string ordering = ::testing::TempDir() + "05-binary.order";
+
+  RunBloaty({"bloaty", "--symbol-ordering-file=" + ordering,
+             "--profile=" + profile, "05-binary.bin"});
+  std::ifstream in(ordering);
+  std::vector<std::string> names;
+  std::string name;
+  while (std::getline(in, name)) {
+    names.push_back(name);
+  }
+
+  // The sampled functions come first, the hottest one first, and every
+  // function is listed once.
+  ASSERT_GE(names.size(), 2);
+  EXPECT_EQ("foo_func", names[0]);
+  EXPECT_EQ("bar_func", names[1]);
+  std::vector<std::string> sorted(names);
+  std::sort(sorted.begin(), sorted.end());
+  EXPECT_TRUE(std::adjacent_find(sorted.begin(), sorted.end()) ==
+              sorted.end());
+  EXPECT_TRUE(absl::StrContains(output_->GetSummary(), "Hot .text pages"));
+
+  AssertBloatyFails({"bloaty", "--symbol-ordering-file=" + ordering,
+                     "05-binary.bin", "--", "05-binary.bin"}, "diff mode");
+  AssertBloatyFails({"bloaty", "--symbol-ordering-file=" + ordering, "-d",
+                     "symbols", "05-binary.bin"}, "data sources");
+  AssertBloatyFails({"bloaty", "--symbol-ordering-file=" + ordering,
+                     "02-simple.o"}, "only ELF binaries");
+  std::remove(profile.c_str());
+  std::remove(ordering.c_str());
+}
+
+TEST_F(BloatyTest, Pages) {
+  for (int page_size : {4096, 2 * 1024 * 1024}) {
+    RunBloaty({"bloaty", "-d", "pages", "-n", "0",
+               "--page-size=" + std::to_string(page_size), "05-binary.bin"});
+    for (const auto& child : top_row_->sorted_children) {
+      if (child.name == "[Unmapped]") {
+        EXPECT_EQ(0, child.size.vm);
+      } else {
+        EXPECT_TRUE(absl::StartsWith(child.name, "page 0x")) << child.name;
+        EXPECT_LE(child.size.vm, page_size);
+      }
+    }
+  }
+
+  AssertBloatyFails({"bloaty", "-d", "pages", "--page-size=1000",
+                     "05-binary.bin"}, "power of two");
+
+  // With a profile, each function's code is on a touched page, while the big
+  // arrays are only on pages that the profile never touches.  (The symbols'
+  // file-only bytes, like their names, are [Unmapped].)
+  std::string profile = WriteTestProfile();
+  RunBloaty({"bloaty", "-d", "symbols,pages", "--profile=" + profile,
+             "05-binary.bin"});
+  auto row = FindRow("foo_func");
+  ASSERT_TRUE(row != nullptr);
+  for (const auto& child : row->sorted_children) {
+    if (child.size.vm > 0) {
+      EXPECT_TRUE(absl::StartsWith(child.name, "page 0x")) << child.name;
+    }
+  }
+  row = FindRow("bar_x");
+  ASSERT_TRUE(row != nullptr);
+  for (const auto& child : row->sorted_children) {
+    if (child.size.vm > 0) {
+      EXPECT_EQ("[untouched pages]", child.name);
+    }
+  }
+  std::remove(profile.c_str());
+}
+
+TEST_F(BloatyTest, Relocs) {
+  // The test binary is linked without PIE, so only its GOT entries are
+  // relocated at load time.
+  RunBloaty({"bloaty", "-d", "sections", "-s", "relocs", "--relocs",
+             "05-binary.bin"});
+  EXPECT_EQ(3, top_row_->relocs);
+  ASSERT_GE(top_row_->sorted_children.size(), 2);
+  EXPECT_EQ(".got.plt", top_row_->sorted_children[0].name);
+  EXPECT_EQ(2, top_row_->sorted_children[0].relocs);
+  EXPECT_EQ(".got", top_row_->sorted_children[1].name);
+  EXPECT_EQ(1, top_row_->sorted_children[1].relocs);
+
+  AssertBloatyFails({"bloaty", "-s", "relocs", "05-binary.bin"},
+                    "requires --relocs");
+}
+
+TEST_F(BloatyTest, CompressedSize) {
+  RunBloaty({"bloaty", "-d", "sections", "-s", "compressed", "--compressed",
+             "-n", "0", "05-binary.bin"});
+  int64_t total = top_row_->compressed;
+  EXPECT_GT(total, 0);
+  EXPECT_LT(total, top_row_->size.file);
+  int64_t last = INT64_MAX;
+  for (const auto& row : top_row_->sorted_children) {
+    EXPECT_LE(row.compressed, last) << row.name;
+    last = row.compressed;
+    // Only loaded bytes are compressed.
+    if (row.size.vm == 0 || row.size.file == 0) {
+      EXPECT_EQ(0, row.compressed) << row.name;
+    }
+  }
+
+  // Smaller blocks compress worse.
+  RunBloaty({"bloaty", "-d", "sections", "--compressed",
+             "--compression-block-size=64", "05-binary.bin"});
+  EXPECT_GT(top_row_->compressed, total);
+
+  // A block size far larger than the file compresses each run of loaded
+  // ranges as a single block.
+  RunBloaty({"bloaty", "-d", "sections", "--compressed",
+             "--compression-block-size=1048576", "05-binary.bin"});
+  int64_t whole = top_row_->compressed;
+  RunBloaty({"bloaty", "-d", "sections", "--compressed",
+             "--compression-block-size=4294967295", "05-binary.bin"});
+  EXPECT_EQ(whole, top_row_->compressed);
+
+  AssertBloatyFails({"bloaty", "-s", "compressed", "05-binary.bin"},
+                    "requires --compressed");
+  AssertBloatyFails({"bloaty", "--compressed", "--compression-block-size=0",
+                     "05-binary.bin"},
+                    "block size");
+  AssertBloatyFails({"bloaty", "--compressed", "05-binary.bin", "--",
+                     "07-binary-stripped.bin"},
+                    "diff mode");
+}
+
 TEST_F(BloatyTest, SeparateDebug) {
   RunBloaty({"bloaty", "--debug-file=05-binary.bin", "07-binary-stripped.bin",
              "-d", "symbols"});
@@ -0,0 +1,139 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks that Bloaty's output doesn't depend on how its work is scheduled.
+// Every input is scanned with several thread counts and in several file
+// orders, and the raw maps and the report must come out byte-identical.
+// Since the first label added to a range wins, any parallel feature that
+// changes the order of the work must keep these tests passing.
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+struct ScanOutput {
+  std::string raw_map;
+  std::string report;
+};
+
+class DeterminismTest : public BloatyTest {
+ protected:
+  ScanOutput Scan(std::vector<std::string> args, int threads) {
+    args.push_back("--raw-map");
+    args.push_back("--threads=" + std::to_string(threads));
+
+    ScanOutput ret;
+    ::testing::internal::CaptureStdout();
+    bool ok = TryRunBloaty(args);
+    ret.raw_map = ::testing::internal::GetCapturedStdout();
+    EXPECT_TRUE(ok) << JoinStrings(args);
+    if (!ok) {
+      return ret;
+    }
+
+    std::ostringstream report;
+    bloaty::OutputOptions options;
+    output_->Print(options, &report);
+    options.output_format = bloaty::OutputFormat::kCSV;
+    output_->Print(options, &report);
+    ret.report = report.str();
+    return ret;
+  }
+
+  // Scans |files| in their given order and in a few shuffled orders, each
+  // with 1, 2, 8 and 64 threads.  The report must never change; the raw maps
+  // are printed per file in input order, so they must only be the same for
+  // the same order.
+  void CheckDeterministic(const std::vector<std::string>& sources,
+                          std::vector<std::string> files,
+                          const std::vector<std::string>& base_files = {}) {
+    std::mt19937 rng(0);
+    std::string expected_report;
+
+    for (int order = 0; order < 4; order++) {
+      if (order > 0) {
+        std::shuffle(files.begin(), files.end(), rng);
+      }
+
+      std::vector<std::string> args = {"bloaty", "-n", "0"};
+      for (const auto& source : sources) {
+        args.push_back("-d");
+        args.push_back(source);
+      }
+      args.insert(args.end(), files.begin(), files.end());
+      if (!base_files.empty()) {
+        args.push_back("--");
+        args.insert(args.end(), base_files.begin(), base_files.end());
+      }
+
+      std::string expected_raw_map;
+      for (int threads : {1, 2, 8, 64}) {
+        SCOPED_TRACE(JoinStrings(args) + " --threads=" +
+                     std::to_string(threads));
+        ScanOutput output = Scan(args, threads);
+        ASSERT_NE("", output.raw_map);
+        ASSERT_NE("", output.report);
+        if (expected_report.empty()) {
+          expected_report = output.report;
+        }
+        if (threads == 1) {
+          expected_raw_map = output.raw_map;
+        }
+        EXPECT_EQ(expected_report, output.report);
+        EXPECT_EQ(expected_raw_map, output.raw_map);
+      }
+    }
+  }
+
+  const std::vector<std::string> kAllFiles = {
+      "01-empty.o",   "02-simple.o",  "03-simple.a",
+      "04-simple.so", "05-binary.bin", "06-diff.a",
+      "07-binary-stripped.bin"};
+};
+
+TEST_F(DeterminismTest, Segments) {
+  CheckDeterministic({"segments"}, kAllFiles);
+}
+
+TEST_F(DeterminismTest, Sections) {
+  CheckDeterministic({"sections"}, kAllFiles);
+}
+
+TEST_F(DeterminismTest, Symbols) {
+  CheckDeterministic({"symbols"}, kAllFiles);
+}
+
+TEST_F(DeterminismTest, InputFilesAndSections) {
+  CheckDeterministic({"inputfiles,sections"}, kAllFiles);
+}
+
+TEST_F(DeterminismTest, ArchiveMembers) {
+  CheckDeterministic({"armembers,symbols"},
+                     {"03-simple.a", "06-diff.a", "05-binary.bin"});
+}
+
+TEST_F(DeterminismTest, CompileUnits) {
+  CheckDeterministic({"compileunits,symbols"},
+                     {"04-simple.so", "05-binary.bin"});
+}
+
+TEST_F(DeterminismTest, Diff) {
+  CheckDeterministic({"sections,symbols"},
+                     {"06-diff.a", "05-binary.bin"},
+                     {"03-simple.a", "07-binary-stripped.bin"});
+}
@@ -17,6 +17,8 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include <set>
+#include <thread>
 #include <tuple>
 
 namespace bloaty {
@@ -75,7 +77,7 @@ class RangeMapTest : public ::testing::Test {
       ASSERT_EQ(entry.addr, iter->first) << i;
       ASSERT_EQ(entry.end, map.RangeEnd(iter)) << i;
       ASSERT_EQ(entry.other_start, iter->second.other_start) << i;
-      ASSERT_EQ(entry.label, iter->second.label) << i;
+      ASSERT_EQ(entry.label, map.Label(iter->second)) << i;
     }
     ASSERT_EQ(i, entries.size());
     ASSERT_EQ(iter, map.mappings_.end());
@@ -95,6 +97,10 @@ class RangeMapTest : public ::testing::Test {
     ASSERT_EQ(entries.size(), i);
   }
 
+  static uint32_t InternedLabelAt(const RangeMap& map, uint64_t addr) {
+    return map.mappings_.find(addr)->second.label;
+  }
+
   void AssertMainMapEquals(const std::vector<Entry>& entries) {
     AssertMapEquals(map_, entries);
   }
@@ -366,9 +372,7 @@ TEST_F(RangeMapTest, Translation2) {
                                             &map3_));
   CheckConsistency();
   AssertMapEquals(map2_, {
-    {20, 25, kNoTranslation, "translate me"},
-    {25, 30, kNoTranslation, "translate me"},
-    {30, 35, kNoTranslation, "translate me"}
+    {20, 35, kNoTranslation, "translate me"}
   });
   AssertMapEquals(map3_, {
     {120, 125, kNoTranslation, "translate me"},
@@ -376,6 +380,43 @@ TEST_F(RangeMapTest, Translation2) {
   });
 }
 
+TEST_F(RangeMapTest, MergeAdjacent) {
+  map_.AddRange(10, 10, "foo");
+  map_.AddRange(20, 10, "foo");
+  map_.AddRange(30, 10, "bar");
+  map_.AddRange(5, 50, "foo");
+  CheckConsistency();
+  AssertMainMapEquals({
+    {5, 30, kNoTranslation, "foo"},
+    {30, 40, kNoTranslation, "bar"},
+    {40, 55, kNoTranslation, "foo"}
+  });
+
+  map2_.AddDualRange(0, 10, 100, "baz");
+  map2_.AddDualRange(10, 10, 110, "baz");
+  CheckConsistency();
+  AssertMapEquals(map2_, {
+    {0, 20, 100, "baz"},
+  });
+}
+
+TEST_F(RangeMapTest, RollupCoalescesIdenticalKeys) {
+  // "foo" is split in two entries because the translations are not
+  // contiguous, but the rollup should still report it as a single run.
+  map_.AddRange(0, 40, "base");
+  map2_.AddDualRange(0, 10, 100, "foo");
+  map2_.AddDualRange(10, 10, 500, "foo");
+  map2_.AddRange(20, 20, "bar");
+  map3_.AddRange(0, 15, "x");
+  map3_.AddRange(15, 25, "y");
+
+  AssertRollupEquals({&map_, &map2_, &map3_}, {
+    {{"base", "foo", "x"}, 0, 15},
+    {{"base", "foo", "y"}, 15, 20},
+    {{"base", "bar", "y"}, 20, 40},
+  });
+}
+
 TEST_F(RangeMapTest, UnknownTranslation) {
   map_.AddDualRange(20, 10, 120, "foo");
   CheckConsistency();
@@ -401,4 +442,74 @@ TEST_F(RangeMapTest, UnknownTranslation) {
   });
 }
 
+TEST_F(RangeMapTest, SharedLabelPool) {
+  auto labels = std::make_shared<LabelPool>();
+  RangeMap vm_map(labels);
+  RangeMap file_map(labels);
+  RangeMap translator;
+  translator.AddDualRange(0, 100, 1000, "section");
+
+  // Split by the existing range at 20, and translated into |file_map|.  Each
+  // label is only stored once.
+  std::string long_label(4096, 'x');
+  vm_map.AddRange(20, 10, "other");
+  vm_map.AddRangeWithTranslation(0, 50, long_label, translator, false,
+                                 &file_map);
+  vm_map.AddRangeWithTranslation(60, 10, long_label, translator, false,
+                                 &file_map);
+  EXPECT_EQ(2, labels->size());
+  EXPECT_EQ(InternedLabelAt(vm_map, 0), InternedLabelAt(file_map, 1000));
+
+  AssertMapEquals(vm_map, {
+    {0, 20, kNoTranslation, long_label},
+    {20, 30, kNoTranslation, "other"},
+    {30, 50, kNoTranslation, long_label},
+    {60, 70, kNoTranslation, long_label},
+  });
+  AssertMapEquals(file_map, {
+    {1000, 1050, kNoTranslation, long_label},
+    {1060, 1070, kNoTranslation, long_label},
+  });
+}
+
+TEST_F(RangeMapTest, LabelPoolConcurrentIntern) {
+  LabelPool labels;
+  const int kThreads = 8;
+  const int kLabels = 5000;
+
+  // Every thread interns the same labels, in a different order.
+  std::vector<std::vector<uint32_t>> ids(kThreads,
+                                         std::vector<uint32_t>(kLabels));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&labels, &ids, t]() {
+      for (int i = 0; i < kLabels; i++) {
+        int label = (i * 7 + t * 1000) % kLabels;
+        ids[t][label] = labels.Intern("label" + std::to_string(label));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(kLabels, labels.size());
+  std::set<uint32_t> distinct;
+  for (int i = 0; i < kLabels; i++) {
+    std::string label = "label" + std::to_string(i);
+    for (int t = 0; t < kThreads; t++) {
+      ASSERT_EQ(ids[0][i], ids[t][i]) << label;
+    }
+    ASSERT_EQ(label, labels.Get(ids[0][i]));
+    uint32_t found;
+    ASSERT_TRUE(labels.Find(label, &found));
+    ASSERT_EQ(ids[0][i], found);
+    distinct.insert(ids[0][i]);
+  }
+  EXPECT_EQ(kLabels, distinct.size());
+
+  uint32_t found;
+  EXPECT_FALSE(labels.Find("label" + std::to_string(kLabels), &found));
+}
+
 }  // namespace bloaty
@@ -0,0 +1,188 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reference_graph.h"
+
+#include <random>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace bloaty {
+
+using ::testing::ElementsAre;
+
+static const uint32_t kNone = ReferenceGraph::kNoNode;
+
+// Computes the dominators the slow way: D dominates N if N can't be reached
+// from the root once D is removed.
+static std::vector<uint32_t> SlowImmediateDominators(
+    const ReferenceGraph& graph, const std::vector<uint32_t>& roots) {
+  const uint32_t n = graph.node_count();
+
+  // Which nodes the root has edges to, as ComputeDominatorTree() adds them.
+  std::vector<bool> from_root(n, false);
+  std::vector<bool> seen(n, false);
+  auto reach = [&](uint32_t start, uint32_t removed, std::vector<bool>* seen) {
+    std::vector<uint32_t> stack;
+    if (start != removed && !(*seen)[start]) {
+      (*seen)[start] = true;
+      stack.push_back(start);
+    }
+    while (!stack.empty()) {
+      uint32_t node = stack.back();
+      stack.pop_back();
+      for (uint32_t next : graph.Successors(node)) {
+        if (next != removed && !(*seen)[next]) {
+          (*seen)[next] = true;
+          stack.push_back(next);
+        }
+      }
+    }
+  };
+  for (uint32_t root : roots) {
+    from_root[root] = true;
+    reach(root, kNone, &seen);
+  }
+  for (uint32_t node = 0; node < n; node++) {
+    if (!seen[node]) {
+      from_root[node] = true;
+      reach(node, kNone, &seen);
+    }
+  }
+
+  // dominated[d][v]: whether d dominates v.
+  std::vector<std::vector<bool>> dominated(n, std::vector<bool>(n));
+  for (uint32_t d = 0; d < n; d++) {
+    std::vector<bool> reached(n, false);
+    for (uint32_t node = 0; node < n; node++) {
+      if (from_root[node]) {
+        reach(node, d, &reached);
+      }
+    }
+    for (uint32_t v = 0; v < n; v++) {
+      dominated[d][v] = !reached[v];
+    }
+  }
+
+  // The immediate dominator is the strict dominator that all the others
+  // dominate.
+  std::vector<uint32_t> idom(n + 1, kNone);
+  for (uint32_t v = 0; v < n; v++) {
+    idom[v] = n;
+    for (uint32_t d = 0; d < n; d++) {
+      if (d != v && dominated[d][v] &&
+          (idom[v] == n || dominated[idom[v]][d])) {
+        idom[v] = d;
+      }
+    }
+  }
+  return idom;
+}
+
+static void CheckOrder(const DominatorTree& tree) {
+  std::vector<bool> seen(tree.idom.size(), false);
+  ASSERT_EQ(tree.idom.size(), tree.order.size());
+  ASSERT_EQ(tree.root, tree.order[0]);
+  for (uint32_t node : tree.order) {
+    if (node != tree.root) {
+      ASSERT_TRUE(seen[tree.idom[node]]) << node;
+    }
+    seen[node] = true;
+  }
+}
+
+TEST(ReferenceGraphTest, Edges) {
+  ReferenceGraph graph(4, {{0, 2}, {0, 1}, {2, 1}, {0, 2}, {3, 3}});
+  EXPECT_EQ(4, graph.node_count());
+  EXPECT_THAT(graph.Successors(0), ElementsAre(1, 2));
+  EXPECT_THAT(graph.Successors(1), ElementsAre());
+  EXPECT_THAT(graph.Successors(2), ElementsAre(1));
+  EXPECT_THAT(graph.Successors(3), ElementsAre(3));
+  EXPECT_THAT(graph.Predecessors(1), ElementsAre(0, 2));
+  EXPECT_THAT(graph.Predecessors(2), ElementsAre(0));
+  EXPECT_THAT(graph.Predecessors(3), ElementsAre(3));
+}
+
+TEST(ReferenceGraphTest, Dominators) {
+  // 0 -> 1 -> 2 -> 3, 1 -> 3, 0 -> 4 -> 3, and 5 <-> 6, which nothing else
+  // refers to.
+  ReferenceGraph graph(7, {{0, 1}, {1, 2}, {2, 3}, {1, 3}, {0, 4}, {4, 3},
+                           {5, 6}, {6, 5}});
+  DominatorTree tree = ComputeDominatorTree(graph, {0});
+  CheckOrder(tree);
+  EXPECT_EQ(7, tree.root);
+  EXPECT_THAT(tree.idom, ElementsAre(7, 0, 1, 0, 0, 7, 5, kNone));
+
+  // As a root, 3 is no longer dominated by 0.
+  tree = ComputeDominatorTree(graph, {0, 3});
+  EXPECT_THAT(tree.idom, ElementsAre(7, 0, 1, 7, 0, 7, 5, kNone));
+}
+
+TEST(ReferenceGraphTest, LongChain) {
+  // Deep enough that a recursive search would overflow the stack.
+  const uint32_t n = 1000000;
+  std::vector<std::pair<uint32_t, uint32_t>> edges;
+  for (uint32_t i = 0; i + 1 < n; i++) {
+    edges.push_back({i, i + 1});
+  }
+  ReferenceGraph graph(n, edges);
+  DominatorTree tree = ComputeDominatorTree(graph, {});
+  EXPECT_EQ(n, tree.idom[0]);
+  for (uint32_t i = 1; i < n; i++) {
+    ASSERT_EQ(i - 1, tree.idom[i]);
+  }
+}
+
+TEST(ReferenceGraphTest, RandomGraphs) {
+  std::mt19937 rng(0);
+  for (int i = 0; i < 200; i++) {
+    uint32_t n = 1 + rng() % 30;
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    uint32_t edge_count = rng() % (3 * n);
+    for (uint32_t j = 0; j < edge_count; j++) {
+      edges.push_back({rng() % n, rng() % n});
+    }
+    std::vector<uint32_t> roots;
+    for (uint32_t j = 0; j < n; j++) {
+      if (rng() % 8 == 0) {
+        roots.push_back(j);
+      }
+    }
+
+    ReferenceGraph graph(n, edges);
+    DominatorTree tree = ComputeDominatorTree(graph, roots);
+    CheckOrder(tree);
+    ASSERT_EQ(SlowImmediateDominators(graph, roots), tree.idom) << i;
+  }
+}
+
+TEST(ReferenceGraphTest, FindPossiblePointers) {
+  std::string data("\x01\x02\x03\x04\x05\x06\x07\x08\x00\x00\x00\x00", 12);
+  std::vector<uint64_t> refs;
+  // Starts 3 bytes before an aligned address.
+  FindPossiblePointers(data, 0x1001, 4, Endian::kLittle, &refs);
+  EXPECT_THAT(refs, ElementsAre(0x07060504, 0x08));
+
+  // The last word is zero, so it isn't a pointer.
+  refs.clear();
+  FindPossiblePointers(data, 0x1000, 4, Endian::kBig, &refs);
+  EXPECT_THAT(refs, ElementsAre(0x01020304, 0x05060708));
+
+  refs.clear();
+  FindPossiblePointers(data, 0x1000, 8, Endian::kLittle, &refs);
+  EXPECT_THAT(refs, ElementsAre(0x0807060504030201));
+}
+
+}  // namespace bloaty
@@ -0,0 +1,500 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks that the cost of the known hot paths grows near-linearly with input
+// size.  Each test generates the same kind of input at sizes N, 2N, 4N and 8N
+// and compares the time and the number of allocations it takes to process the
+// smallest and largest one.  The fuzzer only catches crashes; this catches
+// inputs that a change has made quadratic.
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+#include "third_party/darwin_xnu_macho/mach-o/loader.h"
+#include "third_party/freebsd_elf/elf.h"
+
+#include "bloaty.h"
+#include "bloaty.pb.h"
+#include "dwarf_constants.h"
+#include "util.h"
+
+using absl::string_view;
+using namespace dwarf2reader;
+
+static std::atomic<uint64_t> allocation_count{0};
+
+ABSL_ATTRIBUTE_NOINLINE void* operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  void* ret = malloc(size ? size : 1);
+  if (!ret) throw std::bad_alloc();
+  return ret;
+}
+
+ABSL_ATTRIBUTE_NOINLINE void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+
+namespace bloaty {
+
+// Linear growth would make the largest input 8x as expensive as the smallest.
+// Allocation counts are deterministic, so they get a tight bound; time gets
+// room for n log n behavior and scheduler noise.  A quadratic path is 64x.
+static const double kMaxAllocationRatio = 10;
+static const double kMaxTimeRatio = 24;
+static const int kRuns = 3;
+
+class StringInputFile : public InputFile {
+ public:
+  StringInputFile(string_view data) : InputFile("scaling_test_input") {
+    data_ = data;
+  }
+
+  bool TryOpen(absl::string_view /* filename */,
+               std::unique_ptr<InputFile>& file) override {
+    file.reset(new StringInputFile(data_));
+    return true;
+  }
+};
+
+// Opens |base| for "scaling_test_base" and |data| for any other name.
+class StringInputFileFactory : public InputFileFactory {
+ public:
+  StringInputFileFactory(string_view data, string_view base = string_view())
+      : data_(data), base_(base) {}
+
+ private:
+  string_view data_;
+  string_view base_;
+  std::unique_ptr<InputFile> OpenFile(
+      const std::string& filename) const override {
+    return std::unique_ptr<InputFile>(
+        new StringInputFile(filename == "scaling_test_base" ? base_ : data_));
+  }
+};
+
+struct Cost {
+  double seconds;
+  uint64_t allocations;
+};
+
+// Runs |func| kRuns times and returns its cheapest run.
+static Cost Measure(const std::function<void()>& func) {
+  Cost ret{1e9, UINT64_MAX};
+  for (int i = 0; i < kRuns; i++) {
+    uint64_t allocations = allocation_count.load();
+    auto start = std::chrono::steady_clock::now();
+    func();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    ret.seconds = std::min(ret.seconds, elapsed.count());
+    ret.allocations =
+        std::min(ret.allocations, allocation_count.load() - allocations);
+  }
+  return ret;
+}
+
+// Calls |func| with sizes n, 2n, 4n and 8n and checks that the largest is not
+// disproportionately more expensive than the smallest.
+static void ExpectLinear(int n, const std::function<void(int)>& func) {
+  std::vector<Cost> costs;
+  std::string report;
+  for (int size = n; size <= 8 * n; size *= 2) {
+    costs.push_back(Measure([&]() { func(size); }));
+    absl::StrAppend(&report, "  n=", size, ": ", costs.back().seconds * 1000,
+                    "ms, ", costs.back().allocations, " allocations\n");
+  }
+
+  double time_ratio = costs.back().seconds / costs.front().seconds;
+  double allocation_ratio = static_cast<double>(costs.back().allocations) /
+                            std::max<uint64_t>(costs.front().allocations, 1);
+  EXPECT_LE(time_ratio, kMaxTimeRatio) << report;
+  EXPECT_LE(allocation_ratio, kMaxAllocationRatio) << report;
+}
+
+static void RunBloaty(const std::string& data, const std::string& data_source,
+                      size_t min_rows) {
+  StringInputFileFactory factory(data);
+  RollupOutput output;
+  Options options;
+  std::string error;
+  options.add_data_source(data_source);
+  options.add_filename("scaling_test_input");
+  options.set_max_rows_per_level(INT64_MAX);
+  ASSERT_TRUE(BloatyMain(options, factory, &output, &error)) << error;
+  ASSERT_GE(output.toplevel_row().sorted_children.size(), min_rows);
+}
+
+// Diffs |data| against |base| with the default row limit, and checks that at
+// least |min_others| rows were folded into "[Others]".
+static void RunBloatyDiff(const std::string& data, const std::string& base,
+                          const std::string& data_source, int64_t min_others) {
+  StringInputFileFactory factory(data, base);
+  RollupOutput output;
+  Options options;
+  std::string error;
+  options.add_data_source(data_source);
+  options.add_filename("scaling_test_input");
+  options.add_base_filename("scaling_test_base");
+  ASSERT_TRUE(BloatyMain(options, factory, &output, &error)) << error;
+  int64_t others = 0;
+  for (const auto& row : output.toplevel_row().sorted_children) {
+    others += row.other_count;
+  }
+  ASSERT_GE(others, min_others);
+}
+
+template <class T>
+static void Append(const T& val, std::string* out) {
+  out->append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+static void AppendULEB128(uint64_t val, std::string* out) {
+  do {
+    uint8_t byte = val & 0x7f;
+    val >>= 7;
+    out->push_back(val ? byte | 0x80 : byte);
+  } while (val);
+}
+
+// ELF //////////////////////////////////////////////////////////////////////////
+
+class ElfBuilder {
+ public:
+  ElfBuilder() {
+    Elf64_Shdr null = {};
+    sections_.push_back({"", null, ""});
+  }
+
+  // Returns the new section's index.
+  int AddSection(std::string name, uint32_t type, uint64_t flags,
+                 uint64_t addr, std::string data, uint32_t link = 0,
+                 uint64_t entsize = 0) {
+    Elf64_Shdr header = {};
+    header.sh_type = type;
+    header.sh_flags = flags;
+    header.sh_addr = addr;
+    header.sh_link = link;
+    header.sh_entsize = entsize;
+    header.sh_addralign = 1;
+    sections_.push_back({std::move(name), header, std::move(data)});
+    return sections_.size() - 1;
+  }
+
+  std::string Build() {
+    std::string shstrtab(1, '\0');
+    for (auto& section : sections_) {
+      if (section.name.empty()) continue;
+      section.header.sh_name = shstrtab.size();
+      shstrtab += section.name + '\0';
+    }
+    Elf64_Shdr shstrtab_header = {};
+    shstrtab_header.sh_type = SHT_STRTAB;
+    shstrtab_header.sh_name = shstrtab.size();
+    shstrtab += std::string(".shstrtab") + '\0';
+    sections_.push_back({".shstrtab", shstrtab_header, shstrtab});
+
+    // Every SHF_ALLOC section gets its own PT_LOAD segment.
+    int load_count = 0;
+    for (const auto& section : sections_) {
+      if (section.header.sh_flags & SHF_ALLOC) load_count++;
+    }
+
+    std::string body;
+    std::string phdrs;
+    size_t data_start =
+        sizeof(Elf64_Ehdr) + load_count * sizeof(Elf64_Phdr);
+    for (auto& section : sections_) {
+      if (section.header.sh_type == SHT_NULL) continue;
+      section.header.sh_offset = data_start + body.size();
+      section.header.sh_size = section.data.size();
+      body += section.data;
+      if (section.header.sh_flags & SHF_ALLOC) {
+        Elf64_Phdr phdr = {};
+        phdr.p_type = PT_LOAD;
+        phdr.p_flags = PF_R | PF_X;
+        phdr.p_offset = section.header.sh_offset;
+        phdr.p_vaddr = section.header.sh_addr;
+        phdr.p_paddr = section.header.sh_addr;
+        phdr.p_filesz = section.header.sh_size;
+        phdr.p_memsz = section.header.sh_size;
+        phdr.p_align = 1;
+        Append(phdr, &phdrs);
+      }
+    }
+
+    Elf64_Ehdr ehdr = {};
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_phoff = load_count ? sizeof(Elf64_Ehdr) : 0;
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = load_count;
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = sections_.size();
+    ehdr.e_shstrndx = sections_.size() - 1;
+    ehdr.e_shoff = data_start + body.size();
+
+    std::string ret;
+    Append(ehdr, &ret);
+    ret += phdrs;
+    ret += body;
+    for (const auto& section : sections_) {
+      Append(section.header, &ret);
+    }
+    return ret;
+  }
+
+ private:
+  struct Section {
+    std::string name;
+    Elf64_Shdr header;
+    std::string data;
+  };
+  std::vector<Section> sections_;
+};
+
+static const uint64_t kTextAddr = 0x10000;
+
+// |n| function symbols, each of which overlaps the seven that follow it.
+static std::string MakeOverlappingSymbolsElf(int n) {
+  ElfBuilder elf;
+  int text = elf.AddSection(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                            kTextAddr, std::string(8 * n + 64, '\x90'));
+
+  std::string strtab(1, '\0');
+  std::string symtab;
+  Append(Elf64_Sym{}, &symtab);
+  for (int i = 0; i < n; i++) {
+    Elf64_Sym sym = {};
+    sym.st_name = strtab.size();
+    sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    sym.st_shndx = text;
+    sym.st_value = kTextAddr + 8 * i;
+    sym.st_size = 64;
+    Append(sym, &symtab);
+    strtab += absl::StrCat("func", i) + '\0';
+  }
+  int strtab_index = elf.AddSection(".strtab", SHT_STRTAB, 0, 0, strtab);
+  elf.AddSection(".symtab", SHT_SYMTAB, 0, 0, symtab, strtab_index,
+                 sizeof(Elf64_Sym));
+  return elf.Build();
+}
+
+// A compilation unit whose DIEs first nest |n| declarations deep (all of which
+// are skipped with SkipChildren()) and then list |n| sibling functions.
+static std::string MakeDwarfElf(int n) {
+  enum { kCompileUnit = 1, kDeclaration = 2, kFunction = 3 };
+  std::string abbrev;
+  auto add_abbrev = [&](int code, int tag, bool children,
+                        std::vector<std::pair<int, int>> attrs) {
+    AppendULEB128(code, &abbrev);
+    AppendULEB128(tag, &abbrev);
+    abbrev.push_back(children ? 1 : 0);  // DW_CHILDREN_yes / DW_CHILDREN_no
+    for (auto attr : attrs) {
+      AppendULEB128(attr.first, &abbrev);
+      AppendULEB128(attr.second, &abbrev);
+    }
+    abbrev.append(2, '\0');
+  };
+  add_abbrev(kCompileUnit, DW_TAG_compile_unit, true,
+             {{DW_AT_name, DW_FORM_string},
+              {DW_AT_low_pc, DW_FORM_addr},
+              {DW_AT_high_pc, DW_FORM_data4}});
+  add_abbrev(kDeclaration, DW_TAG_subprogram, true,
+             {{DW_AT_declaration, DW_FORM_flag_present}});
+  add_abbrev(kFunction, DW_TAG_subprogram, false,
+             {{DW_AT_name, DW_FORM_string},
+              {DW_AT_low_pc, DW_FORM_addr},
+              {DW_AT_high_pc, DW_FORM_data4}});
+  abbrev.push_back('\0');
+
+  std::string dies;
+  AppendULEB128(kCompileUnit, &dies);
+  dies += std::string("scaling.c") + '\0';
+  Append<uint64_t>(kTextAddr, &dies);
+  Append<uint32_t>(16 * n, &dies);
+  for (int i = 0; i < n; i++) {
+    AppendULEB128(kDeclaration, &dies);
+  }
+  dies.append(n, '\0');
+  for (int i = 0; i < n; i++) {
+    AppendULEB128(kFunction, &dies);
+    dies += absl::StrCat("func", i) + '\0';
+    Append<uint64_t>(kTextAddr + 16 * i, &dies);
+    Append<uint32_t>(16, &dies);
+  }
+  dies.push_back('\0');
+
+  std::string info;
+  Append<uint32_t>(2 + 4 + 1 + dies.size(), &info);
+  Append<uint16_t>(4, &info);
+  Append<uint32_t>(0, &info);
+  info.push_back(8);
+  info += dies;
+
+  ElfBuilder elf;
+  elf.AddSection(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, kTextAddr,
+                 std::string(16 * n, '\x90'));
+  elf.AddSection(".debug_abbrev", SHT_PROGBITS, 0, 0, abbrev);
+  elf.AddSection(".debug_info", SHT_PROGBITS, 0, 0, info);
+  return elf.Build();
+}
+
+// Mach-O ///////////////////////////////////////////////////////////////////////
+
+// |n| LC_SEGMENT_64 load commands, each mapping 16 bytes.
+static std::string MakeManySegmentsMachO(int n) {
+  size_t data_start =
+      sizeof(mach_header_64) + n * sizeof(segment_command_64);
+
+  mach_header_64 header = {};
+  header.magic = MH_MAGIC_64;
+  header.cputype = CPU_TYPE_X86_64;
+  header.filetype = MH_EXECUTE;
+  header.ncmds = n;
+  header.sizeofcmds = n * sizeof(segment_command_64);
+
+  std::string ret;
+  Append(header, &ret);
+  for (int i = 0; i < n; i++) {
+    segment_command_64 segment = {};
+    segment.cmd = LC_SEGMENT_64;
+    segment.cmdsize = sizeof(segment);
+    snprintf(segment.segname, sizeof(segment.segname), "SEG%d", i);
+    segment.vmaddr = kTextAddr + 16 * i;
+    segment.vmsize = 16;
+    segment.fileoff = data_start + 16 * i;
+    segment.filesize = 16;
+    Append(segment, &ret);
+  }
+  ret.append(16 * n, '\0');
+  return ret;
+}
+
+// WebAssembly //////////////////////////////////////////////////////////////////
+
+static void AppendWasmSection(int id, const std::string& contents,
+                              std::string* out) {
+  out->push_back(id);
+  AppendULEB128(contents.size(), out);
+  *out += contents;
+}
+
+// |n| functions in the code section, all named in the "name" section.
+static std::string MakeManyFunctionsWasm(int n,
+                                         const std::string& prefix = "func") {
+  std::string code;
+  AppendULEB128(n, &code);
+  for (int i = 0; i < n; i++) {
+    // Function body: no locals, "end".
+    AppendULEB128(2, &code);
+    code += std::string("\x00\x0b", 2);
+  }
+
+  std::string funcs;
+  AppendULEB128(n, &funcs);
+  for (int i = 0; i < n; i++) {
+    std::string name = absl::StrCat(prefix, i);
+    AppendULEB128(i, &funcs);
+    AppendULEB128(name.size(), &funcs);
+    funcs += name;
+  }
+  std::string names;
+  AppendULEB128(4, &names);
+  names += "name";
+  names.push_back(1);  // Function names.
+  AppendULEB128(funcs.size(), &names);
+  names += funcs;
+
+  std::string ret("\0asm\x01\0\0\0", 8);
+  AppendWasmSection(10, code, &ret);
+  AppendWasmSection(0, names, &ret);
+  return ret;
+}
+
+// Tests ////////////////////////////////////////////////////////////////////////
+
+TEST(ScalingTest, RangeMapOverlappingRanges) {
+  ExpectLinear(16384, [](int n) {
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(n));
+
+    RangeMap map;
+    for (int i : order) {
+      map.AddRange(8 * i, 64, absl::StrCat("range", i));
+    }
+    uint64_t total = 0;
+    RangeMap::ComputeRollup(
+        {&map}, [&total](const std::vector<std::string>&, uint64_t start,
+                         uint64_t end) { total += end - start; });
+    ASSERT_EQ(8 * n + 56, total);
+  });
+}
+
+TEST(ScalingTest, ElfOverlappingSymbols) {
+  ExpectLinear(4096, [](int n) {
+    std::string elf = MakeOverlappingSymbolsElf(n);
+    RunBloaty(elf, "symbols", n);
+  });
+}
+
+TEST(ScalingTest, ElfDwarfNestingAndSiblings) {
+  ExpectLinear(16384, [](int n) {
+    std::string elf = MakeDwarfElf(n);
+    RunBloaty(elf, "compileunits", 1);
+  });
+}
+
+TEST(ScalingTest, MachOManyLoadCommands) {
+  ExpectLinear(4096, [](int n) {
+    std::string macho = MakeManySegmentsMachO(n);
+    RunBloaty(macho, "segments", n);
+  });
+}
+
+TEST(ScalingTest, WasmManyFunctions) {
+  ExpectLinear(4096, [](int n) {
+    std::string wasm = MakeManyFunctionsWasm(n);
+    RunBloaty(wasm, "symbols", n);
+  });
+}
+
+TEST(ScalingTest, DiffManyFunctions) {
+  // Every function is only on one side, so each side's labels are all new to
+  // the other.
+  ExpectLinear(4096, [](int n) {
+    std::string wasm = MakeManyFunctionsWasm(n);
+    std::string base = MakeManyFunctionsWasm(n, "old_func");
+    RunBloatyDiff(wasm, base, "symbols", 2 * n - 20);
+  });
+}
+
+}  // namespace bloaty
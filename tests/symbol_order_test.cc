@@ -0,0 +1,140 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "symbol_order.h"
+
+#include <algorithm>
+#include <random>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace bloaty {
+
+using ::testing::ElementsAre;
+
+TEST(SymbolOrderTest, CalleeFollowsCaller) {
+  // 0 calls 2; 1 and 3 are never sampled.
+  std::vector<OrderedFunction> functions = {
+      {0x1000, 100, 50}, {0x1100, 3000, 0}, {0x2000, 100, 40},
+      {0x3000, 100, 0}};
+  ReferenceGraph calls(functions.size(), {{0, 2}, {1, 3}});
+  EXPECT_THAT(ComputeFunctionOrder(functions, calls, 4096),
+              ElementsAre(0, 2, 1, 3));
+}
+
+TEST(SymbolOrderTest, DensestFirst) {
+  // Nothing calls anything, so the clusters are single functions.
+  std::vector<OrderedFunction> functions = {
+      {0x1000, 1000, 10}, {0x2000, 10, 5}, {0x3000, 100, 0}, {0x4000, 100, 50}};
+  ReferenceGraph calls(functions.size(), {});
+  EXPECT_THAT(ComputeFunctionOrder(functions, calls, 4096),
+              ElementsAre(1, 3, 0, 2));
+}
+
+TEST(SymbolOrderTest, ClusterLimits) {
+  // Together, 0 and 1 would be larger than a page.
+  std::vector<OrderedFunction> functions = {{0x1000, 3000, 30},
+                                            {0x2000, 3000, 60}};
+  ReferenceGraph calls(functions.size(), {{0, 1}});
+  EXPECT_THAT(ComputeFunctionOrder(functions, calls, 4096), ElementsAre(1, 0));
+  EXPECT_THAT(ComputeFunctionOrder(functions, calls, 8192), ElementsAre(0, 1));
+
+  // Merging 1 into 0 would make 0's cluster far less dense, so 2 (which is
+  // denser than 1) goes between them.
+  functions = {{0x1000, 100, 1000}, {0x2000, 2000, 50}, {0x3000, 100, 5}};
+  ReferenceGraph calls2(functions.size(), {{0, 1}});
+  EXPECT_THAT(ComputeFunctionOrder(functions, calls2, 4096),
+              ElementsAre(0, 2, 1));
+  functions = {{0x1000, 100, 1000}, {0x2000, 1000, 500}, {0x3000, 100, 5}};
+  EXPECT_THAT(ComputeFunctionOrder(functions, calls2, 4096),
+              ElementsAre(0, 1, 2));
+
+  // A cold caller doesn't pull in a hot callee.
+  functions = {{0x1000, 100, 0}, {0x2000, 100, 50}};
+  EXPECT_THAT(ComputeFunctionOrder(functions, calls, 4096), ElementsAre(1, 0));
+}
+
+TEST(SymbolOrderTest, CallChain) {
+  // 3 -> 2 -> 1 -> 0, all equally hot: each one is placed after its caller.
+  std::vector<OrderedFunction> functions = {
+      {0x1000, 100, 10}, {0x2000, 100, 10}, {0x3000, 100, 10},
+      {0x4000, 100, 10}};
+  ReferenceGraph calls(functions.size(), {{3, 2}, {2, 1}, {1, 0}});
+  EXPECT_THAT(ComputeFunctionOrder(functions, calls, 4096),
+              ElementsAre(3, 2, 1, 0));
+}
+
+TEST(SymbolOrderTest, LayOutAndCountPages) {
+  std::vector<OrderedFunction> functions = {
+      {0x1000, 0x10, 1}, {0x1010, 0x2000, 0}, {0x3010, 0x8, 1},
+      {0x3024, 0x4, 0}};
+  std::vector<uint64_t> addrs;
+  for (const auto& function : functions) {
+    addrs.push_back(function.vmaddr);
+  }
+  EXPECT_EQ(2, CountHotPages(functions, addrs, 0x1000));
+
+  // Each function keeps its alignment (up to 64 bytes).
+  addrs = LayOutFunctions(functions, {0, 2, 3, 1}, 0x1000);
+  EXPECT_THAT(addrs, ElementsAre(0x1000, 0x1020, 0x1010, 0x1018));
+  EXPECT_EQ(1, CountHotPages(functions, addrs, 0x1000));
+
+  // A function that spans pages counts every page it touches, once.
+  functions = {{0x1ff0, 0x1020, 1}, {0x2800, 0x10, 1}};
+  addrs = {0x1ff0, 0x2800};
+  EXPECT_EQ(3, CountHotPages(functions, addrs, 0x1000));
+}
+
+TEST(SymbolOrderTest, Scale) {
+  // A large random call graph, with a few hot functions.
+  const uint32_t n = 200000;
+  std::mt19937 rng(1);
+  std::vector<OrderedFunction> functions;
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t samples = rng() % 10 == 0 ? rng() % 1000 + 1 : 0;
+    functions.push_back({i * 64ULL, rng() % 200 + 1, samples});
+  }
+  std::vector<std::pair<uint32_t, uint32_t>> edges;
+  for (uint32_t i = 0; i < 4 * n; i++) {
+    edges.push_back({rng() % n, rng() % n});
+  }
+  ReferenceGraph calls(n, edges);
+
+  std::vector<uint32_t> order = ComputeFunctionOrder(functions, calls, 4096);
+  ASSERT_EQ(n, order.size());
+
+  // Every function appears once, and the hot ones all come first.
+  std::vector<bool> seen(n, false);
+  bool saw_cold = false;
+  for (uint32_t i : order) {
+    ASSERT_FALSE(seen[i]);
+    seen[i] = true;
+    if (functions[i].samples == 0) {
+      saw_cold = true;
+    } else {
+      ASSERT_FALSE(saw_cold);
+    }
+  }
+
+  std::vector<uint64_t> before;
+  for (const auto& function : functions) {
+    before.push_back(function.vmaddr);
+  }
+  std::vector<uint64_t> after = LayOutFunctions(functions, order, 0);
+  EXPECT_LT(CountHotPages(functions, after, 4096),
+            CountHotPages(functions, before, 4096));
+}
+
+}  // namespace bloaty
@@ -0,0 +1,119 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "template_family.h"
+
+#include "gtest/gtest.h"
+
+namespace bloaty {
+
+static std::string Family(const char* symbol) {
+  std::string family;
+  if (!TemplateFamily(symbol, &family)) {
+    return "<fail>";
+  }
+  return family;
+}
+
+TEST(TemplateFamilyTest, Instantiations) {
+  // std::vector<int>::push_back(int const&)
+  EXPECT_EQ("std::vector<*>::push_back",
+            Family("_ZNSt6vectorIiSaIiEE9push_backERKi"));
+  // std::vector<char*>::push_back(char*&&)
+  EXPECT_EQ("std::vector<*>::push_back",
+            Family("_ZNSt6vectorIPcSaIS0_EE9push_backEOS0_"));
+  // Mach-O adds an underscore.
+  EXPECT_EQ("std::vector<*>::push_back",
+            Family("__ZNSt6vectorIiSaIiEE9push_backERKi"));
+
+  // int max<int>(int, int)
+  EXPECT_EQ("max<*>", Family("_Z3maxIiET_S0_S0_"));
+  // ns::Map<int, std::string>::Find<char const*>(char const*) const
+  EXPECT_EQ("ns::Map<*>::Find<*>",
+            Family("_ZNK2ns3MapIiSsE4FindIPKcEEbT_"));
+}
+
+TEST(TemplateFamilyTest, Substitutions) {
+  // Foo<Bar>::Baz<Foo<Bar> >::Run()
+  EXPECT_EQ("Foo<*>::Baz<*>::Run", Family("_ZN3FooI3BarE3BazIS1_E3RunEv"));
+  // std::basic_string<...>::append(...)
+  EXPECT_EQ("std::basic_string<*>::append",
+            Family("_ZNSbIwSt11char_traitsIwESaIwEE6appendEPKwm"));
+  // std::string::size() const
+  EXPECT_EQ("std::string::size", Family("_ZNKSs4sizeEv"));
+  // a::B<int>::g(a::B<int>)
+  EXPECT_EQ("a::B<*>::g", Family("_ZN1a1BIiE1gENS0_IiEE"));
+}
+
+TEST(TemplateFamilyTest, CtorsAndDtors) {
+  EXPECT_EQ("std::vector<*>::vector",
+            Family("_ZNSt6vectorIiSaIiEEC2Ev"));
+  EXPECT_EQ("std::vector<*>::~vector",
+            Family("_ZNSt6vectorIiSaIiEED1Ev"));
+  EXPECT_EQ("Foo::~Foo", Family("_ZN3FooD0Ev"));
+  // A lambda in ns::Foo::Foo(), passed to std::sort(), names the class with
+  // a substitution.
+  EXPECT_EQ("std::sort<*>", Family("_ZSt4sortIN2ns3FooEZNS1_C4EvEUlvE_EvT_"));
+}
+
+TEST(TemplateFamilyTest, Operators) {
+  EXPECT_EQ("Foo<*>::operator=", Family("_ZN3FooIiEaSERKS0_"));
+  EXPECT_EQ("std::function<*>::operator()",
+            Family("_ZNKSt8functionIFviEEclEi"));
+  EXPECT_EQ("operator new", Family("_Znwm"));
+  EXPECT_EQ("Foo::operator cast", Family("_ZNK3FoocvbEv"));
+}
+
+TEST(TemplateFamilyTest, LocalNames) {
+  // Foo<int>::Run()::{lambda()#1}::operator()() const
+  EXPECT_EQ("Foo<*>::Run::{lambda}::operator()",
+            Family("_ZZN3FooIiE3RunEvENKUlvE_clEv"));
+  // f()::counter
+  EXPECT_EQ("f::counter", Family("_ZZ1fvE7counter"));
+  EXPECT_EQ("f::counter", Family("_ZZ1fvE7counter_0"));
+  EXPECT_EQ("(anonymous namespace)::Helper",
+            Family("_ZN12_GLOBAL__N_16HelperEv"));
+}
+
+TEST(TemplateFamilyTest, SpecialNames) {
+  EXPECT_EQ("vtable for Foo<*>", Family("_ZTV3FooIiE"));
+  EXPECT_EQ("typeinfo for std::vector<*>",
+            Family("_ZTISt6vectorIiSaIiEE"));
+  EXPECT_EQ("guard variable for Foo<*>::instance",
+            Family("_ZGVN3FooIiE8instanceE"));
+  EXPECT_EQ("vtable for std::ostream", Family("_ZTVSo"));
+  EXPECT_EQ("non-virtual thunk to Foo<*>::Run",
+            Family("_ZThn8_N3FooIiE3RunEv"));
+}
+
+TEST(TemplateFamilyTest, NotMangled) {
+  EXPECT_EQ("<fail>", Family("main"));
+  EXPECT_EQ("<fail>", Family("_Z"));
+  EXPECT_EQ("<fail>", Family("_Z999foo"));
+  EXPECT_EQ("<fail>", Family("_ZN3FooIiE"));
+  // S_ is a pointer type here, not a name.
+  EXPECT_EQ("<fail>", Family("_ZZ1fPiENS_1gE"));
+  EXPECT_EQ("<fail>", Family("_ZNS5_3fooEv"));
+}
+
+TEST(TemplateFamilyTest, DeepNesting) {
+  std::string symbol = "_Z1fI";
+  for (int i = 0; i < 10000; i++) {
+    symbol += "P";
+  }
+  symbol += "iEvv";
+  EXPECT_EQ("<fail>", Family(symbol.c_str()));
+}
+
+}  // namespace bloaty
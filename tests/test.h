@@ -15,7 +15,11 @@
 #ifndef BLOATY_TESTS_TEST_H_
 #define BLOATY_TESTS_TEST_H_
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <fstream>
+#include <iterator>
 #include <memory>
 #include <string>
 #include <unordered_set>
@@ -47,6 +51,57 @@ inline bool GetFileSize(const std::string& filename, uint64_t* size) {
   return true;
 }
 
+// Returns the total size of the member files of |filename| if it is a thin
+// archive, whose members are scanned as files of their own, or 0 otherwise.
+inline uint64_t GetThinArchiveMemberSize(const std::string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  if (data.compare(0, 8, "!<thin>\n") != 0) {
+    return 0;
+  }
+
+  size_t slash = filename.rfind('/');
+  std::string dir =
+      slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+  std::string long_names;
+  uint64_t total = 0;
+  size_t pos = 8;
+  while (pos + 60 <= data.size()) {
+    std::string name = data.substr(pos, 16);
+    name = name.substr(0, name.find(' '));
+    uint64_t size = strtoull(data.substr(pos + 48, 10).c_str(), nullptr, 10);
+    pos += 60;
+
+    // Only the symbol table and the long name table are stored in the
+    // archive itself.
+    if (name == "/" || name == "/SYM64/" || name == "//") {
+      if (name == "//") {
+        long_names = data.substr(pos, size);
+      }
+      pos += size + size % 2;
+      continue;
+    }
+
+    std::string path;
+    if (name.size() > 1 && name[0] == '/') {
+      size_t offset = strtoul(name.c_str() + 1, nullptr, 10);
+      path = long_names.substr(offset,
+                               long_names.find("/\n", offset) - offset);
+    } else {
+      path = name.substr(0, name.find('/'));
+    }
+    if (path[0] != '/') {
+      path = dir + path;
+    }
+    uint64_t member_size;
+    if (GetFileSize(path, &member_size)) {
+      total += member_size;
+    }
+  }
+  return total;
+}
+
 inline std::string GetTestDirectory() {
   char pathbuf[PATH_MAX];
   if (!getcwd(pathbuf, sizeof(pathbuf))) {
@@ -80,9 +135,15 @@ class BloatyTest : public ::testing::Test {
     if (row.sorted_children.size() > 0) {
       uint64_t vmtotal = 0;
       uint64_t filetotal = 0;
+      int64_t samples = 0;
+      int64_t relocs = 0;
+      int64_t compressed = 0;
       for (const auto& child : row.sorted_children) {
         vmtotal += child.size.vm;
         filetotal += child.size.file;
+        samples += child.samples;
+        relocs += child.relocs;
+        compressed += child.compressed;
         CheckConsistencyForRow(child, false, diff_mode, count);
         ASSERT_TRUE(names.insert(child.name).second);
         ASSERT_FALSE(child.size.vm == 0 && child.size.file == 0);
@@ -91,9 +152,13 @@ class BloatyTest : public ::testing::Test {
       if (!diff_mode) {
         ASSERT_EQ(vmtotal, row.size.vm);
         ASSERT_EQ(filetotal, row.size.file);
+        ASSERT_EQ(samples, row.samples);
+        ASSERT_EQ(relocs, row.relocs);
+        ASSERT_EQ(compressed, row.compressed);
       }
-    } else {
-      // Count leaf rows.
+    } else if (!is_toplevel) {
+      // Count leaf rows.  A top-level row without children (when
+      // --source-filter matches nothing) has no rows in the CSV output.
       *count += 1;
     }
 
@@ -117,6 +182,10 @@ class BloatyTest : public ::testing::Test {
     ASSERT_GT(rows.size(), 0);  // There should be a header row.
 
     ASSERT_EQ(rows.size() - 1, row_count);
+    size_t size_cols = 2;
+    if (output_->show_samples()) size_cols += 2;
+    if (output_->show_relocs()) size_cols += 1;
+    if (output_->show_compressed()) size_cols += 1;
     bool first = true;
     for (const auto& row : rows) {
       std::vector<std::string> cols = absl::StrSplit(row, ',');
@@ -125,29 +194,71 @@ class BloatyTest : public ::testing::Test {
         std::vector<std::string> expected_headers(output_->source_names());
         expected_headers.push_back("vmsize");
         expected_headers.push_back("filesize");
+        if (output_->show_compressed()) {
+          expected_headers.push_back("compressedsize");
+        }
+        if (output_->show_samples()) {
+          expected_headers.push_back("samples");
+          expected_headers.push_back("bytes_per_sample");
+        }
+        if (output_->show_relocs()) {
+          expected_headers.push_back("relocs");
+        }
         ASSERT_EQ(cols, expected_headers);
         first = false;
       } else {
-        // Final two columns should parse as integer.
+        // The size columns (and sample/reloc counts) should parse as integer.
         int out;
-        ASSERT_EQ(output_->source_names().size() + 2, cols.size());
-        ASSERT_TRUE(absl::SimpleAtoi(cols[cols.size() - 1], &out));
-        ASSERT_TRUE(absl::SimpleAtoi(cols[cols.size() - 2], &out));
+        size_t sizes = output_->source_names().size();
+        ASSERT_EQ(sizes + size_cols, cols.size());
+        ASSERT_TRUE(absl::SimpleAtoi(cols[sizes], &out));
+        ASSERT_TRUE(absl::SimpleAtoi(cols[sizes + 1], &out));
+        size_t col = sizes + 2;
+        if (output_->show_compressed()) {
+          ASSERT_TRUE(absl::SimpleAtoi(cols[col++], &out));
+        }
+        if (output_->show_samples()) {
+          ASSERT_TRUE(absl::SimpleAtoi(cols[col], &out));
+        }
+        if (output_->show_relocs()) {
+          ASSERT_TRUE(absl::SimpleAtoi(cols[cols.size() - 1], &out));
+        }
       }
     }
   }
 
   void CheckConsistency(const bloaty::Options& options) {
-    ASSERT_EQ(options.base_filename_size() > 0, output_->diff_mode());
+    if (options.has_write_partial() || options.has_symbol_ordering_file() ||
+        options.has_disassemble_function() ||
+        options.has_disassemble_regex()) {
+      // No report is produced.
+      return;
+    }
 
-    if (!output_->diff_mode()) {
-      size_t total_input_size = 0;
+    // A merge gets diff mode from its partials, not from base files.
+    if (!options.merge()) {
+      ASSERT_EQ(options.base_filename_size() > 0, output_->diff_mode());
+    }
+
+    // Sharded and merged runs don't cover exactly the given files.
+    if (!output_->diff_mode() && !options.merge() &&
+        options.shard_count() <= 1) {
+      uint64_t total_input_size = 0;
+      uint64_t thin_member_size = 0;
       for (const auto& filename : options.filename()) {
         uint64_t size;
         ASSERT_TRUE(GetFileSize(filename, &size));
         total_input_size += size;
+        thin_member_size += GetThinArchiveMemberSize(filename);
+      }
+      uint64_t total = top_row_->size.file + top_row_->filtered_size.file;
+      if (options.has_source_filter() && thin_member_size > 0) {
+        // The member files that the filter rules out aren't opened at all.
+        ASSERT_GE(total, total_input_size);
+        ASSERT_LE(total, total_input_size + thin_member_size);
+      } else {
+        ASSERT_EQ(total, total_input_size + thin_member_size);
       }
-      ASSERT_EQ(top_row_->size.file, total_input_size);
     }
 
     int rows = 0;
@@ -0,0 +1,4 @@
+# Sampled PCs of 05-binary.bin, one address and count per line.
+4004f0 10
+400512
+400513 2
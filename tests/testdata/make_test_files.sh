@@ -53,6 +53,13 @@ function make_ar() {
   publish $FILE
 }
 
+function make_bsd_ar() {
+  FILE=$1
+  shift
+  ${LLVM_AR:-llvm-ar} rcs --format=bsd $FILE "$@"
+  publish $FILE
+}
+
 function make_so() {
   FILE=$1
   shift
@@ -118,3 +125,34 @@ make_ar "06-diff.a" "foo2.o" "bar.o" "a_filename_longer_than_sixteen_chars.o"
 cp "05-binary.bin" "07-binary-stripped.bin"
 strip "07-binary-stripped.bin"
 publish "07-binary-stripped.bin"
+
+make_bsd_ar "08-bsd.a" "foo.o" "bar.o" "a_filename_longer_than_sixteen_chars.o"
+
+# Functions with identical code at different addresses, for the "icf" data
+# source.  It doesn't need libc, so it is linked without it.
+cat > identical.c <<EOF
+int counter;
+int scale[4] = {1, 2, 3, 5};
+
+__attribute__((noinline)) int helper(int x) { return x * scale[x & 3] + counter; }
+__attribute__((noinline)) int helper2(int x) { return x * scale[x & 3] + counter; }
+
+__attribute__((noinline)) int twice_a(int x) { return helper(x) + helper(x + 1); }
+__attribute__((noinline)) int twice_b(int x) { return helper(x) + helper(x + 1); }
+__attribute__((noinline)) int twice_c(int x) { return helper(x) + helper(x + 1); }
+__attribute__((noinline)) int twice_d(int x) { return helper2(x) + helper2(x + 1); }
+__attribute__((noinline)) int twice_diff(int x) { return helper(x) - helper(x + 1); }
+
+void _start(void) {
+  counter = twice_a(1) + twice_b(2) + twice_c(3) + twice_d(4) + twice_diff(5);
+  for (;;) {
+  }
+}
+EOF
+make_binary "10-identical.bin" -O1 -fno-ipa-icf -fno-pie -no-pie -nostdlib \
+  -static identical.c
+
+# A thin archive refers to its members by their paths, so it is made next to
+# the members it refers to.
+(cd $OUTPUT_DIR && ar rcsT "09-thin.a" "01-empty.o" "02-simple.o" &&
+  echo "09-thin.a")
@@ -0,0 +1,214 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util.h"
+
+#include "dwarf/dwarf_util.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace bloaty {
+
+// Straightforward byte-at-a-time encoder to check the decoder against.
+static std::string EncodeLEB128(uint64_t val, bool is_signed) {
+  std::string ret;
+  while (true) {
+    uint8_t byte = val & 0x7f;
+    if (is_signed) {
+      val = static_cast<int64_t>(val) >> 7;
+      bool done = (val == 0 && !(byte & 0x40)) ||
+                  (val == UINT64_MAX && (byte & 0x40));
+      if (done) {
+        ret.push_back(byte);
+        return ret;
+      }
+    } else {
+      val >>= 7;
+      if (val == 0) {
+        ret.push_back(byte);
+        return ret;
+      }
+    }
+    ret.push_back(byte | 0x80);
+  }
+}
+
+static void CheckRoundTrip(uint64_t val, bool is_signed) {
+  std::string encoded = EncodeLEB128(val, is_signed);
+
+  // Once at the end of the buffer (slow path) and once followed by padding
+  // (word-at-a-time path).
+  for (size_t padding : {0, 1, 7, 16}) {
+    std::string buf = encoded + std::string(padding, '\xff');
+    absl::string_view data = buf;
+    EXPECT_EQ(val, ReadLEB128Internal(is_signed, 64, &data, "test"))
+        << "val=" << val << " padding=" << padding;
+    EXPECT_EQ(padding, data.size());
+
+    data = buf;
+    SkipLEB128(&data, "test");
+    EXPECT_EQ(padding, data.size());
+  }
+}
+
+TEST(LEB128Test, RoundTrip) {
+  for (int bit = 0; bit < 64; bit++) {
+    uint64_t val = 1ULL << bit;
+    for (uint64_t v : {val - 1, val, val + 1, ~val, -val}) {
+      CheckRoundTrip(v, false);
+      CheckRoundTrip(v, true);
+    }
+  }
+  CheckRoundTrip(0, false);
+  CheckRoundTrip(UINT64_MAX, false);
+  CheckRoundTrip(INT64_MIN, true);
+  CheckRoundTrip(INT64_MAX, true);
+}
+
+TEST(LEB128Test, SignExtension) {
+  // -2 as a one-byte and as a padded two-byte varint.
+  for (std::string buf : {std::string("\x7e"), std::string("\xfe\x7f")}) {
+    absl::string_view data = buf;
+    EXPECT_EQ(static_cast<uint64_t>(-2),
+              ReadLEB128Internal(true, 64, &data, "test"));
+    data = buf;
+    EXPECT_EQ(buf.size() == 1 ? 0x7eU : 0x3ffeU,
+              ReadLEB128Internal(false, 64, &data, "test"));
+  }
+
+  // No sign extension once the encoding covers the requested width.
+  std::string buf("\x7f");
+  absl::string_view data = buf;
+  EXPECT_EQ(0x7fU, ReadLEB128Internal(true, 7, &data, "test"));
+}
+
+// The message of the error that |f| throws.
+template <class F>
+static std::string ErrorMessage(F f) {
+  try {
+    f();
+  } catch (const bloaty::Error& e) {
+    return e.what();
+  }
+  return "no error";
+}
+
+TEST(LEB128Test, Unterminated) {
+  // Short enough for the byte loop, and long enough for the word path to
+  // give up on.
+  for (size_t len : {3, 16}) {
+    std::string buf(len, '\x80');
+    absl::string_view data = buf;
+    EXPECT_EQ("corrupt DWARF data, unterminated LEB128", ErrorMessage([&]() {
+                ReadLEB128Internal(false, 64, &data, "DWARF");
+              }));
+    data = buf;
+    EXPECT_EQ("corrupt wasm data, unterminated LEB128",
+              ErrorMessage([&]() { SkipLEB128(&data, "wasm"); }));
+    data = buf;
+    EXPECT_EQ("corrupt DWARF data, unterminated LEB128",
+              ErrorMessage([&]() { dwarf::ReadLEB128<uint32_t>(&data); }));
+  }
+}
+
+// Microbenchmarks of the three decoding paths, against the byte-at-a-time loop
+// that the DWARF and WebAssembly readers used before.  They only report their
+// timings, so they are disabled by default.  Run them (in an optimized build)
+// with:
+//
+//   util_test --gtest_also_run_disabled_tests --gtest_filter='*Benchmark*'
+
+// The loop that ReadLEB128Internal() replaced.
+static uint64_t ReadLEB128ByteAtATime(bool is_signed, absl::string_view* data) {
+  uint64_t ret = 0;
+  int shift = 0;
+  const char* ptr = data->data();
+  const char* limit = ptr + data->size();
+
+  while (ptr < limit && shift < 70) {
+    char byte = *(ptr++);
+    ret |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    shift += 7;
+    if ((byte & 0x80) == 0) {
+      data->remove_prefix(ptr - data->data());
+      if (is_signed && shift < 64 && (byte & 0x40)) {
+        ret |= -(1ULL << shift);
+      }
+      return ret;
+    }
+  }
+
+  THROW("unterminated LEB128");
+}
+
+// Returns how many nanoseconds |decode| takes per varint to read all of
+// |buf|, and adds up the values it returns in |sum|.
+template <class Func>
+static double TimeDecoding(const std::string& buf, size_t count, Func&& decode,
+                           uint64_t* sum) {
+  const int kRounds = 200;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; i++) {
+    absl::string_view data = buf;
+    while (!data.empty()) {
+      *sum += decode(&data);
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (kRounds * count);
+}
+
+// Decodes 100,000 signed varints with values in [min, max) both ways.
+static void BenchmarkLEB128(uint64_t min, uint64_t max) {
+  const size_t kCount = 100000;
+  std::mt19937_64 rng(0);
+  std::uniform_int_distribution<uint64_t> dist(min, max - 1);
+  std::string buf;
+  for (size_t i = 0; i < kCount; i++) {
+    buf += EncodeLEB128(dist(rng), true);
+  }
+
+  uint64_t sum = 0;
+  uint64_t expected_sum = 0;
+  double word_ns = TimeDecoding(buf, kCount, [](absl::string_view* data) {
+    return ReadLEB128Internal(true, 64, data, "test");
+  }, &sum);
+  double byte_ns = TimeDecoding(buf, kCount, [](absl::string_view* data) {
+    return ReadLEB128ByteAtATime(true, data);
+  }, &expected_sum);
+  EXPECT_EQ(expected_sum, sum);
+
+  std::cout << "values in [" << min << ", " << max << "), "
+            << buf.size() / static_cast<double>(kCount) << " bytes each: "
+            << word_ns << " ns/varint (byte at a time: " << byte_ns
+            << " ns/varint)\n";
+}
+
+TEST(LEB128Test, DISABLED_BenchmarkOneByte) { BenchmarkLEB128(0, 1 << 6); }
+
+TEST(LEB128Test, DISABLED_BenchmarkShort) {
+  BenchmarkLEB128(1 << 6, 1 << 20);
+}
+
+TEST(LEB128Test, DISABLED_BenchmarkLong) {
+  BenchmarkLEB128(1ULL << 27, 1ULL << 55);
+}
+
+}  // namespace bloaty